@@ -57,6 +57,7 @@ struct per_dev_info {
 	unsigned long long seq_skips;
 	unsigned int max_depth[2];
 	unsigned int cur_depth[2];
+	unsigned int interval_depth[2];
 
 	struct rb_root rb_track;
 
@@ -86,6 +87,7 @@ static struct process_pid_map *ppm_hash_table[PPM_HASH_SIZE];
 struct per_process_info {
 	struct process_pid_map *ppm;
 	struct io_stats io_stats;
+	struct io_stats interval_stats;
 	struct per_process_info *hash_next, *list_next;
 	int more_than_one;
 
@@ -123,6 +125,24 @@ static struct option l_opts[] = {
 		.flag = NULL,
 		.val = 'b'
 	},
+	{
+		.name = "retain",
+		.has_arg = required_argument,
+		.flag = NULL,
+		.val = 'R'
+	},
+	{
+		.name = "filter",
+		.has_arg = required_argument,
+		.flag = NULL,
+		.val = 'e'
+	},
+	{
+		.name = "columnar",
+		.has_arg = required_argument,
+		.flag = NULL,
+		.val = 'C'
+	},
 	{
 		.name = "input-directory",
 		.has_arg = required_argument,
@@ -195,6 +215,18 @@ static struct option l_opts[] = {
 		.flag = NULL,
 		.val = 't'
 	},
+	{
+		.name = "interval-stats",
+		.has_arg = required_argument,
+		.flag = NULL,
+		.val = 'S'
+	},
+	{
+		.name = "interval",
+		.has_arg = required_argument,
+		.flag = NULL,
+		.val = 'T'
+	},
 	{
 		.name = "stopwatch",
 		.has_arg = required_argument,
@@ -280,13 +312,27 @@ int data_is_native = -1;
 
 static FILE *dump_fp;
 static char *dump_binary;
+static char *col_name;
 
 static unsigned int t_alloc_cache;
 static unsigned int bit_alloc_cache;
 
+static FILE *interval_fp;
+static char *interval_name;
+static unsigned long long interval_ns = 1000000000ULL;
+static unsigned long long interval_end;
+
 #define RB_BATCH_DEFAULT	(512)
 static unsigned int rb_batch = RB_BATCH_DEFAULT;
 
+/*
+ * Handled traces are kept per CPU for sequence look-backs. Only the
+ * most recent rb_retain of them are kept, older ones are released.
+ */
+#define RB_RETAIN_DEFAULT	(512)
+static unsigned int rb_retain = RB_RETAIN_DEFAULT;
+static unsigned long rb_last_total, rb_last_hwm;
+
 static int pipeline;
 static char *pipename;
 
@@ -783,6 +829,7 @@ static inline void __put_trace_last(struct per_dev_info *pdi, struct trace *t)
 
 	rb_erase(&t->rb_node, &pci->rb_last);
 	pci->rb_last_entries--;
+	rb_last_total--;
 
 	bit_free(t->bit);
 	t_free(t);
@@ -840,12 +887,20 @@ static int trace_rb_insert_last(struct per_dev_info *pdi, struct trace *t)
 {
 	struct per_cpu_info *pci = get_cpu_info(pdi, t->bit->cpu);
 
+	if (!rb_retain) {
+		bit_free(t->bit);
+		t_free(t);
+		return 0;
+	}
+
 	if (trace_rb_insert(t, &pci->rb_last))
 		return 1;
 
 	pci->rb_last_entries++;
+	if (++rb_last_total > rb_last_hwm)
+		rb_last_hwm = rb_last_total;
 
-	if (pci->rb_last_entries > rb_batch * pdi->nfiles) {
+	if (pci->rb_last_entries > rb_retain) {
 		struct rb_node *n = rb_first(&pci->rb_last);
 
 		t = rb_entry(n, struct trace, rb_node);
@@ -964,6 +1019,7 @@ static struct io_track *find_track(struct per_dev_info *pdi, pid_t pid,
 	iot = __find_track(pdi, sector);
 	if (!iot) {
 		iot = malloc(sizeof(*iot));
+		memset(iot, 0, sizeof(*iot));
 		iot->ppm = find_ppm(pid);
 		if (!iot->ppm)
 			iot->ppm = add_ppm_hash(pid, "unknown");
@@ -1519,6 +1575,8 @@ static void dump_trace_pc(struct blk_io_trace *t, struct per_dev_info *pdi,
 			pdi->cur_depth[w]++;
 			if (pdi->cur_depth[w] > pdi->max_depth[w])
 				pdi->max_depth[w] = pdi->cur_depth[w];
+			if (pdi->cur_depth[w] > pdi->interval_depth[w])
+				pdi->interval_depth[w] = pdi->cur_depth[w];
 			log_pc(pci, t, "D");
 			break;
 		case __BLK_TA_COMPLETE:
@@ -1581,6 +1639,8 @@ static void dump_trace_fs(struct blk_io_trace *t, struct per_dev_info *pdi,
 			pdi->cur_depth[w]++;
 			if (pdi->cur_depth[w] > pdi->max_depth[w])
 				pdi->max_depth[w] = pdi->cur_depth[w];
+			if (pdi->cur_depth[w] > pdi->interval_depth[w])
+				pdi->interval_depth[w] = pdi->cur_depth[w];
 			log_issue(pdi, pci, t, "D");
 			break;
 		case __BLK_TA_COMPLETE:
@@ -1619,9 +1679,130 @@ static void dump_trace_fs(struct blk_io_trace *t, struct per_dev_info *pdi,
 	}
 }
 
+/*
+ * Interval statistics: at the end of each interval, the change in every
+ * io_stats since the previous interval is written out as one line for
+ * each device, CPU and (with -s) process that saw activity.
+ */
+struct interval_row {
+	long long q[2], qb[2], d[2], db[2], c[2], cb[2], m[2];
+};
+
+#define IV_DIFF(f)	((long long)(now->f - last->f))
+#define IV_BYTES(f)	(IV_DIFF(f##_kb) * 1024 + IV_DIFF(f##_b))
+
+static int interval_diff(struct interval_row *r, struct io_stats *now,
+			 struct io_stats *last)
+{
+	r->q[0] = IV_DIFF(qreads);
+	r->q[1] = IV_DIFF(qwrites);
+	r->qb[0] = IV_BYTES(qread);
+	r->qb[1] = IV_BYTES(qwrite);
+	r->d[0] = IV_DIFF(ireads);
+	r->d[1] = IV_DIFF(iwrites);
+	r->db[0] = IV_BYTES(iread);
+	r->db[1] = IV_BYTES(iwrite);
+	r->c[0] = IV_DIFF(creads);
+	r->c[1] = IV_DIFF(cwrites);
+	r->cb[0] = IV_BYTES(cread);
+	r->cb[1] = IV_BYTES(cwrite);
+	r->m[0] = IV_DIFF(mreads);
+	r->m[1] = IV_DIFF(mwrites);
+
+	*last = *now;
+	return r->q[0] || r->q[1] || r->d[0] || r->d[1] ||
+		r->c[0] || r->c[1] || r->m[0] || r->m[1];
+}
+
+static void interval_add(struct interval_row *sum, struct interval_row *r)
+{
+	long long *s = (long long *) sum, *p = (long long *) r;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(*r) / sizeof(*p); i++)
+		s[i] += p[i];
+}
+
+static void interval_print(double start, char type, char *dev, char *id,
+			   struct interval_row *r, unsigned int *depth,
+			   char *comm)
+{
+	fprintf(interval_fp, "%.9f %c %s %s", start, type, dev, id);
+	fprintf(interval_fp, " %lld %lld %lld %lld", r->q[0], r->q[1],
+		r->qb[0], r->qb[1]);
+	fprintf(interval_fp, " %lld %lld %lld %lld", r->d[0], r->d[1],
+		r->db[0], r->db[1]);
+	fprintf(interval_fp, " %lld %lld %lld %lld", r->c[0], r->c[1],
+		r->cb[0], r->cb[1]);
+	fprintf(interval_fp, " %lld %lld", r->m[0], r->m[1]);
+	if (depth)
+		fprintf(interval_fp, " %u %u", depth[0], depth[1]);
+	else
+		fprintf(interval_fp, " - -");
+	fprintf(interval_fp, " %s\n", comm);
+}
+
+static void flush_interval(void)
+{
+	double start = (double)(interval_end - interval_ns) / 1.0e9;
+	struct per_process_info *ppi;
+	struct interval_row row, dev_row;
+	char dev[32], id[32];
+	int i, j, active;
+
+	for (i = 0; i < ndevices; i++) {
+		struct per_dev_info *pdi = &devices[i];
+
+		get_dev_name(pdi, dev, sizeof(dev));
+		memset(&dev_row, 0, sizeof(dev_row));
+		active = 0;
+
+		for (j = 0; j < pdi->ncpus; j++) {
+			struct per_cpu_info *pci = &pdi->cpus[j];
+
+			if (!interval_diff(&row, &pci->io_stats,
+					   &pci->interval_stats))
+				continue;
+
+			snprintf(id, sizeof(id), "%d", j);
+			interval_print(start, 'C', dev, id, &row, NULL, "-");
+			interval_add(&dev_row, &row);
+			active = 1;
+		}
+
+		if (active)
+			interval_print(start, 'D', dev, "-", &dev_row,
+				       pdi->interval_depth, "-");
+
+		pdi->interval_depth[0] = pdi->cur_depth[0];
+		pdi->interval_depth[1] = pdi->cur_depth[1];
+	}
+
+	for (ppi = ppi_list; ppi; ppi = ppi->list_next) {
+		if (!interval_diff(&row, &ppi->io_stats, &ppi->interval_stats))
+			continue;
+
+		snprintf(id, sizeof(id), "%d", ppi->ppm->pid);
+		interval_print(start, 'P', "-", id, &row, NULL, ppi->ppm->comm);
+	}
+}
+
+/*
+ * Write out the interval that just ended and skip any empty ones up to
+ * the one holding time
+ */
+static void next_interval(unsigned long long time)
+{
+	flush_interval();
+	interval_end += ((time - interval_end) / interval_ns + 1) * interval_ns;
+}
+
 static void dump_trace(struct blk_io_trace *t, struct per_cpu_info *pci,
 		       struct per_dev_info *pdi)
 {
+	if (interval_fp && t->time >= interval_end)
+		next_interval(t->time);
+
 	if (text_output) {
 		if (t->action == BLK_TN_MESSAGE)
 			handle_notify(t);
@@ -1636,6 +1817,9 @@ static void dump_trace(struct blk_io_trace *t, struct per_cpu_info *pci,
 
 	pdi->events++;
 
+	if (col_name)
+		col_add(t);
+
 	if (bin_output_msgs ||
 			    !(t->action & BLK_TC_ACT(BLK_TC_NOTIFY) &&
 			      t->action == BLK_TN_MESSAGE))
@@ -2144,7 +2328,8 @@ static void show_entries_rb(int force)
 
 		pci->nelems++;
 
-		if (bit->action & (act_mask << BLK_TC_SHIFT))
+		if ((bit->action & (act_mask << BLK_TC_SHIFT)) &&
+		    filter_trace(bit))
 			dump_trace(bit, pci, pdi);
 
 		put_trace(pdi, t);
@@ -2372,90 +2557,158 @@ static void ms_sort(struct ms_stream *msp)
 	}
 }
 
-static int ms_prime(struct ms_stream *msp)
+/*
+ * A cpu's file is read in large pieces, and the headers of up to MS_BATCH
+ * records at a time copied out of them into one array, so that foreign
+ * ones are converted by a single traces_to_cpu() call
+ */
+#define MS_RBUF_SIZE	(512 * 1024)
+#define MS_BATCH	64
+
+/*
+ * Make len unread bytes available in pci's read buffer, moving what is
+ * left of it to the front first; 0 if the file ends (or fails) before
+ */
+static int ms_rbuf_fill(struct per_cpu_info *pci, int len)
 {
+	int left = pci->rbuf_len - pci->rbuf_off;
+	int ret;
+
+	if (!pci->rbuf)
+		pci->rbuf = malloc(MS_RBUF_SIZE);
+
+	memmove(pci->rbuf, pci->rbuf + pci->rbuf_off, left);
+	pci->rbuf_len = left;
+	pci->rbuf_off = 0;
+
+	while (pci->rbuf_len < len) {
+		ret = read(pci->fd, pci->rbuf + pci->rbuf_len,
+			   MS_RBUF_SIZE - pci->rbuf_len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			perror("read");
+		if (ret <= 0)
+			return 0;
+		pci->rbuf_len += ret;
+	}
+
+	return 1;
+}
+
+/*
+ * Take up to n whole records from pci's read buffer: each header is copied
+ * into hdrs, converted, and pdus pointed at its pdu (left in the buffer,
+ * so good until the next call). A batch stops short where the buffer
+ * needs refilling, or at a record that is not good; 0 means the file has
+ * nothing more to give.
+ */
+static int ms_read_batch(struct per_cpu_info *pci, struct blk_io_trace *hdrs,
+			 char **pdus, int n)
+{
+	int i, len, pdu_len;
 	__u32 magic;
-	unsigned int i;
-	struct trace *t;
-	struct per_dev_info *pdi = msp->pdi;
-	struct per_cpu_info *pci = get_cpu_info(pdi, msp->cpu);
-	struct blk_io_trace *bit = NULL;
-	int ret, pdu_len, ndone = 0;
 
-	for (i = 0; !is_done() && pci->fd >= 0 && i < rb_batch; i++) {
-		bit = bit_alloc();
-		ret = read_data(pci->fd, bit, sizeof(*bit), 1, &pci->fdblock);
-		if (ret)
-			goto err;
+	for (i = 0; i < n; i++) {
+		len = sizeof(*hdrs);
+		if (pci->rbuf_len - pci->rbuf_off < len &&
+		    (i || !ms_rbuf_fill(pci, len)))
+			break;
+		memcpy(&hdrs[i], pci->rbuf + pci->rbuf_off, len);
 
-		if (data_is_native == -1 && check_data_endianness(bit->magic))
-			goto err;
+		if (data_is_native == -1 &&
+		    check_data_endianness(hdrs[i].magic))
+			break;
 
-		magic = get_magic(bit);
+		magic = get_magic(&hdrs[i]);
 		if ((magic & 0xffffff00) != BLK_IO_TRACE_MAGIC) {
-			fprintf(stderr, "Bad magic %x\n", magic);
-			goto err;
-
+			if (!i)
+				fprintf(stderr, "Bad magic %x\n", magic);
+			break;
 		}
 
-		pdu_len = get_pdulen(bit);
-		if (pdu_len) {
-			void *ptr = realloc(bit, sizeof(*bit) + pdu_len);
-			ret = read_data(pci->fd, ptr + sizeof(*bit), pdu_len,
-							     1, &pci->fdblock);
-			if (ret) {
-				free(ptr);
-				bit = NULL;
-				goto err;
-			}
+		pdu_len = get_pdulen(&hdrs[i]);
+		len += pdu_len;
+		if (pci->rbuf_len - pci->rbuf_off < len &&
+		    (i || !ms_rbuf_fill(pci, len)))
+			break;
 
-			bit = ptr;
-		}
+		pdus[i] = pci->rbuf + pci->rbuf_off + sizeof(*hdrs);
+		pci->rbuf_off += len;
+	}
 
-		trace_to_cpu(bit);
-		if (verify_trace(bit))
+	traces_to_cpu(hdrs, i);
+	return i;
+}
+
+static int ms_prime(struct ms_stream *msp)
+{
+	struct blk_io_trace hdrs[MS_BATCH];
+	char *pdus[MS_BATCH];
+	unsigned int i = 0;
+	struct trace *t;
+	struct per_dev_info *pdi = msp->pdi;
+	struct per_cpu_info *pci = get_cpu_info(pdi, msp->cpu);
+	struct blk_io_trace *bit;
+	int j, n, ndone = 0;
+
+	while (!is_done() && pci->fd >= 0 && i < rb_batch) {
+		n = ms_read_batch(pci, hdrs, pdus, min(MS_BATCH, rb_batch - i));
+		if (!n)
 			goto err;
 
-		if (bit->cpu != pci->cpu) {
-			fprintf(stderr, "cpu %d trace info has error cpu %d\n",
-				pci->cpu, bit->cpu);
-			continue;
-		}
+		for (j = 0; j < n; j++) {
+			if (verify_trace(&hdrs[j]))
+				goto err;
 
-		if (bit->action & BLK_TC_ACT(BLK_TC_NOTIFY) && bit->action != BLK_TN_MESSAGE) {
-			handle_notify(bit);
-			output_binary(bit, sizeof(*bit) + bit->pdu_len);
-			bit_free(bit);
+			if (hdrs[j].cpu != pci->cpu) {
+				fprintf(stderr, "cpu %d trace info has error "
+					"cpu %d\n", pci->cpu, hdrs[j].cpu);
+				i++;
+				continue;
+			}
 
-			i -= 1;
-			continue;
-		}
+			bit = bit_alloc();
+			if (hdrs[j].pdu_len)
+				bit = realloc(bit, sizeof(*bit) +
+					      hdrs[j].pdu_len);
+			memcpy(bit, &hdrs[j], sizeof(*bit));
+			memcpy(bit + 1, pdus[j], bit->pdu_len);
+
+			if (bit->action & BLK_TC_ACT(BLK_TC_NOTIFY) && bit->action != BLK_TN_MESSAGE) {
+				handle_notify(bit);
+				output_binary(bit, sizeof(*bit) + bit->pdu_len);
+				bit_free(bit);
+				continue;
+			}
 
-		if (bit->time > pdi->last_read_time)
-			pdi->last_read_time = bit->time;
+			if (bit->time > pdi->last_read_time)
+				pdi->last_read_time = bit->time;
 
-		t = t_alloc();
-		memset(t, 0, sizeof(*t));
-		t->bit = bit;
+			t = t_alloc();
+			memset(t, 0, sizeof(*t));
+			t->bit = bit;
 
-		if (msp->first == NULL)
-			msp->first = msp->last = t;
-		else {
-			msp->last->next = t;
-			msp->last = t;
-		}
+			if (msp->first == NULL)
+				msp->first = msp->last = t;
+			else {
+				msp->last->next = t;
+				msp->last = t;
+			}
 
-		ndone++;
+			i++;
+			ndone++;
+		}
 	}
 
 	return ndone;
 
 err:
-	if (bit) bit_free(bit);
-
 	cpu_mark_offline(pdi, pci->cpu);
 	close(pci->fd);
 	pci->fd = -1;
+	free(pci->rbuf);
+	pci->rbuf = NULL;
 
 	return ndone;
 }
@@ -2539,7 +2792,7 @@ static int handle(struct ms_stream *msp)
 
 	pdi->last_reported_time = bit->time;
 	if ((bit->action & (act_mask << BLK_TC_SHIFT))&&
-	    t->bit->time >= stopwatch_start)
+	    t->bit->time >= stopwatch_start && filter_trace(bit))
 		dump_trace(bit, pci, pdi);
 
 	ms_deq(msp);
@@ -2672,6 +2925,15 @@ static void show_stats(void)
 	if (per_device_and_cpu_stats)
 		show_device_and_cpu_stats();
 
+	if (verbose)
+		fprintf(stderr, "Retained traces high-water mark: %lu\n",
+			rb_last_hwm);
+
+	if (interval_fp) {
+		flush_interval();
+		fflush(interval_fp);
+	}
+
 	fflush(ofp);
 }
 
@@ -2730,22 +2992,27 @@ static int is_pipe(const char *str)
 	return 0;
 }
 
-#define S_OPTS  "a:A:b:D:d:f:F:hi:o:Oqstw:vVM"
+#define S_OPTS  "a:A:b:C:D:d:e:f:F:hi:o:OqR:sS:tT:w:vVM"
 static char usage_str[] =    "\n\n" \
 	"-i <file>           | --input=<file>\n" \
 	"[ -a <action field> | --act-mask=<action field> ]\n" \
 	"[ -A <action mask>  | --set-mask=<action mask> ]\n" \
 	"[ -b <traces>       | --batch=<traces> ]\n" \
+	"[ -C <file>         | --columnar=<file> ]\n" \
 	"[ -d <file>         | --dump-binary=<file> ]\n" \
 	"[ -D <dir>          | --input-directory=<dir> ]\n" \
+	"[ -e <expr>         | --filter=<expr> ]\n" \
 	"[ -f <format>       | --format=<format> ]\n" \
 	"[ -F <spec>         | --format-spec=<spec> ]\n" \
 	"[ -h                | --hash-by-name ]\n" \
 	"[ -o <file>         | --output=<file> ]\n" \
 	"[ -O                | --no-text-output ]\n" \
 	"[ -q                | --quiet ]\n" \
+	"[ -R <traces>       | --retain=<traces> ]\n" \
 	"[ -s                | --per-program-stats ]\n" \
+	"[ -S <file>         | --interval-stats=<file> ]\n" \
 	"[ -t                | --track-ios ]\n" \
+	"[ -T <msec>         | --interval=<msec> ]\n" \
 	"[ -w <time>         | --stopwatch=<time> ]\n" \
 	"[ -M                | --no-msgs\n" \
 	"[ -v                | --verbose ]\n" \
@@ -2753,8 +3020,10 @@ static char usage_str[] =    "\n\n" \
 	"\t-a Only trace specified actions. See documentation\n" \
 	"\t-A Give trace mask as a single value. See documentation\n" \
 	"\t-b stdin read batching\n" \
+	"\t-C Write decoded events to file in a columnar binary layout\n" \
 	"\t-d Output file. If specified, binary data is written to file\n" \
 	"\t-D Directory to prepend to input file names\n" \
+	"\t-e Only show events matching the filter expression. See documentation\n" \
 	"\t-f Output format. Customize the output format. The format field\n" \
 	"\t   identifies can be found in the documentation\n" \
 	"\t-F Format specification. Can be found in the documentation\n" \
@@ -2763,9 +3032,13 @@ static char usage_str[] =    "\n\n" \
 	"\t-o Output file. If not given, output is stdout\n" \
 	"\t-O Do NOT output text data\n" \
 	"\t-q Quiet. Don't display any stats at the end of the trace\n" \
+	"\t-R Handled traces kept per CPU for sequence checks (0 keeps none)\n" \
 	"\t-s Show per-program io statistics\n" \
+	"\t-S Write per device, cpu (and with -s, per program) statistics for\n" \
+	"\t   each interval to file, or '-' for stdout\n" \
 	"\t-t Track individual ios. Will tell you the time a request took\n" \
 	"\t   to get queued, to get dispatched, and to get completed\n" \
+	"\t-T Length of the -S intervals in milliseconds (default 1000)\n" \
 	"\t-w Only parse data between the given time interval in seconds.\n" \
 	"\t   If 'start' isn't given, blkparse defaults the start time to 0\n" \
 	"\t-M Do not output messages to binary file\n" \
@@ -2806,6 +3079,10 @@ int main(int argc, char *argv[])
 			}
 			act_mask_tmp = i;
 			break;
+		case 'e':
+			if (add_filter(optarg))
+				return 1;
+			break;
 		case 'i':
 			if (is_pipe(optarg) && !pipeline) {
 				pipeline = 1;
@@ -2827,6 +3104,10 @@ int main(int argc, char *argv[])
 			if (rb_batch <= 0)
 				rb_batch = RB_BATCH_DEFAULT;
 			break;
+		case 'R':
+			i = atoi(optarg);
+			rb_retain = i < 0 ? RB_RETAIN_DEFAULT : i;
+			break;
 		case 's':
 			per_process_stats = 1;
 			break;
@@ -2840,6 +3121,19 @@ int main(int argc, char *argv[])
 			if (find_stopwatch_interval(optarg) != 0)
 				return 1;
 			break;
+		case 'S':
+			interval_name = optarg;
+			break;
+		case 'T': {
+			double msec = atof(optarg);
+
+			interval_ns = (unsigned long long)(msec * 1.0e6);
+			if (!(msec > 0) || !interval_ns) {
+				fprintf(stderr, "Invalid interval %s\n", optarg);
+				return 1;
+			}
+			break;
+		}
 		case 'f':
 			set_all_format_specs(optarg);
 			break;
@@ -2856,6 +3150,9 @@ int main(int argc, char *argv[])
 		case 'V':
 			printf("%s version %s\n", argv[0], blkparse_version);
 			return 0;
+		case 'C':
+			col_name = optarg;
+			break;
 		case 'd':
 			dump_binary = optarg;
 			break;
@@ -2882,6 +3179,12 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	/* the interval counts are kept as the text output is made */
+	if (interval_name && !text_output) {
+		fprintf(stderr, "-S cannot be used with -O\n");
+		return 1;
+	}
+
 	if (act_mask_tmp != 0)
 		act_mask = act_mask_tmp;
 
@@ -2935,6 +3238,27 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (interval_name) {
+		if (!strcmp(interval_name, "-"))
+			interval_fp = stdout;
+		else {
+			interval_fp = fopen(interval_name, "w");
+			if (!interval_fp) {
+				perror(interval_name);
+				return 1;
+			}
+		}
+		interval_end = interval_ns;
+		fprintf(interval_fp, "# time type dev id"
+			" q_r q_w q_r_bytes q_w_bytes"
+			" d_r d_w d_r_bytes d_w_bytes"
+			" c_r c_w c_r_bytes c_w_bytes"
+			" m_r m_w depth_r depth_w comm\n");
+	}
+
+	if (col_name && col_open(col_name))
+		return 1;
+
 	if (pipeline)
 		ret = do_fifo();
 	else
@@ -2943,6 +3267,8 @@ int main(int argc, char *argv[])
 	if (!ret)
 		show_stats();
 
+	col_close();
+
 	if (have_drv_data && !dump_binary)
 		printf("\ndiscarded traces containing low-level device driver "
 		       "specific data (only available in binary output)\n");
@@ -0,0 +1,207 @@
+/*
+ * This file contains the columnar export for blkparse. Decoded traces are
+ * gathered per column and written out in row groups, so readers can skip
+ * whole groups by their min/max values and read only the columns they
+ * need. All values are in the byte order of the machine that wrote the
+ * file, given by the byte order mark in the file header.
+ *
+ * file header:
+ *	char magic[8]		"BLKCOL01"
+ *	u32 bom			0x01020304
+ *	u32 ncols
+ *	ncols x { char name[8]; u32 width; }
+ *
+ * row group, repeated:
+ *	u32 magic		"RGRP"
+ *	u32 nrows
+ *	ncols x { u64 min; u64 max; }
+ *	ncols x column data, nrows * width bytes each, in header order
+ *
+ * footer:
+ *	u32 magic		"FOOT"
+ *	u32 ngroups
+ *	ngroups x u64		file offset of each row group
+ *	u64			file offset of the footer
+ *	char magic[8]		"BLKCOL01"
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "blktrace.h"
+
+#define COL_MAGIC	"BLKCOL01"
+#define COL_BOM		0x01020304
+#define COL_GROUP_ROWS	(64 * 1024)
+
+enum {
+	C_TIME, C_DEV, C_CPU, C_PID, C_ACTION, C_SECTOR, C_BYTES, C_ERROR,
+	C_MAX,
+};
+
+static struct col_info {
+	char name[8];
+	unsigned int width;
+} col_info[C_MAX] = {
+	{ "time", 8 },
+	{ "device", 4 },
+	{ "cpu", 4 },
+	{ "pid", 4 },
+	{ "action", 4 },
+	{ "sector", 8 },
+	{ "bytes", 4 },
+	{ "error", 2 },
+};
+
+static FILE *col_fp;
+static __u64 col_off;
+static unsigned int col_rows;
+static __u64 col_min[C_MAX], col_max[C_MAX];
+
+static __u64 *col_time, *col_sector;
+static __u32 *col_dev, *col_cpu, *col_pid, *col_action, *col_bytes;
+static __u16 *col_error;
+
+static __u64 *group_offs;
+static unsigned int ngroups, group_offs_size;
+
+static void col_write(void *buf, size_t len)
+{
+	if (len && fwrite(buf, len, 1, col_fp) != 1) {
+		perror("columnar output");
+		exit(1);
+	}
+	col_off += len;
+}
+
+int col_open(char *name)
+{
+	__u32 v;
+	int i;
+
+	if (!strcmp(name, "-"))
+		col_fp = stdout;
+	else {
+		col_fp = fopen(name, "w");
+		if (!col_fp) {
+			perror(name);
+			return 1;
+		}
+	}
+
+	col_time = malloc(COL_GROUP_ROWS * sizeof(*col_time));
+	col_sector = malloc(COL_GROUP_ROWS * sizeof(*col_sector));
+	col_dev = malloc(COL_GROUP_ROWS * sizeof(*col_dev));
+	col_cpu = malloc(COL_GROUP_ROWS * sizeof(*col_cpu));
+	col_pid = malloc(COL_GROUP_ROWS * sizeof(*col_pid));
+	col_action = malloc(COL_GROUP_ROWS * sizeof(*col_action));
+	col_bytes = malloc(COL_GROUP_ROWS * sizeof(*col_bytes));
+	col_error = malloc(COL_GROUP_ROWS * sizeof(*col_error));
+
+	col_write(COL_MAGIC, 8);
+	v = COL_BOM;
+	col_write(&v, sizeof(v));
+	v = C_MAX;
+	col_write(&v, sizeof(v));
+	for (i = 0; i < C_MAX; i++) {
+		col_write(col_info[i].name, sizeof(col_info[i].name));
+		col_write(&col_info[i].width, sizeof(col_info[i].width));
+	}
+
+	return 0;
+}
+
+static void col_flush_group(void)
+{
+	__u32 v;
+	int i;
+
+	if (!col_rows)
+		return;
+
+	if (ngroups == group_offs_size) {
+		group_offs_size = group_offs_size ? group_offs_size * 2 : 64;
+		group_offs = realloc(group_offs,
+				     group_offs_size * sizeof(*group_offs));
+	}
+	group_offs[ngroups++] = col_off;
+
+	col_write("RGRP", 4);
+	v = col_rows;
+	col_write(&v, sizeof(v));
+	for (i = 0; i < C_MAX; i++) {
+		col_write(&col_min[i], sizeof(col_min[i]));
+		col_write(&col_max[i], sizeof(col_max[i]));
+	}
+
+	col_write(col_time, col_rows * sizeof(*col_time));
+	col_write(col_dev, col_rows * sizeof(*col_dev));
+	col_write(col_cpu, col_rows * sizeof(*col_cpu));
+	col_write(col_pid, col_rows * sizeof(*col_pid));
+	col_write(col_action, col_rows * sizeof(*col_action));
+	col_write(col_sector, col_rows * sizeof(*col_sector));
+	col_write(col_bytes, col_rows * sizeof(*col_bytes));
+	col_write(col_error, col_rows * sizeof(*col_error));
+
+	col_rows = 0;
+}
+
+static inline void col_stat(int col, __u64 v)
+{
+	if (!col_rows || v < col_min[col])
+		col_min[col] = v;
+	if (!col_rows || v > col_max[col])
+		col_max[col] = v;
+}
+
+/*
+ * Add one (native endian) trace as a row
+ */
+void col_add(struct blk_io_trace *t)
+{
+	col_stat(C_TIME, t->time);
+	col_stat(C_DEV, t->device);
+	col_stat(C_CPU, t->cpu);
+	col_stat(C_PID, t->pid);
+	col_stat(C_ACTION, t->action);
+	col_stat(C_SECTOR, t->sector);
+	col_stat(C_BYTES, t->bytes);
+	col_stat(C_ERROR, t->error);
+
+	col_time[col_rows] = t->time;
+	col_dev[col_rows] = t->device;
+	col_cpu[col_rows] = t->cpu;
+	col_pid[col_rows] = t->pid;
+	col_action[col_rows] = t->action;
+	col_sector[col_rows] = t->sector;
+	col_bytes[col_rows] = t->bytes;
+	col_error[col_rows] = t->error;
+
+	if (++col_rows == COL_GROUP_ROWS)
+		col_flush_group();
+}
+
+void col_close(void)
+{
+	__u64 off;
+	__u32 v;
+
+	if (!col_fp)
+		return;
+
+	col_flush_group();
+
+	off = col_off;
+	col_write("FOOT", 4);
+	v = ngroups;
+	col_write(&v, sizeof(v));
+	col_write(group_offs, ngroups * sizeof(*group_offs));
+	col_write(&off, sizeof(off));
+	col_write(COL_MAGIC, 8);
+
+	if (col_fp == stdout)
+		fflush(col_fp);
+	else
+		fclose(col_fp);
+	col_fp = NULL;
+}
@@ -0,0 +1,588 @@
+/*
+ * This file contains the event filter for blkparse. A filter expression
+ * is compiled once into a small flat program, which is then run against
+ * each trace before it is formatted:
+ *
+ *	pid in {12,34} && bytes >= 1M && sector in [2048,4096) &&
+ *	action == C && error != 0
+ *
+ * Each test sets a result flag; && and || are compiled into conditional
+ * jumps over the right hand side, so evaluation short circuits and no
+ * recursion or allocation happens per trace.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#include "blktrace.h"
+
+enum {
+	F_TIME, F_DEV, F_CPU, F_PID, F_ACTION, F_RW, F_SECTOR, F_BYTES,
+	F_ERROR, F_SEQ,
+};
+
+enum {
+	OP_EQ, OP_NE, OP_LT, OP_LE, OP_GT, OP_GE,
+	OP_RANGE,			/* lo <= v <= hi */
+	OP_SET,				/* v in sorted set[] */
+	OP_NOT,
+	OP_JF,				/* jump to target if result false */
+	OP_JT,				/* jump to target if result true */
+};
+
+struct filter_insn {
+	unsigned char op;
+	unsigned char field;
+	unsigned int nset;
+	unsigned int target;
+	__u64 lo, hi;
+	__u64 *set;
+};
+
+struct filter_field {
+	char *name;
+	int field;
+};
+
+static struct filter_field filter_fields[] = {
+	{ "time", F_TIME },
+	{ "dev", F_DEV },
+	{ "device", F_DEV },
+	{ "cpu", F_CPU },
+	{ "pid", F_PID },
+	{ "action", F_ACTION },
+	{ "act", F_ACTION },
+	{ "rw", F_RW },
+	{ "sector", F_SECTOR },
+	{ "bytes", F_BYTES },
+	{ "error", F_ERROR },
+	{ "seq", F_SEQ },
+	{ "sequence", F_SEQ },
+};
+
+/*
+ * Action identifiers as shown in the text output. Notify events never
+ * match any of these, see filter_value().
+ */
+static struct {
+	char *name;
+	__u64 act;
+} filter_actions[] = {
+	{ "Q", __BLK_TA_QUEUE },
+	{ "M", __BLK_TA_BACKMERGE },
+	{ "F", __BLK_TA_FRONTMERGE },
+	{ "G", __BLK_TA_GETRQ },
+	{ "S", __BLK_TA_SLEEPRQ },
+	{ "R", __BLK_TA_REQUEUE },
+	{ "D", __BLK_TA_ISSUE },
+	{ "C", __BLK_TA_COMPLETE },
+	{ "P", __BLK_TA_PLUG },
+	{ "U", __BLK_TA_UNPLUG_IO },
+	{ "UT", __BLK_TA_UNPLUG_TIMER },
+	{ "I", __BLK_TA_INSERT },
+	{ "X", __BLK_TA_SPLIT },
+	{ "B", __BLK_TA_BOUNCE },
+	{ "A", __BLK_TA_REMAP },
+};
+
+#define FILTER_NOTIFY	(1ULL << 32)
+
+static struct filter_insn *prog;
+static unsigned int prog_len, prog_size;
+
+/*
+ * parser state, only used while compiling
+ */
+static char *expr_str, *pos;
+
+static void filter_error(char *msg)
+{
+	fprintf(stderr, "Bad filter expression: %s\n", msg);
+	fprintf(stderr, "  %s\n  %*s^\n", expr_str, (int)(pos - expr_str), "");
+}
+
+static unsigned int emit(int op, int field)
+{
+	struct filter_insn *fi;
+
+	if (prog_len == prog_size) {
+		prog_size = prog_size ? prog_size * 2 : 16;
+		prog = realloc(prog, prog_size * sizeof(*prog));
+	}
+
+	fi = &prog[prog_len];
+	memset(fi, 0, sizeof(*fi));
+	fi->op = op;
+	fi->field = field;
+	return prog_len++;
+}
+
+static void skip_space(void)
+{
+	while (isspace(*pos))
+		pos++;
+}
+
+static int accept(char *tok)
+{
+	int len = strlen(tok);
+
+	skip_space();
+	if (strncmp(pos, tok, len))
+		return 0;
+
+	pos += len;
+	return 1;
+}
+
+static int parse_number(__u64 *val)
+{
+	unsigned long long v;
+	char *end;
+
+	skip_space();
+	v = strtoull(pos, &end, 0);
+	if (end == pos) {
+		filter_error("number expected");
+		return 1;
+	}
+	pos = end;
+
+	switch (toupper(*pos)) {
+	case 'G':
+		v <<= 10;
+		/* fall through */
+	case 'M':
+		v <<= 10;
+		/* fall through */
+	case 'K':
+		v <<= 10;
+		pos++;
+		break;
+	}
+
+	*val = v;
+	return 0;
+}
+
+/*
+ * time is given in seconds (fractions allowed) like -w, kept in ns
+ */
+static int parse_time(__u64 *val)
+{
+	double d;
+	char *end;
+
+	skip_space();
+	d = strtod(pos, &end);
+	if (end == pos || d < 0) {
+		filter_error("time in seconds expected");
+		return 1;
+	}
+	pos = end;
+
+	*val = (__u64)(d * 1.0e9 + 0.5);
+	return 0;
+}
+
+/*
+ * devices are written major,minor as in the text output, or major:minor
+ */
+static int parse_dev(__u64 *val)
+{
+	__u64 major, minor;
+
+	if (parse_number(&major))
+		return 1;
+	skip_space();
+	if (*pos != ',' && *pos != ':') {
+		filter_error("device must be given as major,minor");
+		return 1;
+	}
+	pos++;
+	if (parse_number(&minor))
+		return 1;
+
+	*val = (major << MINORBITS) | minor;
+	return 0;
+}
+
+static int parse_action(__u64 *val)
+{
+	unsigned int i;
+	int len;
+
+	skip_space();
+	for (len = 0; isalpha(pos[len]); len++)
+		;
+
+	for (i = 0; i < sizeof(filter_actions)/sizeof(filter_actions[0]); i++)
+		if ((int)strlen(filter_actions[i].name) == len &&
+		    !strncmp(filter_actions[i].name, pos, len)) {
+			*val = filter_actions[i].act;
+			pos += len;
+			return 0;
+		}
+
+	filter_error("unknown action");
+	return 1;
+}
+
+static int parse_rw(__u64 *val)
+{
+	skip_space();
+	if (*pos == 'R' || *pos == 'W') {
+		*val = *pos++ == 'W';
+		return 0;
+	}
+
+	filter_error("R or W expected");
+	return 1;
+}
+
+static int parse_value(int field, __u64 *val)
+{
+	switch (field) {
+	case F_TIME:
+		return parse_time(val);
+	case F_DEV:
+		return parse_dev(val);
+	case F_ACTION:
+		return parse_action(val);
+	case F_RW:
+		return parse_rw(val);
+	default:
+		return parse_number(val);
+	}
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	__u64 x = *(const __u64 *)a, y = *(const __u64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int parse_set(int field)
+{
+	struct filter_insn *fi;
+	__u64 *set = NULL, v;
+	int n = 0, i;
+	unsigned int pc;
+
+	do {
+		if (parse_value(field, &v)) {
+			free(set);
+			return 1;
+		}
+		if ((n & 15) == 0)
+			set = realloc(set, (n + 16) * sizeof(*set));
+		set[n++] = v;
+	} while (accept(","));
+
+	if (!accept("}")) {
+		filter_error("'}' expected");
+		free(set);
+		return 1;
+	}
+
+	qsort(set, n, sizeof(*set), cmp_u64);
+	for (i = 1; i < n; i++)
+		if (set[i] == set[i - 1]) {
+			memmove(&set[i], &set[i + 1], (n - i - 1) * sizeof(*set));
+			n--;
+			i--;
+		}
+
+	pc = emit(OP_SET, field);
+	fi = &prog[pc];
+	fi->set = set;
+	fi->nset = n;
+	return 0;
+}
+
+/*
+ * [a,b) style intervals, either end may be open or closed
+ */
+static int parse_range(int field, int lo_open)
+{
+	struct filter_insn *fi;
+	unsigned int pc;
+	__u64 lo, hi;
+	int hi_open = 0;
+
+	if (parse_value(field, &lo))
+		return 1;
+	if (!accept(",")) {
+		filter_error("',' expected");
+		return 1;
+	}
+	if (parse_value(field, &hi))
+		return 1;
+
+	if (accept(")"))
+		hi_open = 1;
+	else if (!accept("]")) {
+		filter_error("']' or ')' expected");
+		return 1;
+	}
+
+	/*
+	 * Kept closed at both ends, so that neither end has to step past
+	 * the largest value; an open end with nothing beyond it leaves the
+	 * range empty (lo > hi)
+	 */
+	pc = emit(OP_RANGE, field);
+	fi = &prog[pc];
+	if ((lo_open && lo == ULLONG_MAX) || (hi_open && hi == 0)) {
+		fi->lo = 1;
+		fi->hi = 0;
+	} else {
+		fi->lo = lo + lo_open;
+		fi->hi = hi - hi_open;
+	}
+	return 0;
+}
+
+static int parse_compare(void)
+{
+	static struct {
+		char *tok;
+		int op;
+	} ops[] = {
+		{ "==", OP_EQ }, { "!=", OP_NE }, { "<=", OP_LE },
+		{ ">=", OP_GE }, { "<", OP_LT }, { ">", OP_GT },
+		{ "=", OP_EQ },
+	};
+	unsigned int i;
+	int len, field = -1;
+
+	skip_space();
+	for (len = 0; isalpha(pos[len]); len++)
+		;
+	for (i = 0; i < sizeof(filter_fields)/sizeof(filter_fields[0]); i++)
+		if ((int)strlen(filter_fields[i].name) == len &&
+		    !strncmp(filter_fields[i].name, pos, len)) {
+			field = filter_fields[i].field;
+			break;
+		}
+	if (field < 0) {
+		filter_error("unknown field");
+		return 1;
+	}
+	pos += len;
+
+	if (accept("in")) {
+		if (accept("{"))
+			return parse_set(field);
+		if (accept("["))
+			return parse_range(field, 0);
+		if (accept("("))
+			return parse_range(field, 1);
+
+		filter_error("'{', '[' or '(' expected");
+		return 1;
+	}
+
+	for (i = 0; i < sizeof(ops)/sizeof(ops[0]); i++)
+		if (accept(ops[i].tok)) {
+			unsigned int pc = emit(ops[i].op, field);
+
+			return parse_value(field, &prog[pc].lo);
+		}
+
+	filter_error("comparison expected");
+	return 1;
+}
+
+static int parse_or(void);
+
+static int parse_unary(void)
+{
+	if (accept("!")) {
+		if (parse_unary())
+			return 1;
+		emit(OP_NOT, 0);
+		return 0;
+	}
+
+	if (accept("(")) {
+		if (parse_or())
+			return 1;
+		if (!accept(")")) {
+			filter_error("')' expected");
+			return 1;
+		}
+		return 0;
+	}
+
+	return parse_compare();
+}
+
+static int parse_and(void)
+{
+	unsigned int j;
+
+	if (parse_unary())
+		return 1;
+
+	while (accept("&&")) {
+		j = emit(OP_JF, 0);
+		if (parse_unary())
+			return 1;
+		prog[j].target = prog_len;
+	}
+
+	return 0;
+}
+
+static int parse_or(void)
+{
+	unsigned int j;
+
+	if (parse_and())
+		return 1;
+
+	while (accept("||")) {
+		j = emit(OP_JT, 0);
+		if (parse_and())
+			return 1;
+		prog[j].target = prog_len;
+	}
+
+	return 0;
+}
+
+/*
+ * Compile a filter expression. Several filters may be given, an event
+ * then has to match all of them.
+ */
+int add_filter(char *expr)
+{
+	unsigned int j = 0;
+
+	expr_str = pos = expr;
+
+	if (prog_len)
+		j = emit(OP_JF, 0);
+
+	if (parse_or())
+		return 1;
+
+	skip_space();
+	if (*pos) {
+		filter_error("unexpected input");
+		return 1;
+	}
+
+	if (j)
+		prog[j].target = prog_len;
+	return 0;
+}
+
+static inline __u64 filter_value(struct blk_io_trace *t, int field)
+{
+	switch (field) {
+	case F_TIME:
+		return t->time;
+	case F_DEV:
+		return t->device;
+	case F_CPU:
+		return t->cpu;
+	case F_PID:
+		return t->pid;
+	case F_ACTION:
+		if (t->action & BLK_TC_ACT(BLK_TC_NOTIFY))
+			return FILTER_NOTIFY;
+		return t->action & 0xffff;
+	case F_RW:
+		return (t->action & BLK_TC_ACT(BLK_TC_WRITE)) != 0;
+	case F_SECTOR:
+		return t->sector;
+	case F_BYTES:
+		return t->bytes;
+	case F_ERROR:
+		return t->error;
+	case F_SEQ:
+		return t->sequence;
+	}
+
+	return 0;
+}
+
+static int in_set(__u64 *set, int n, __u64 v)
+{
+	int lo = 0, hi = n;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (set[mid] < v)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo < n && set[lo] == v;
+}
+
+/*
+ * Run the compiled filter on a (native endian) trace. Returns 1 if the
+ * trace should be shown, also when no filter was given.
+ */
+int filter_trace(struct blk_io_trace *t)
+{
+	struct filter_insn *fi;
+	unsigned int pc = 0;
+	int r = 1;
+	__u64 v;
+
+	while (pc < prog_len) {
+		fi = &prog[pc++];
+
+		switch (fi->op) {
+		case OP_JF:
+			if (!r)
+				pc = fi->target;
+			continue;
+		case OP_JT:
+			if (r)
+				pc = fi->target;
+			continue;
+		case OP_NOT:
+			r = !r;
+			continue;
+		}
+
+		v = filter_value(t, fi->field);
+		switch (fi->op) {
+		case OP_EQ:
+			r = v == fi->lo;
+			break;
+		case OP_NE:
+			r = v != fi->lo;
+			break;
+		case OP_LT:
+			r = v < fi->lo;
+			break;
+		case OP_LE:
+			r = v <= fi->lo;
+			break;
+		case OP_GT:
+			r = v > fi->lo;
+			break;
+		case OP_GE:
+			r = v >= fi->lo;
+			break;
+		case OP_RANGE:
+			r = v >= fi->lo && v <= fi->hi;
+			break;
+		case OP_SET:
+			r = in_set(fi->set, fi->nset, v);
+			break;
+		}
+	}
+
+	return r;
+}
@@ -2,6 +2,7 @@
 #define BLKTRACE_H
 
 #include <stdio.h>
+#include <string.h>
 #include <limits.h>
 #include <byteswap.h>
 #include <endian.h>
@@ -52,7 +53,12 @@ struct per_cpu_info {
 	int fdblock;
 	char fname[PATH_MAX];
 
+	/* blkparse reads a cpu's file through this, and batches from it */
+	char *rbuf;
+	int rbuf_len, rbuf_off;
+
 	struct io_stats io_stats;
+	struct io_stats interval_stats;
 
 	struct rb_root rb_last;
 	unsigned long rb_last_entries;
@@ -103,22 +109,98 @@ static inline int verify_trace(struct blk_io_trace *t)
 	return 0;
 }
 
-static inline void trace_to_cpu(struct blk_io_trace *t)
+static inline void __bswap_trace(struct blk_io_trace *t)
+{
+	t->magic	= __bswap_32(t->magic);
+	t->sequence	= __bswap_32(t->sequence);
+	t->time		= __bswap_64(t->time);
+	t->sector	= __bswap_64(t->sector);
+	t->bytes	= __bswap_32(t->bytes);
+	t->action	= __bswap_32(t->action);
+	t->pid		= __bswap_32(t->pid);
+	t->device	= __bswap_32(t->device);
+	t->cpu		= __bswap_32(t->cpu);
+	t->error	= __bswap_16(t->error);
+	t->pdu_len	= __bswap_16(t->pdu_len);
+}
+
+static inline void __bswap_traces_scalar(struct blk_io_trace *t, int n)
+{
+	for (; n > 0; n--, t++)
+		__bswap_trace(t);
+}
+
+/*
+ * A struct blk_io_trace is exactly three 16-byte vectors, so when the
+ * target has a byte shuffle instruction (SSSE3 pshufb, NEON tbl) a header
+ * is swapped with three shuffles instead of eleven field swaps. On x86
+ * builds not already targeting SSSE3 the shuffle is compiled for it
+ * alone, and used only if cpuid says the CPU has it. btswap checks and
+ * times it against the scalar swap.
+ */
+#if defined(__SSSE3__) || defined(__ARM_NEON)
+#define HAVE_BSWAP_SHUFFLE
+#define BSWAP_SHUFFLE_TARGET
+#define bswap_shuffle_ok()	1
+#elif (defined(__x86_64__) || defined(__i386__)) && \
+      defined(__GNUC__) && !defined(__clang__)
+#define HAVE_BSWAP_SHUFFLE
+#define BSWAP_SHUFFLE_TARGET	__attribute__((target("ssse3")))
+#define bswap_shuffle_ok()	__builtin_cpu_supports("ssse3")
+#endif
+
+#ifdef HAVE_BSWAP_SHUFFLE
+typedef unsigned char bit_vec_t __attribute__((vector_size(16)));
+
+static inline BSWAP_SHUFFLE_TARGET
+void __bswap_traces_shuffle(struct blk_io_trace *t, int n)
+{
+	/* magic, sequence, time */
+	const bit_vec_t m0 = { 3, 2, 1, 0, 7, 6, 5, 4,
+			       15, 14, 13, 12, 11, 10, 9, 8 };
+	/* sector, bytes, action */
+	const bit_vec_t m1 = { 7, 6, 5, 4, 3, 2, 1, 0,
+			       11, 10, 9, 8, 15, 14, 13, 12 };
+	/* pid, device, cpu, error, pdu_len */
+	const bit_vec_t m2 = { 3, 2, 1, 0, 7, 6, 5, 4,
+			       11, 10, 9, 8, 13, 12, 15, 14 };
+	bit_vec_t v[3];
+
+	for (; n > 0; n--, t++) {
+		memcpy(v, t, sizeof(v));
+		v[0] = __builtin_shuffle(v[0], m0);
+		v[1] = __builtin_shuffle(v[1], m1);
+		v[2] = __builtin_shuffle(v[2], m2);
+		memcpy(t, v, sizeof(v));
+	}
+}
+
+static inline void __bswap_traces(struct blk_io_trace *t, int n)
+{
+	if (bswap_shuffle_ok())
+		__bswap_traces_shuffle(t, n);
+	else
+		__bswap_traces_scalar(t, n);
+}
+#else
+#define __bswap_traces	__bswap_traces_scalar
+#endif
+
+/*
+ * convert a run of n back-to-back trace headers (no pdus in between)
+ * from foreign to native byte order
+ */
+static inline void traces_to_cpu(struct blk_io_trace *t, int n)
 {
 	if (data_is_native)
 		return;
 
-	t->magic	= be32_to_cpu(t->magic);
-	t->sequence	= be32_to_cpu(t->sequence);
-	t->time		= be64_to_cpu(t->time);
-	t->sector	= be64_to_cpu(t->sector);
-	t->bytes	= be32_to_cpu(t->bytes);
-	t->action	= be32_to_cpu(t->action);
-	t->pid		= be32_to_cpu(t->pid);
-	t->device	= be32_to_cpu(t->device);
-	t->cpu		= be32_to_cpu(t->cpu);
-	t->error	= be16_to_cpu(t->error);
-	t->pdu_len	= be16_to_cpu(t->pdu_len);
+	__bswap_traces(t, n);
+}
+
+static inline void trace_to_cpu(struct blk_io_trace *t)
+{
+	traces_to_cpu(t, 1);
 }
 
 /*
@@ -144,6 +226,11 @@ extern void set_all_format_specs(char *);
 extern int add_format_spec(char *);
 extern void process_fmt(char *, struct per_cpu_info *, struct blk_io_trace *,
 			unsigned long long, int, unsigned char *);
+extern int col_open(char *);
+extern void col_add(struct blk_io_trace *);
+extern void col_close(void);
+extern int add_filter(char *);
+extern int filter_trace(struct blk_io_trace *);
 extern int valid_act_opt(int);
 extern int find_mask_map(char *);
 extern char *find_process_name(pid_t);
@@ -0,0 +1,608 @@
+/*
+ * block queue tracing application
+ *
+ * Synthetic trace generator: writes blktrace per-device, per-CPU files
+ * (and the same traces merged into one time ordered file) for a made up
+ * workload, so the parsing tools can be measured against a repeatable
+ * input.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <endian.h>
+
+#include "blktrace.h"
+
+#define S_OPTS	"c:d:e:i:m:n:o:p:q:r:s:u:V"
+#define PDU_MAX	32
+#define MERGE_MAX	64
+#define DM_DEV	((253 << MINORBITS) | 0)
+
+static char usage_str[] = "\n\nbtgen " \
+	"[ -o <name>         | --output=<name> ]\n" \
+	"[ -n <ios>          | --ios=<ios> ]\n" \
+	"[ -c <cpus>         | --cpus=<cpus> ]\n" \
+	"[ -d <devices>      | --devices=<devices> ]\n" \
+	"[ -q <depth>        | --depth=<depth> ]\n" \
+	"[ -i <nsecs>        | --interarrival=<nsecs> ]\n" \
+	"[ -m <percent>      | --merges=<percent> ]\n" \
+	"[ -r <percent>      | --remaps=<percent> ]\n" \
+	"[ -u <percent>      | --unplugs=<percent> ]\n" \
+	"[ -p <pids>         | --pids=<pids> ]\n" \
+	"[ -e <endian>       | --endian=<native|little|big> ]\n" \
+	"[ -s <seed>         | --seed=<seed> ]\n" \
+	"[ -V                | --version ]\n\n" \
+	"\t-o   Output name: <name>_<major>_<minor>.blktrace.<cpu> per\n" \
+	"\t     device, and <name>.bin with all traces merged. Default btgen.\n" \
+	"\t-n   Number of IOs (bios) to queue. Default 100000.\n" \
+	"\t-c   Number of CPUs to spread traces over. Default 4.\n" \
+	"\t-d   Number of devices (8,0 8,16 ...). Default 1.\n" \
+	"\t-q   Requests in flight per device at most. Default 32.\n" \
+	"\t-i   Mean time between IOs in nanoseconds. Default 20000.\n" \
+	"\t-m   Percentage of IOs back merged into a request. Default 10.\n" \
+	"\t-r   Percentage of requests remapped from a dm device. Default 0.\n" \
+	"\t-u   Percentage of requests plugged and unplugged. Default 0.\n" \
+	"\t-p   Number of processes issuing IO. Default 4.\n" \
+	"\t-e   Byte order of the traces written. Default native.\n" \
+	"\t-s   Random seed. Default 1.\n" \
+	"\t-V   Print program version.\n\n";
+
+static struct option l_opts[] = {
+	{
+		.name = "output",
+		.has_arg = required_argument,
+		.flag = NULL,
+		.val = 'o'
+	},
+	{
+		.name = "ios",
+		.has_arg = required_argument,
+		.flag = NULL,
+		.val = 'n'
+	},
+	{
+		.name = "cpus",
+		.has_arg = required_argument,
+		.flag = NULL,
+		.val = 'c'
+	},
+	{
+		.name = "devices",
+		.has_arg = required_argument,
+		.flag = NULL,
+		.val = 'd'
+	},
+	{
+		.name = "depth",
+		.has_arg = required_argument,
+		.flag = NULL,
+		.val = 'q'
+	},
+	{
+		.name = "interarrival",
+		.has_arg = required_argument,
+		.flag = NULL,
+		.val = 'i'
+	},
+	{
+		.name = "merges",
+		.has_arg = required_argument,
+		.flag = NULL,
+		.val = 'm'
+	},
+	{
+		.name = "remaps",
+		.has_arg = required_argument,
+		.flag = NULL,
+		.val = 'r'
+	},
+	{
+		.name = "unplugs",
+		.has_arg = required_argument,
+		.flag = NULL,
+		.val = 'u'
+	},
+	{
+		.name = "pids",
+		.has_arg = required_argument,
+		.flag = NULL,
+		.val = 'p'
+	},
+	{
+		.name = "endian",
+		.has_arg = required_argument,
+		.flag = NULL,
+		.val = 'e'
+	},
+	{
+		.name = "seed",
+		.has_arg = required_argument,
+		.flag = NULL,
+		.val = 's'
+	},
+	{
+		.name = "version",
+		.has_arg = no_argument,
+		.flag = NULL,
+		.val = 'V'
+	},
+	{
+		.name = NULL,
+	}
+};
+
+/*
+ * A trace waiting for its time to come. Traces are made a request at a
+ * time but go out in time order, so the ones still in the future wait in
+ * a heap ordered on time (and then on when they were made).
+ */
+struct gen_trace {
+	struct blk_io_trace t;
+	struct gen_dev *gdp;
+	unsigned long long order;
+	unsigned char pdu[PDU_MAX];
+};
+
+/*
+ * Like blktrace, each device gets its own per-CPU files (and sequence
+ * numbers), and is told a pid's name the first time the pid shows up
+ */
+struct gen_dev {
+	__u32 device;
+	__u64 next_sec;
+	unsigned long long *slots;	/* when each slot in flight frees up */
+	FILE **fps;
+	__u32 *seq;
+	char *pid_seen;
+};
+
+int data_is_native = 1;
+
+static char *name = "btgen";
+static unsigned long nios = 100000;
+static int ncpus = 4, ndevs = 1, depth = 32, npids = 4;
+static int merge_pct = 10, remap_pct = 0, unplug_pct = 0;
+static unsigned long long interarrival = 20000;
+static unsigned int seed = 1;
+static int swap;
+
+static struct gen_trace *heap;
+static unsigned long heap_nr, heap_size;
+static unsigned long long order, n_events;
+
+static struct gen_dev *devs, *dm_dev;
+static FILE *merged_fp;
+
+static void usage(char *prog)
+{
+	fprintf(stderr, "Usage: %s %s", prog, usage_str);
+}
+
+static inline int heap_before(struct gen_trace *a, struct gen_trace *b)
+{
+	if (a->t.time != b->t.time)
+		return a->t.time < b->t.time;
+	return a->order < b->order;
+}
+
+static void heap_push(struct gen_trace *gtp)
+{
+	unsigned long i;
+
+	if (heap_nr == heap_size) {
+		heap_size = heap_size ? 2 * heap_size : 1024;
+		heap = realloc(heap, heap_size * sizeof(*heap));
+		if (!heap) {
+			perror("btgen: heap");
+			exit(1);
+		}
+	}
+
+	gtp->order = order++;
+	for (i = heap_nr++; i > 0; i = (i - 1) / 2) {
+		if (!heap_before(gtp, &heap[(i - 1) / 2]))
+			break;
+		heap[i] = heap[(i - 1) / 2];
+	}
+	heap[i] = *gtp;
+}
+
+static void heap_pop(struct gen_trace *gtp)
+{
+	struct gen_trace last = heap[--heap_nr];
+	unsigned long i = 0, c;
+
+	*gtp = heap[0];
+	while ((c = 2 * i + 1) < heap_nr) {
+		if (c + 1 < heap_nr && heap_before(&heap[c + 1], &heap[c]))
+			c++;
+		if (!heap_before(&heap[c], &last))
+			break;
+		heap[i] = heap[c];
+		i = c;
+	}
+	heap[i] = last;
+}
+
+static void write_trace(FILE *fp, struct blk_io_trace *t, void *pdu, int len)
+{
+	if (fwrite(t, sizeof(*t), 1, fp) != 1 ||
+	    (len && fwrite(pdu, len, 1, fp) != 1)) {
+		perror("btgen: write");
+		exit(1);
+	}
+}
+
+/*
+ * Times are kept strictly increasing (blkrawverify insists), nudging the
+ * odd collision along by a nanosecond
+ */
+static void emit(struct gen_trace *gtp)
+{
+	static unsigned long long last_time;
+	struct blk_io_trace t = gtp->t;
+	int cpu = t.cpu, len = t.pdu_len;
+
+	if (t.time <= last_time)
+		t.time = last_time + 1;
+	last_time = t.time;
+
+	t.sequence = ++gtp->gdp->seq[cpu];
+	if (swap)
+		__bswap_trace(&t);
+
+	write_trace(gtp->gdp->fps[cpu], &t, gtp->pdu, len);
+	write_trace(merged_fp, &t, gtp->pdu, len);
+	n_events++;
+}
+
+/*
+ * Write out everything due before time
+ */
+static void flush_until(unsigned long long time)
+{
+	struct gen_trace gt;
+
+	while (heap_nr && heap[0].t.time < time) {
+		heap_pop(&gt);
+		emit(&gt);
+	}
+}
+
+static struct gen_trace *mk_trace(struct gen_trace *gtp,
+				  unsigned long long time, struct gen_dev *gdp,
+				  __u32 action, __u64 sector, __u32 bytes,
+				  __u32 pid, int cpu)
+{
+	memset(&gtp->t, 0, sizeof(gtp->t));
+	gtp->gdp = gdp;
+	gtp->t.magic = BLK_IO_TRACE_MAGIC | SUPPORTED_VERSION;
+	gtp->t.time = time;
+	gtp->t.device = gdp->device;
+	gtp->t.action = action;
+	gtp->t.sector = sector;
+	gtp->t.bytes = bytes;
+	gtp->t.pid = pid;
+	gtp->t.cpu = cpu;
+	return gtp;
+}
+
+static void add_process(unsigned long long time, struct gen_dev *gdp,
+			__u32 pid, int cpu)
+{
+	struct gen_trace gt;
+
+	mk_trace(&gt, time, gdp, BLK_TN_PROCESS, 0, 0, pid, cpu);
+	gt.t.pdu_len = sprintf((char *)gt.pdu, "btgen%u", pid) + 1;
+	heap_push(&gt);
+}
+
+static void add(unsigned long long time, struct gen_dev *gdp, __u32 action,
+		__u64 sector, __u32 bytes, __u32 pid, int cpu)
+{
+	struct gen_trace gt;
+
+	if (pid && !gdp->pid_seen[pid - 1000]) {
+		gdp->pid_seen[pid - 1000] = 1;
+		add_process(time, gdp, pid, cpu);
+	}
+	heap_push(mk_trace(&gt, time, gdp, action, sector, bytes, pid, cpu));
+}
+
+/*
+ * pdus are written the way the kernel writes them: big endian
+ */
+static void add_remap(unsigned long long time, struct gen_dev *gdp,
+		      __u64 sector, __u32 bytes, __u32 pid, int cpu, __u32 rw,
+		      __u32 from_dev, __u64 from_sec)
+{
+	struct blk_io_trace_remap r;
+	struct gen_trace gt;
+
+	mk_trace(&gt, time, gdp, BLK_TA_REMAP | rw, sector, bytes, pid, cpu);
+	r.device_from = htobe32(from_dev);
+	r.device_to = htobe32(gdp->device);
+	r.sector_from = htobe64(from_sec);
+	memcpy(gt.pdu, &r, sizeof(r));
+	gt.t.pdu_len = sizeof(r);
+	heap_push(&gt);
+}
+
+static void add_unplug(unsigned long long time, struct gen_dev *gdp,
+		       __u32 pid, int cpu, __u64 nr)
+{
+	struct gen_trace gt;
+	__u64 be_nr = htobe64(nr);
+
+	mk_trace(&gt, time, gdp, BLK_TA_UNPLUG_IO, 0, 0, pid, cpu);
+	memcpy(gt.pdu, &be_nr, sizeof(be_nr));
+	gt.t.pdu_len = sizeof(be_nr);
+	heap_push(&gt);
+}
+
+static inline unsigned long long rnd(unsigned long long n)
+{
+	return n ? (unsigned long long)random() % n : 0;
+}
+
+static inline int pct(int p)
+{
+	return (int)rnd(100) < p;
+}
+
+/*
+ * One request: a leading bio (Q G I) and any bios back merged into it
+ * (Q M), then D and C for the lot. Plugged requests get a P up front and
+ * an unplug (with its request count pdu) just before D; remapped ones
+ * start out on the dm device above with a Q there and an A here.
+ */
+static unsigned long gen_request(struct gen_dev *gdp, unsigned long long *now,
+				 unsigned long left)
+{
+	__u32 rw = pct(33) ? BLK_TC_ACT(BLK_TC_WRITE) : BLK_TC_ACT(BLK_TC_READ);
+	__u32 pid = 1000 + rnd(npids);
+	int cpu = rnd(ncpus), plugged = pct(unplug_pct), i, slot;
+	unsigned long nbios = 1;
+	unsigned long long t = *now, d_time, c_time;
+	__u64 sector, nsecs = 0, dm_secs[MERGE_MAX];
+	__u32 bytes, dm_bytes[MERGE_MAX];
+	int n_dm = 0;
+
+	if (pct(50))
+		gdp->next_sec = rnd(1ULL << 28) & ~7ULL;
+	sector = gdp->next_sec;
+
+	flush_until(t);
+	if (plugged) {
+		add(t, gdp, BLK_TA_PLUG, 0, 0, pid, cpu);
+		t += 100;
+	}
+
+	for (;;) {
+		bytes = 4096 * (1 + rnd(8));
+		if (pct(remap_pct)) {
+			__u64 dm_sec = sector + nsecs + 2048;
+
+			add(t, dm_dev, BLK_TA_QUEUE | rw, dm_sec, bytes, pid,
+			    cpu);
+			add_remap(t + 300, gdp, sector + nsecs, bytes,
+				  pid, cpu, rw, DM_DEV, dm_sec);
+			dm_secs[n_dm] = dm_sec;
+			dm_bytes[n_dm++] = bytes;
+			t += 500;
+		}
+		add(t, gdp, BLK_TA_QUEUE | rw, sector + nsecs, bytes,
+		    pid, cpu);
+		if (nsecs == 0) {
+			add(t + 200, gdp, BLK_TA_GETRQ | rw, sector,
+			    bytes, pid, cpu);
+			add(t + 400, gdp, BLK_TA_INSERT | rw, sector,
+			    bytes, pid, cpu);
+		} else
+			add(t + 200, gdp, BLK_TA_BACKMERGE | rw,
+			    sector + nsecs, bytes, pid, cpu);
+		nsecs += bytes >> 9;
+		t += 500 + rnd(2 * interarrival / 10);
+
+		if (nbios == left || nbios == MERGE_MAX || !pct(merge_pct))
+			break;
+		nbios++;
+	}
+
+	/* Issue once a slot is free, and complete some time later */
+	for (slot = 0, i = 1; i < depth; i++)
+		if (gdp->slots[i] < gdp->slots[slot])
+			slot = i;
+	d_time = t + 1000;
+	if (d_time < gdp->slots[slot])
+		d_time = gdp->slots[slot];
+	c_time = d_time + 20000 + nsecs * 50 + rnd(200000);
+	gdp->slots[slot] = c_time;
+
+	if (plugged)
+		add_unplug(d_time - 100, gdp, pid, cpu, 1);
+	add(d_time, gdp, BLK_TA_ISSUE | rw, sector, nsecs << 9, pid,
+	    cpu);
+	add(c_time, gdp, BLK_TA_COMPLETE | rw, sector, nsecs << 9,
+	    0, cpu);
+	gdp->next_sec = sector + nsecs;
+
+	/* The dm device completes its bios once the request below has */
+	for (i = 0; i < n_dm; i++)
+		add(c_time + 2000 + 100 * i, dm_dev, BLK_TA_COMPLETE | rw,
+		    dm_secs[i], dm_bytes[i], 0, cpu);
+
+	*now = t;
+	return nbios;
+}
+
+static FILE *open_out(char *fn)
+{
+	FILE *fp = fopen(fn, "w");
+
+	if (!fp) {
+		perror(fn);
+		exit(1);
+	}
+	return fp;
+}
+
+static void dev_init(struct gen_dev *gdp, __u32 device)
+{
+	char fn[4096];
+	int i;
+
+	gdp->device = device;
+	gdp->slots = calloc(depth, sizeof(*gdp->slots));
+	gdp->fps = calloc(ncpus, sizeof(*gdp->fps));
+	gdp->seq = calloc(ncpus, sizeof(*gdp->seq));
+	gdp->pid_seen = calloc(npids, 1);
+	for (i = 0; i < ncpus; i++) {
+		snprintf(fn, sizeof(fn), "%s_%u_%u.blktrace.%d", name,
+			 MAJOR(device), MINOR(device), i);
+		gdp->fps[i] = open_out(fn);
+	}
+}
+
+static void close_out(FILE *fp)
+{
+	if (fclose(fp)) {
+		perror("btgen: close");
+		exit(1);
+	}
+}
+
+static void handle_args(int argc, char *argv[])
+{
+	int c;
+
+	while ((c = getopt_long(argc, argv, S_OPTS, l_opts, NULL)) != -1) {
+		switch (c) {
+		case 'c':
+			ncpus = atoi(optarg);
+			break;
+		case 'd':
+			ndevs = atoi(optarg);
+			break;
+		case 'e':
+			if (!strcmp(optarg, "native"))
+				swap = 0;
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+			else if (!strcmp(optarg, "little"))
+				swap = 0;
+			else if (!strcmp(optarg, "big"))
+				swap = 1;
+#else
+			else if (!strcmp(optarg, "little"))
+				swap = 1;
+			else if (!strcmp(optarg, "big"))
+				swap = 0;
+#endif
+			else {
+				usage(argv[0]);
+				exit(1);
+			}
+			break;
+		case 'i':
+			interarrival = strtoull(optarg, NULL, 0);
+			break;
+		case 'm':
+			merge_pct = atoi(optarg);
+			break;
+		case 'n':
+			nios = strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			name = optarg;
+			break;
+		case 'p':
+			npids = atoi(optarg);
+			break;
+		case 'q':
+			depth = atoi(optarg);
+			break;
+		case 'r':
+			remap_pct = atoi(optarg);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'u':
+			unplug_pct = atoi(optarg);
+			break;
+		case 'V':
+			printf("%s version 0.1\n", argv[0]);
+			exit(0);
+		default:
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	if (ncpus < 1 || ndevs < 1 || depth < 1 || npids < 1 ||
+	    interarrival < 1) {
+		usage(argv[0]);
+		exit(1);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct gen_trace gt;
+	unsigned long done = 0;
+	unsigned long long now = 1000000;
+	char fn[4096];
+	int i;
+
+	handle_args(argc, argv);
+	srandom(seed);
+
+	devs = calloc(ndevs + 1, sizeof(*devs));
+	for (i = 0; i < ndevs; i++)
+		dev_init(&devs[i], (8 << MINORBITS) | (i * 16));
+	if (remap_pct) {
+		dm_dev = &devs[ndevs];
+		dev_init(dm_dev, DM_DEV);
+	}
+	snprintf(fn, sizeof(fn), "%s.bin", name);
+	merged_fp = open_out(fn);
+	setvbuf(merged_fp, NULL, _IOFBF, 1 << 20);
+
+	while (done < nios) {
+		now += 1 + rnd(2 * interarrival);
+		done += gen_request(&devs[rnd(ndevs)], &now, nios - done);
+	}
+
+	while (heap_nr) {
+		heap_pop(&gt);
+		emit(&gt);
+	}
+
+	for (i = 0; i <= ndevs; i++) {
+		int j;
+
+		if (devs[i].fps)
+			for (j = 0; j < ncpus; j++)
+				close_out(devs[i].fps[j]);
+	}
+	close_out(merged_fp);
+
+	printf("%llu events, %lu IOs\n", n_events, done);
+	return 0;
+}
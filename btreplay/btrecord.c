@@ -508,21 +508,13 @@ again:
 		check_data_endianness(t.magic);
 
 	assert(data_is_native >= 0);
-	if (data_is_native) {
-		spec->time = t.time;
-		spec->sector = t.sector;
-		spec->bytes = t.bytes;
-		action = t.action;
-		pdu_len = t.pdu_len;
-	}
-	else {
-		spec->time = be64_to_cpu(t.time);
-		spec->sector = be64_to_cpu(t.sector);
-		spec->bytes = be32_to_cpu(t.bytes);
-		action = be32_to_cpu(t.action);
-		pdu_len = be16_to_cpu(t.pdu_len);
-	}
+	trace_to_cpu(&t);
 
+	spec->time = t.time;
+	spec->sector = t.sector;
+	spec->bytes = t.bytes;
+	action = t.action;
+	pdu_len = t.pdu_len;
 
 	if (pdu_len) {
 		char buf[pdu_len];
@@ -0,0 +1,256 @@
+/*
+ * block queue tracing application
+ *
+ * Checks and times the two ways traces_to_cpu() can swap foreign-endian
+ * trace headers: field by field, and (where the target has a byte
+ * shuffle instruction) three vector shuffles per header.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "blktrace.h"
+
+#define S_OPTS	"cn:r:"
+
+static char usage_str[] = "[ -c ] [ -n <headers> ] [ -r <rounds> ]\n\n" \
+	"\t-c   Check both swaps against headers written out in the\n" \
+	"\t     other byte order, rather than timing them.\n" \
+	"\t-n   Headers swapped per call. Default 64, as btt reads them.\n" \
+	"\t-r   Calls timed. Default 1000000.\n\n";
+
+int data_is_native = 0;
+
+static int nhdrs = 64;
+static long rounds = 1000000;
+static volatile __u32 sink;
+
+struct swapper {
+	char *name;
+	void (*swap)(struct blk_io_trace *, int);
+};
+
+static struct swapper swappers[] = {
+	{ "scalar", __bswap_traces_scalar },
+#ifdef HAVE_BSWAP_SHUFFLE
+	{ "shuffle", __bswap_traces_shuffle },
+#endif
+};
+#define N_SWAPPERS	(int)(sizeof(swappers) / sizeof(swappers[0]))
+
+/*
+ * The shuffle may be built for SSSE3 without the CPU running it having it
+ */
+static int swapper_ok(struct swapper *sp)
+{
+#ifdef HAVE_BSWAP_SHUFFLE
+	if (sp->swap == __bswap_traces_shuffle && !bswap_shuffle_ok()) {
+		printf("%-8s not supported by this CPU\n", sp->name);
+		return 0;
+	}
+#endif
+	return 1;
+}
+
+static void usage(char *prog)
+{
+	fprintf(stderr, "Usage: %s %s", prog, usage_str);
+}
+
+static unsigned long long rnd64(void)
+{
+	return ((unsigned long long)random() << 62) ^
+	       ((unsigned long long)random() << 31) ^ random();
+}
+
+static void rnd_trace(struct blk_io_trace *t)
+{
+	memset(t, 0, sizeof(*t));
+	t->magic = BLK_IO_TRACE_MAGIC | SUPPORTED_VERSION;
+	t->sequence = rnd64();
+	t->time = rnd64();
+	t->sector = rnd64();
+	t->bytes = rnd64();
+	t->action = rnd64();
+	t->pid = rnd64();
+	t->device = rnd64();
+	t->cpu = rnd64();
+	t->error = rnd64();
+	t->pdu_len = rnd64();
+}
+
+/*
+ * Write val into p in the byte order that is not this machine's, one
+ * byte at a time, independently of either swap
+ */
+static void put_foreign(unsigned char *p, unsigned long long val, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++) {
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+		p[i] = val >> (8 * (len - 1 - i));
+#else
+		p[i] = val >> (8 * i);
+#endif
+	}
+}
+
+#define PUT_FOREIGN(p, t, fld)						\
+	put_foreign((unsigned char *)(p) + offsetof(struct blk_io_trace, fld),\
+		    (t)->fld, sizeof((t)->fld))
+
+static void to_foreign(struct blk_io_trace *f, struct blk_io_trace *t)
+{
+	PUT_FOREIGN(f, t, magic);
+	PUT_FOREIGN(f, t, sequence);
+	PUT_FOREIGN(f, t, time);
+	PUT_FOREIGN(f, t, sector);
+	PUT_FOREIGN(f, t, bytes);
+	PUT_FOREIGN(f, t, action);
+	PUT_FOREIGN(f, t, pid);
+	PUT_FOREIGN(f, t, device);
+	PUT_FOREIGN(f, t, cpu);
+	PUT_FOREIGN(f, t, error);
+	PUT_FOREIGN(f, t, pdu_len);
+}
+
+/*
+ * Every run length up to nhdrs, so the tail of a run is covered as well
+ */
+static int check(void)
+{
+	struct blk_io_trace *orig, *foreign, *buf;
+	int i, n, s, bad = 0;
+
+	orig = malloc(nhdrs * sizeof(*orig));
+	foreign = malloc(nhdrs * sizeof(*foreign));
+	buf = malloc(nhdrs * sizeof(*buf));
+
+	for (i = 0; i < nhdrs; i++) {
+		rnd_trace(&orig[i]);
+		to_foreign(&foreign[i], &orig[i]);
+	}
+
+	for (s = 0; s < N_SWAPPERS; s++) {
+		int wrong = 0;
+
+		if (!swapper_ok(&swappers[s]))
+			continue;
+
+		for (n = 1; n <= nhdrs && !wrong; n++) {
+			memcpy(buf, foreign, n * sizeof(*buf));
+			swappers[s].swap(buf, n);
+			for (i = 0; i < n; i++)
+				if (memcmp(&buf[i], &orig[i], sizeof(*buf))) {
+					fprintf(stderr, "%s: header %d of %d "
+						"swapped wrong\n",
+						swappers[s].name, i, n);
+					wrong = 1;
+					break;
+				}
+		}
+		printf("%-8s %s\n", swappers[s].name, wrong ? "FAIL" : "ok");
+		bad |= wrong;
+	}
+#ifndef HAVE_BSWAP_SHUFFLE
+	printf("shuffle  not built (no SSSE3 or NEON target)\n");
+#endif
+
+	free(orig);
+	free(foreign);
+	free(buf);
+	return bad;
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1.0e9 + ts.tv_nsec;
+}
+
+static void bench(void)
+{
+	struct blk_io_trace *buf = malloc(nhdrs * sizeof(*buf));
+	int i, s;
+
+	for (i = 0; i < nhdrs; i++) {
+		struct blk_io_trace t;
+
+		rnd_trace(&t);
+		to_foreign(&buf[i], &t);
+	}
+
+	for (s = 0; s < N_SWAPPERS; s++) {
+		double start;
+		long r;
+
+		if (!swapper_ok(&swappers[s]))
+			continue;
+
+		swappers[s].swap(buf, nhdrs);
+		start = now_ns();
+		for (r = 0; r < rounds; r++)
+			swappers[s].swap(buf, nhdrs);
+		printf("%-8s %6.2f ns/header\n", swappers[s].name,
+		       (now_ns() - start) / ((double)rounds * nhdrs));
+		sink = buf[nhdrs - 1].pid;
+	}
+#ifndef HAVE_BSWAP_SHUFFLE
+	printf("shuffle  not built (no SSSE3 or NEON target)\n");
+#endif
+
+	free(buf);
+}
+
+int main(int argc, char *argv[])
+{
+	int c, do_check = 0;
+
+	while ((c = getopt(argc, argv, S_OPTS)) != -1) {
+		switch (c) {
+		case 'c':
+			do_check = 1;
+			break;
+		case 'n':
+			nhdrs = atoi(optarg);
+			break;
+		case 'r':
+			rounds = atol(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (nhdrs <= 0 || rounds <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (do_check)
+		return check();
+
+	bench();
+	return 0;
+}
@@ -24,8 +24,13 @@
 
 #include "globals.h"
 
+/*
+ * With -b only the new depth is kept at each change; the text file has
+ * both ends of each step
+ */
 struct aqd_info {
 	FILE *fp;
+	struct bcol_buf *bp;
 	int na;		/* # active */
 };
 
@@ -38,6 +43,13 @@ void *aqd_alloc(struct d_info *dip)
 
 	ap = malloc(sizeof(*ap));
 	ap->na = 0;
+	ap->fp = NULL;
+
+	if (binary_data) {
+		ap->bp = bcol_alloc(BC_AQD, dip);
+		return ap;
+	}
+	ap->bp = NULL;
 
 	oname = malloc(strlen(aqd_name) + strlen(dip->dip_name) + 32);
 	sprintf(oname, "%s_%s_aqd.dat", aqd_name, dip->dip_name);
@@ -55,7 +67,11 @@ void *aqd_alloc(struct d_info *dip)
 
 void aqd_free(void *info)
 {
-	free(info);
+	struct aqd_info *ap = info;
+
+	if (ap)
+		bcol_free(ap->bp);
+	free(ap);
 }
 
 void aqd_issue(void *info, double ts)
@@ -63,7 +79,11 @@ void aqd_issue(void *info, double ts)
 	if (info) {
 		struct aqd_info *ap = info;
 
-		fprintf(ap->fp, "%lf %d\n%lf %d\n", ts, ap->na, ts, ap->na + 1);
+		if (ap->bp)
+			bcol_add(ap->bp, ts, ap->na + 1);
+		else
+			fprintf(ap->fp, "%lf %d\n%lf %d\n",
+					ts, ap->na, ts, ap->na + 1);
 		ap->na += 1;
 	}
 }
@@ -74,7 +94,10 @@ void aqd_complete(void *info, double ts)
 		struct aqd_info *ap = info;
 
 		if (ap->na > 0) {
-			fprintf(ap->fp, "%lf %d\n%lf %d\n",
+			if (ap->bp)
+				bcol_add(ap->bp, ts, ap->na - 1);
+			else
+				fprintf(ap->fp, "%lf %d\n%lf %d\n",
 					ts, ap->na, ts, ap->na - 1);
 			ap->na -= 1;
 		}
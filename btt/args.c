@@ -29,7 +29,7 @@
 
 #define SETBUFFER_SIZE	(64 * 1024)
 
-#define S_OPTS	"aAB:d:D:e:hi:I:l:L:m:M:o:p:P:q:Q:rs:S:t:T:u:VvXz:Z"
+#define S_OPTS	"aAbB:c:C:d:D:e:EhH:i:I:j:kK:l:L:m:M:o:p:P:q:Q:rR:s:S:t:T:u:VvW:Xz:Z"
 static struct option l_opts[] = {
 	{
 		.name = "seek-absolute",
@@ -43,12 +43,30 @@ static struct option l_opts[] = {
 		.flag = NULL,
 		.val = 'A'
 	},
+	{
+		.name = "binary-data",
+		.has_arg = no_argument,
+		.flag = NULL,
+		.val = 'b'
+	},
 	{
 		.name = "dump-blocknos",
 		.has_arg = required_argument,
 		.flag = NULL,
 		.val = 'B'
 	},
+	{
+		.name = "resume",
+		.has_arg = required_argument,
+		.flag = NULL,
+		.val = 'c'
+	},
+	{
+		.name = "cull-horizon",
+		.has_arg = required_argument,
+		.flag = NULL,
+		.val = 'C'
+	},
 	{
 		.name = "range-delta",
 		.has_arg = required_argument,
@@ -67,12 +85,24 @@ static struct option l_opts[] = {
 		.flag = NULL,
 		.val = 'e'
 	},
+	{
+		.name = "exact-seeks",
+		.has_arg = no_argument,
+		.flag = NULL,
+		.val = 'E'
+	},
 	{
 		.name = "help",
 		.has_arg = no_argument,
 		.flag = NULL,
 		.val = 'h'
 	},
+	{
+		.name = "percentiles",
+		.has_arg = required_argument,
+		.flag = NULL,
+		.val = 'H'
+	},
 	{
 		.name = "input-file",
 		.has_arg = required_argument,
@@ -85,6 +115,12 @@ static struct option l_opts[] = {
 		.flag = NULL,
 		.val = 'I'
 	},
+	{
+		.name = "checkpoint",
+		.has_arg = required_argument,
+		.flag = NULL,
+		.val = 'K'
+	},
 	{
 		.name = "d2c-latencies",
 		.has_arg = required_argument,
@@ -97,6 +133,18 @@ static struct option l_opts[] = {
 		.flag = NULL,
 		.val = 'L'
 	},
+	{
+		.name = "threads",
+		.has_arg = required_argument,
+		.flag = NULL,
+		.val = 'j'
+	},
+	{
+		.name = "stacks",
+		.has_arg = no_argument,
+		.flag = NULL,
+		.val = 'k'
+	},
 	{
 		.name = "seeks-per-second",
 		.has_arg = required_argument,
@@ -145,6 +193,12 @@ static struct option l_opts[] = {
 		.flag = NULL,
 		.val = 'r'
 	},
+	{
+		.name = "reorder",
+		.has_arg = required_argument,
+		.flag = NULL,
+		.val = 'R'
+	},
 	{
 		.name = "seeks",
 		.has_arg = required_argument,
@@ -187,6 +241,12 @@ static struct option l_opts[] = {
 		.flag = NULL,
 		.val = 'v'
 	},
+	{
+		.name = "checkpoint-interval",
+		.has_arg = required_argument,
+		.flag = NULL,
+		.val = 'W'
+	},
 	{
 		.name = "do-active",
 		.has_arg = no_argument,
@@ -213,13 +273,21 @@ static struct option l_opts[] = {
 static char usage_str[] = \
 	"\n[ -a               | --seek-absolute ]\n" \
 	"[ -A               | --all-data ]\n" \
+	"[ -b               | --binary-data ]\n" \
 	"[ -B <output name> | --dump-blocknos=<output name> ]\n" \
+	"[ -c <checkpoint>  | --resume=<checkpoint> ]\n" \
+	"[ -C <seconds>     | --cull-horizon=<seconds> ]\n" \
 	"[ -d <seconds>     | --range-delta=<seconds> ]\n" \
 	"[ -D <dev;...>     | --devices=<dev;...> ]\n" \
 	"[ -e <exe,...>     | --exes=<exe,...>  ]\n" \
+	"[ -E               | --exact-seeks ]\n" \
 	"[ -h               | --help ]\n" \
+	"[ -H <pct,...>     | --percentiles=<pct,...> ]\n" \
 	"[ -i <input name>  | --input-file=<input name> ]\n" \
 	"[ -I <output name> | --iostat=<output name> ]\n" \
+	"[ -j <threads>     | --threads=<threads> ]\n" \
+	"[ -k               | --stacks ]\n" \
+	"[ -K <checkpoint>  | --checkpoint=<checkpoint> ]\n" \
 	"[ -l <output name> | --d2c-latencies=<output name> ]\n" \
 	"[ -L <freq>        | --periodic-latencies=<freq> ]\n" \
 	"[ -m <output name> | --seeks-per-second=<output name> ]\n" \
@@ -230,6 +298,7 @@ static char usage_str[] = \
 	"[ -q <output name> | --q2c-latencies=<output name> ]\n" \
 	"[ -Q <output name> | --active-queue-depth=<output name> ]\n" \
 	"[ -r               | --no-remaps ]\n" \
+	"[ -R <traces>      | --reorder=<traces> ]\n" \
 	"[ -s <output name> | --seeks=<output name> ]\n" \
 	"[ -S <interval>    | --iostat-interval=<interval> ]\n" \
 	"[ -t <sec>         | --time-start=<sec> ]\n" \
@@ -237,6 +306,7 @@ static char usage_str[] = \
 	"[ -u <output name> | --unplug-hist=<output name> ]\n" \
 	"[ -V               | --version ]\n" \
 	"[ -v               | --verbose ]\n" \
+	"[ -W <seconds>     | --checkpoint-interval=<seconds> ]\n" \
 	"[ -X               | --easy-parse-avgs ]\n" \
 	"[ -z <output name> | --q2d-latencies=<output name> ]\n" \
 	"[ -Z               | --do-active\n" \
@@ -251,7 +321,7 @@ static FILE *setup_ofile(char *fname)
 {
 	if (fname) {
 		char *buf;
-		FILE *ofp = my_fopen(fname, "w");
+		FILE *ofp = ckpt_fopen(fname);
 
 		if (!ofp) {
 			perror(fname);
@@ -276,7 +346,7 @@ static FILE *std_open(char *output_name, char *sfx, char *msg)
 	char fname[strlen(output_name) + 32];
 
 	sprintf(fname, "%s.%s", output_name, sfx);
-	fp = my_fopen(fname, "w");
+	fp = ckpt_fopen(fname);
 	if (fp == NULL) {
 		perror(fname);
 		exit(1);
@@ -287,6 +357,28 @@ static FILE *std_open(char *output_name, char *sfx, char *msg)
 	return fp;
 }
 
+static void parse_pcts(char *str)
+{
+	char *p, *s = strdup(str);
+
+	pcts = malloc(N_PCTS_MAX * sizeof(*pcts));
+	for (p = strtok(s, ","); p; p = strtok(NULL, ",")) {
+		double pct = atof(p);
+
+		if (pct <= 0.0 || pct > 100.0) {
+			fprintf(stderr, "FATAL: bad percentile %s\n", p);
+			exit(1);
+		}
+		if (n_pcts == N_PCTS_MAX) {
+			fprintf(stderr, "FATAL: at most %d percentiles\n",
+				N_PCTS_MAX);
+			exit(1);
+		}
+		pcts[n_pcts++] = pct;
+	}
+	free(s);
+}
+
 void handle_args(int argc, char *argv[])
 {
 	int c;
@@ -299,9 +391,18 @@ void handle_args(int argc, char *argv[])
 		case 'A':
 			output_all_data = 1;
 			break;
+		case 'b':
+			binary_data = 1;
+			break;
 		case 'B':
 			bno_dump_name = optarg;
 			break;
+		case 'c':
+			resume_name = optarg;
+			break;
+		case 'C':
+			sscanf(optarg, "%lf", &cull_horizon);
+			break;
 		case 'd':
 			sscanf(optarg, "%lf", &range_delta);
 			break;
@@ -311,9 +412,15 @@ void handle_args(int argc, char *argv[])
 		case 'e':
 			exes = optarg;
 			break;
+		case 'E':
+			exact_seeks = 1;
+			break;
 		case 'h':
 			usage(argv[0]);
 			exit(0);
+		case 'H':
+			parse_pcts(optarg);
+			break;
 		case 'i':
 			input_name = optarg;
 			break;
@@ -326,6 +433,17 @@ void handle_args(int argc, char *argv[])
 		case 'I':
 			iostat_name = strdup(optarg);
 			break;
+		case 'j':
+			n_shards = atoi(optarg);
+			if (n_shards < 1)
+				n_shards = 1;
+			break;
+		case 'k':
+			do_stacks = 1;
+			break;
+		case 'K':
+			ckpt_name = optarg;
+			break;
 		case 'm':
 			sps_name = optarg;
 			break;
@@ -351,14 +469,31 @@ void handle_args(int argc, char *argv[])
 		case 'r':
 			ignore_remaps = 1;
 			break;
+		case 'R':
+			reorder_nr = atoi(optarg);
+			if (reorder_nr < 1)
+				reorder_nr = 1;
+			break;
 		case 's':
 			seek_name = optarg;
 			break;
 		case 'S': {
-			unsigned int interval;
+			char *end;
+			double interval = strtod(optarg, &end);
 
-			sscanf(optarg, "%u", &interval);
-			iostat_interval = (__u64)interval * 1000000000LL;
+			if (!strcmp(end, "ms"))
+				interval /= 1.0e3;
+			else if (!strcmp(end, "us"))
+				interval /= 1.0e6;
+			else if (*end != '\0' && strcmp(end, "s"))
+				interval = 0.0;
+
+			if (interval < 1.0e-6) {
+				fprintf(stderr, "FATAL: bad iostat interval %s\n",
+					optarg);
+				exit(1);
+			}
+			iostat_interval = (__u64)(interval * 1.0e9 + 0.5);
 			break;
 		}
 		case 't':
@@ -378,6 +513,11 @@ void handle_args(int argc, char *argv[])
 		case 'V':
 			printf("%s version %s\n", argv[0], bt_timeline_version);
 			exit(0);
+		case 'W':
+			ckpt_interval = atoi(optarg);
+			if (ckpt_interval < 0)
+				ckpt_interval = 0;
+			break;
 		case 'X':
 			easy_parse_avgs++;
 			break;
@@ -403,7 +543,39 @@ void handle_args(int argc, char *argv[])
 		exit(1);
 	}
 
+	/*
+	 * The per-IO dump is a single stream in trace order; in binary each
+	 * device keeps its own rows, and bcol2txt puts them back in order
+	 */
+	if (per_io_name && !binary_data)
+		n_shards = 1;
+
+	/*
+	 * Checkpoints hold the state the report is built from; the other
+	 * outputs (written a line per IO, or kept across shards) are not
+	 * carried over
+	 */
+	if (ckpt_name || resume_name) {
+		if (binary_data || bno_dump_name || do_stacks || d2c_name ||
+		    plat_freq > 0.0 || sps_name || per_io_name ||
+		    per_io_trees || q2c_name || aqd_name || seek_name ||
+		    unplug_hist_name || q2d_name) {
+			fprintf(stderr, "FATAL: -K and -c cannot be used with "
+				"-b, -B, -k, -l, -L, -m, -p, -P, -q, -Q, -s, "
+				"-u or -z\n");
+			exit(1);
+		}
+		n_shards = 1;
+	}
+	if (resume_name)
+		ckpt_resume_start();
+
 	setup_ifile(input_name);
+	if (streaming && (ckpt_name || resume_name)) {
+		fprintf(stderr, "FATAL: -K and -c need an input file, "
+			"not a stream\n");
+		exit(1);
+	}
 
 	if (output_name == NULL) {
 		rngs_ofp = avgs_ofp = msgs_ofp = stdout;
@@ -418,6 +590,19 @@ void handle_args(int argc, char *argv[])
 		}
 	}
 
-	iostat_ofp = setup_ofile(iostat_name);
-	per_io_ofp = setup_ofile(per_io_name);
+	if (!binary_data) {
+		iostat_ofp = setup_ofile(iostat_name);
+		per_io_ofp = setup_ofile(per_io_name);
+	}
+
+	/*
+	 * A live stream gets its summaries as it goes, and has to keep
+	 * its outstanding IOs in check
+	 */
+	if (streaming && !iostat_name)
+		iostat_ofp = stdout;
+	if (cull_horizon < 0.0)
+		cull_horizon = streaming ? 30.0 : 0.0;
+	if (binary_data)
+		bcol_init();
 }
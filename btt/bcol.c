@@ -0,0 +1,262 @@
+/*
+ * blktrace output analysis: generate a timeline & gather statistics
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/*
+ * Binary columnar output for the per-IO data files (-b). Rather than one
+ * text file per device and metric, each metric family goes to a single
+ * <name>_<family>.bin file. Every device gathers its rows per column and
+ * writes them out as a row group once BC_ROWS have been seen (and at the
+ * end), so each row group holds one device's rows in time order. All
+ * values are in the byte order of the machine that wrote the file, given
+ * by the byte order mark in the file header.
+ *
+ * file header:
+ *	char magic[8]		"BTTCOL01"
+ *	u32 bom			0x01020304
+ *	u32 ncols
+ *	ncols x { char name[8]; u32 width; u32 type; }
+ *				type 'f' float, 'u' unsigned, 'i' signed
+ *
+ * row group, repeated:
+ *	u32 magic		"RGRP"
+ *	u32 device
+ *	u32 nrows
+ *	ncols x column data, nrows * width bytes each, in header order
+ */
+#include <stdarg.h>
+#include <pthread.h>
+#include "globals.h"
+
+#define BC_MAGIC	"BTTCOL01"
+#define BC_BOM		0x01020304
+#define BC_ROWS		4096
+#define BC_COLS_MAX	12
+
+struct bcol_col {
+	char name[8];
+	__u32 width, type;
+};
+
+struct bcol_family {
+	char *sfx;
+	int ncols;
+	struct bcol_col cols[BC_COLS_MAX];
+
+	FILE *fp;
+	pthread_mutex_t lock;
+};
+
+struct bcol_buf {
+	struct bcol_family *bfp;
+	__u32 device;
+	unsigned int nrows;
+	char *cols[BC_COLS_MAX];
+};
+
+#define F64(name)	{ name, 8, 'f' }
+#define U64(name)	{ name, 8, 'u' }
+#define I64(name)	{ name, 8, 'i' }
+#define U32(name)	{ name, 4, 'u' }
+#define U8(name)	{ name, 1, 'u' }
+
+static struct bcol_family families[BC_NR] = {
+	[BC_Q2D] = { "q2d", 2, { F64("time"), F64("latency") } },
+	[BC_D2C] = { "d2c", 2, { F64("time"), F64("latency") } },
+	[BC_Q2C] = { "q2c", 2, { F64("time"), F64("latency") } },
+	[BC_AQD] = { "aqd", 2, { F64("time"), U32("depth") } },
+	[BC_BNOS] = { "bnos", 4,
+		      { F64("time"), U64("start"), U64("end"), U8("write") } },
+	[BC_SPS] = { "sps", 2, { F64("time"), F64("sps") } },
+	[BC_D2D_SEEK] = { "d2d", 3, { F64("time"), I64("dist"), U8("write") } },
+	[BC_Q2Q_SEEK] = { "q2q", 3, { F64("time"), I64("dist"), U8("write") } },
+	[BC_Q2D_PLAT] = { "q2d_plat", 2, { F64("time"), F64("latency") } },
+	[BC_Q2C_PLAT] = { "q2c_plat", 2, { F64("time"), F64("latency") } },
+	[BC_D2C_PLAT] = { "d2c_plat", 2, { F64("time"), F64("latency") } },
+	[BC_PIT] = { "pit", 3, { U64("q"), U64("d"), U64("c") } },
+	[BC_IOSTAT] = { "iostat", 11,
+			{ F64("time"), U32("rrqm"), U32("wrqm"), U32("r"),
+			  U32("w"), U64("rsec"), U64("wsec"), U64("wait"),
+			  U64("svctm"), F64("avgqu"), F64("util") } },
+	[BC_PER_IO] = { "per_io", 12,
+			{ U64("q"), U64("sec"), U32("nsec"), U32("g"),
+			  U32("i"), U32("m"), U32("d"), U64("c"),
+			  U64("dsec"), U32("dnsec"), U64("csec"),
+			  U32("cnsec") } },
+};
+
+int binary_data;
+
+static void bcol_write(struct bcol_family *bfp, void *buf, size_t len)
+{
+	if (len && fwrite(buf, len, 1, bfp->fp) != 1) {
+		perror("binary data output");
+		exit(1);
+	}
+}
+
+static void bcol_open(int fam, char *name)
+{
+	struct bcol_family *bfp = &families[fam];
+	char *oname;
+	__u32 v;
+	int i;
+
+	if (name) {
+		oname = malloc(strlen(name) + strlen(bfp->sfx) + 8);
+		sprintf(oname, "%s_%s.bin", name, bfp->sfx);
+	} else {
+		oname = malloc(strlen(bfp->sfx) + 8);
+		sprintf(oname, "%s.bin", bfp->sfx);
+	}
+
+	if ((bfp->fp = my_fopen(oname, "w")) == NULL) {
+		perror(oname);
+		exit(1);
+	}
+	add_file(bfp->fp, oname);
+	pthread_mutex_init(&bfp->lock, NULL);
+
+	bcol_write(bfp, BC_MAGIC, 8);
+	v = BC_BOM;
+	bcol_write(bfp, &v, sizeof(v));
+	v = bfp->ncols;
+	bcol_write(bfp, &v, sizeof(v));
+	for (i = 0; i < bfp->ncols; i++)
+		bcol_write(bfp, &bfp->cols[i], sizeof(bfp->cols[i]));
+}
+
+/*
+ * Open one file for each family asked for on the command line
+ */
+void bcol_init(void)
+{
+	if (q2d_name)
+		bcol_open(BC_Q2D, q2d_name);
+	if (d2c_name)
+		bcol_open(BC_D2C, d2c_name);
+	if (q2c_name)
+		bcol_open(BC_Q2C, q2c_name);
+	if (aqd_name)
+		bcol_open(BC_AQD, aqd_name);
+	if (bno_dump_name)
+		bcol_open(BC_BNOS, bno_dump_name);
+	if (sps_name)
+		bcol_open(BC_SPS, sps_name);
+	if (seek_name) {
+		bcol_open(BC_D2D_SEEK, seek_name);
+		bcol_open(BC_Q2Q_SEEK, seek_name);
+	}
+	if (plat_freq > 0.0) {
+		bcol_open(BC_Q2D_PLAT, NULL);
+		bcol_open(BC_Q2C_PLAT, NULL);
+		bcol_open(BC_D2C_PLAT, NULL);
+	}
+	if (per_io_trees)
+		bcol_open(BC_PIT, per_io_trees);
+	if (iostat_name)
+		bcol_open(BC_IOSTAT, iostat_name);
+	if (per_io_name)
+		bcol_open(BC_PER_IO, per_io_name);
+}
+
+struct bcol_buf *bcol_alloc(int fam, struct d_info *dip)
+{
+	struct bcol_family *bfp = &families[fam];
+	struct bcol_buf *bp;
+	int i;
+
+	if (!bfp->fp)
+		return NULL;
+
+	bp = malloc(sizeof(*bp));
+	bp->bfp = bfp;
+	bp->device = dip->device;
+	bp->nrows = 0;
+	for (i = 0; i < bfp->ncols; i++)
+		bp->cols[i] = malloc(BC_ROWS * bfp->cols[i].width);
+
+	return bp;
+}
+
+/*
+ * Devices are handled by one thread each, but share the family's file
+ */
+static void bcol_flush(struct bcol_buf *bp)
+{
+	struct bcol_family *bfp = bp->bfp;
+	__u32 v;
+	int i;
+
+	if (!bp->nrows)
+		return;
+
+	pthread_mutex_lock(&bfp->lock);
+	bcol_write(bfp, "RGRP", 4);
+	bcol_write(bfp, &bp->device, sizeof(bp->device));
+	v = bp->nrows;
+	bcol_write(bfp, &v, sizeof(v));
+	for (i = 0; i < bfp->ncols; i++)
+		bcol_write(bfp, bp->cols[i], bp->nrows * bfp->cols[i].width);
+	pthread_mutex_unlock(&bfp->lock);
+
+	bp->nrows = 0;
+}
+
+void bcol_free(struct bcol_buf *bp)
+{
+	int i;
+
+	if (bp == NULL)
+		return;
+
+	bcol_flush(bp);
+	for (i = 0; i < bp->bfp->ncols; i++)
+		free(bp->cols[i]);
+	free(bp);
+}
+
+/*
+ * Add one row: a double for each 'f' column, a __u64 (or long long) for
+ * each 64-bit integer column and an unsigned int for each narrower one
+ */
+void bcol_add(struct bcol_buf *bp, ...)
+{
+	struct bcol_family *bfp = bp->bfp;
+	va_list ap;
+	int i;
+
+	va_start(ap, bp);
+	for (i = 0; i < bfp->ncols; i++) {
+		struct bcol_col *cp = &bfp->cols[i];
+		char *dst = bp->cols[i] + bp->nrows * cp->width;
+
+		if (cp->type == 'f')
+			*(double *)dst = va_arg(ap, double);
+		else if (cp->width == 8)
+			*(__u64 *)dst = va_arg(ap, __u64);
+		else if (cp->width == 4)
+			*(__u32 *)dst = va_arg(ap, unsigned int);
+		else
+			*(__u8 *)dst = va_arg(ap, unsigned int);
+	}
+	va_end(ap);
+
+	if (++bp->nrows == BC_ROWS)
+		bcol_flush(bp);
+}
@@ -0,0 +1,555 @@
+/*
+ * blktrace output analysis: generate a timeline & gather statistics
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/*
+ * Turns a binary columnar file written by btt -b (see bcol.c) back into
+ * text. Per-IO dumps (-p) come out as btt would have written them, with
+ * every device's rows merged back into completion order; per-IO trees
+ * (-P) go to one <device>_pit.dat file per device, again as btt writes
+ * them. Anything else is listed one row per line.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <asm/types.h>
+
+#include "blktrace.h"
+
+#define BC_MAGIC	"BTTCOL01"
+#define BC_BOM		0x01020304
+#define BC_COLS_MAX	16
+#define OBUF_SIZE	(1024 * 1024)
+
+struct col {
+	char name[9];
+	__u32 width, type;
+};
+
+/*
+ * One row group, with where each of its columns starts
+ */
+struct rgrp {
+	__u32 device, nrows;
+	char *cols[BC_COLS_MAX];
+};
+
+/*
+ * A device's row groups in file order, and how far through them we are
+ */
+struct dev {
+	__u32 device;
+	int ngrps, grp;
+	unsigned int row;
+	int *grps;
+	FILE *ofp;
+	__u64 c_time, d_time;
+};
+
+static char bcol2txt_version[] = "1.00";
+
+static struct col cols[BC_COLS_MAX];
+static int ncols, swap;
+static struct rgrp *grps;
+static int ngrps;
+static struct dev *devs;
+static int ndevs;
+static FILE *out_fp;
+static char *ifile;
+
+#define S_OPTS	"ho:V"
+static struct option l_opts[] = {
+	{
+		.name = "help",
+		.has_arg = no_argument,
+		.flag = NULL,
+		.val = 'h'
+	},
+	{
+		.name = "output-file",
+		.has_arg = required_argument,
+		.flag = NULL,
+		.val = 'o'
+	},
+	{
+		.name = "version",
+		.has_arg = no_argument,
+		.flag = NULL,
+		.val = 'V'
+	},
+	{
+		.name = NULL,
+	}
+};
+
+static char usage_str[] = \
+	"[ -h               | --help ]\n" \
+	"[ -o <output name> | --output-file=<output name> ]\n" \
+	"[ -V               | --version ]\n" \
+	"<btt binary data file>\n" \
+	"\n";
+
+static void usage(char *prog)
+{
+	fprintf(stderr, "Usage: %s %s", prog, usage_str);
+}
+
+static void bad_file(char *why)
+{
+	fprintf(stderr, "%s: %s\n", ifile, why);
+	exit(1);
+}
+
+static inline __u32 get32(char *p)
+{
+	__u32 v;
+
+	memcpy(&v, p, sizeof(v));
+	return swap ? bswap_32(v) : v;
+}
+
+static inline __u64 get64(char *p)
+{
+	__u64 v;
+
+	memcpy(&v, p, sizeof(v));
+	return swap ? bswap_64(v) : v;
+}
+
+static inline __u32 col32(struct rgrp *gp, int col, unsigned int row)
+{
+	return get32(gp->cols[col] + row * 4);
+}
+
+static inline __u64 col64(struct rgrp *gp, int col, unsigned int row)
+{
+	return get64(gp->cols[col] + row * 8);
+}
+
+static int col_find(char *name)
+{
+	int i;
+
+	for (i = 0; i < ncols; i++)
+		if (!strcmp(cols[i].name, name))
+			return i;
+	return -1;
+}
+
+static struct dev *dev_find(__u32 device)
+{
+	int i;
+
+	for (i = 0; i < ndevs; i++)
+		if (devs[i].device == device)
+			return &devs[i];
+
+	devs = realloc(devs, (ndevs + 1) * sizeof(*devs));
+	memset(&devs[ndevs], 0, sizeof(*devs));
+	devs[ndevs].device = device;
+	devs[ndevs].c_time = (__u64)-1;
+	devs[ndevs].d_time = (__u64)-1;
+	return &devs[ndevs++];
+}
+
+/*
+ * Check the header, and find each row group and its device
+ */
+static void read_file(char *p, size_t size)
+{
+	char *end = p + size;
+	int i;
+
+	if (size < 16 || memcmp(p, BC_MAGIC, 8))
+		bad_file("not a btt binary data file");
+	swap = get32(p + 8) != BC_BOM;
+	ncols = get32(p + 12);
+	if (ncols < 1 || ncols > BC_COLS_MAX || size < 16 + ncols * 16UL)
+		bad_file("bad header");
+	p += 16;
+
+	for (i = 0; i < ncols; i++, p += 16) {
+		memcpy(cols[i].name, p, 8);
+		cols[i].name[8] = '\0';
+		cols[i].width = get32(p + 8);
+		cols[i].type = get32(p + 12);
+		if (cols[i].width != 1 && cols[i].width != 4 &&
+		    cols[i].width != 8)
+			bad_file("bad column width");
+	}
+
+	while (p < end) {
+		struct rgrp *gp;
+		struct dev *dp;
+
+		if (end - p < 12 || memcmp(p, "RGRP", 4))
+			bad_file("bad row group");
+
+		grps = realloc(grps, (ngrps + 1) * sizeof(*grps));
+		gp = &grps[ngrps];
+		gp->device = get32(p + 4);
+		gp->nrows = get32(p + 8);
+		p += 12;
+		for (i = 0; i < ncols; i++) {
+			gp->cols[i] = p;
+			if ((size_t)(end - p) < (size_t)gp->nrows * cols[i].width)
+				bad_file("truncated row group");
+			p += (size_t)gp->nrows * cols[i].width;
+		}
+
+		dp = dev_find(gp->device);
+		dp->grps = realloc(dp->grps, (dp->ngrps + 1) * sizeof(int));
+		dp->grps[dp->ngrps++] = ngrps++;
+	}
+}
+
+/*
+ * Per-IO dump: rows carry G, I, M and D as 32-bit offsets from the Q
+ * (~0 when not seen) and C as a 64-bit one
+ */
+enum { PIO_Q, PIO_SEC, PIO_NSEC, PIO_G, PIO_I, PIO_M, PIO_D, PIO_C,
+       PIO_DSEC, PIO_DNSEC, PIO_CSEC, PIO_CNSEC, PIO_NCOLS };
+static char *pio_cols[PIO_NCOLS] = {
+	"q", "sec", "nsec", "g", "i", "m", "d", "c", "dsec", "dnsec", "csec",
+	"cnsec"
+};
+static int pio_idx[PIO_NCOLS];
+
+static inline void __out(__u64 tm, char type, __u64 sec, __u32 nsec,
+			 int indent)
+{
+	fprintf(out_fp, "%s%5d.%09lu %c %10llu+%-4u\n",
+		indent ? "         " : "",
+		(int)SECONDS(tm), (unsigned long)NANO_SECONDS(tm),
+		type, (unsigned long long)sec, nsec);
+}
+
+static inline void __out_delta(__u64 q_time, __u32 delta, char type,
+			       __u64 sec, __u32 nsec)
+{
+	if (delta != ~0U)
+		__out(q_time + delta, type, sec, nsec, 1);
+}
+
+static inline struct rgrp *dev_grp(struct dev *dp)
+{
+	return &grps[dp->grps[dp->grp]];
+}
+
+static inline __u64 pio_c_time(struct dev *dp)
+{
+	struct rgrp *gp = dev_grp(dp);
+
+	return col64(gp, pio_idx[PIO_Q], dp->row) +
+	       col64(gp, pio_idx[PIO_C], dp->row);
+}
+
+static inline int dev_next(struct dev *dp)
+{
+	if (++dp->row == dev_grp(dp)->nrows) {
+		dp->row = 0;
+		if (++dp->grp == dp->ngrps)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * The device with the earliest completion comes first, ties going to
+ * the one written out first
+ */
+static inline int dev_before(struct dev *a, struct dev *b)
+{
+	if (a->c_time != b->c_time)
+		return a->c_time < b->c_time;
+	return a->grps[a->grp] < b->grps[b->grp];
+}
+
+static void heap_down(struct dev **heap, int n, int i)
+{
+	for (;;) {
+		int l = 2 * i + 1, r = l + 1, m = i;
+		struct dev *t;
+
+		if (l < n && dev_before(heap[l], heap[m]))
+			m = l;
+		if (r < n && dev_before(heap[r], heap[m]))
+			m = r;
+		if (m == i)
+			break;
+		t = heap[i];
+		heap[i] = heap[m];
+		heap[m] = t;
+		i = m;
+	}
+}
+
+/*
+ * Write out the Qs making up the device's next completion
+ */
+static int pio_complete(struct dev *dp)
+{
+	__u64 c_time = dp->c_time, c_sec;
+	int more;
+
+	c_sec = col64(dev_grp(dp), pio_idx[PIO_CSEC], dp->row);
+	do {
+		struct rgrp *gp = dev_grp(dp);
+		unsigned int r = dp->row;
+		__u64 q_time = col64(gp, pio_idx[PIO_Q], r);
+		__u64 sec = col64(gp, pio_idx[PIO_SEC], r);
+		__u32 nsec = col32(gp, pio_idx[PIO_NSEC], r);
+
+		fprintf(out_fp, "%3d,%-3d: ", MAJOR(dp->device),
+			MINOR(dp->device));
+		__out(q_time, 'Q', sec, nsec, 0);
+		__out_delta(q_time, col32(gp, pio_idx[PIO_G], r), 'G', sec,
+			    nsec);
+		__out_delta(q_time, col32(gp, pio_idx[PIO_I], r), 'I', sec,
+			    nsec);
+		__out_delta(q_time, col32(gp, pio_idx[PIO_M], r), 'M', sec,
+			    nsec);
+		__out_delta(q_time, col32(gp, pio_idx[PIO_D], r), 'D',
+			    col64(gp, pio_idx[PIO_DSEC], r),
+			    col32(gp, pio_idx[PIO_DNSEC], r));
+		__out(c_time, 'C', c_sec, col32(gp, pio_idx[PIO_CNSEC], r), 1);
+		fprintf(out_fp, "\n");
+
+		more = dev_next(dp);
+		if (more)
+			dp->c_time = pio_c_time(dp);
+	} while (more && dp->c_time == c_time &&
+		 col64(dev_grp(dp), pio_idx[PIO_CSEC], dp->row) == c_sec);
+
+	fprintf(out_fp, "-----------------------------------------\n");
+	return more;
+}
+
+static void per_io_dump(void)
+{
+	struct dev **heap = malloc(ndevs * sizeof(*heap));
+	int i, n = 0;
+
+	for (i = 0; i < ndevs; i++) {
+		devs[i].c_time = pio_c_time(&devs[i]);
+		heap[n++] = &devs[i];
+	}
+	for (i = n / 2 - 1; i >= 0; i--)
+		heap_down(heap, n, i);
+
+	while (n) {
+		if (!pio_complete(heap[0]))
+			heap[0] = heap[--n];
+		heap_down(heap, n, 0);
+	}
+	free(heap);
+}
+
+/*
+ * Per-IO trees: each line has the Qs for one C, then the D and C times
+ */
+static void pit_close(struct dev *dp)
+{
+	fprintf(dp->ofp, "| %d.%09lu | %d.%09lu\n",
+		(int)SECONDS(dp->d_time),
+		(unsigned long)NANO_SECONDS(dp->d_time),
+		(int)SECONDS(dp->c_time),
+		(unsigned long)NANO_SECONDS(dp->c_time));
+	dp->d_time = (__u64)-1;
+}
+
+static void per_io_trees(void)
+{
+	int q = col_find("q"), d = col_find("d"), c = col_find("c");
+	int i, g;
+
+	for (i = 0; i < ndevs; i++) {
+		char fname[64];
+
+		sprintf(fname, "%d,%d_pit.dat", MAJOR(devs[i].device),
+			MINOR(devs[i].device));
+		if ((devs[i].ofp = fopen(fname, "w")) == NULL) {
+			perror(fname);
+			exit(1);
+		}
+		setvbuf(devs[i].ofp, NULL, _IOFBF, OBUF_SIZE / 16);
+	}
+
+	for (g = 0; g < ngrps; g++) {
+		struct rgrp *gp = &grps[g];
+		struct dev *dp = dev_find(gp->device);
+		unsigned int r;
+
+		for (r = 0; r < gp->nrows; r++) {
+			__u64 q_time = col64(gp, q, r);
+			__u64 d_time = col64(gp, d, r);
+			__u64 c_time = col64(gp, c, r);
+
+			if (c_time != dp->c_time) {
+				if (dp->c_time != (__u64)-1)
+					pit_close(dp);
+				dp->c_time = c_time;
+			}
+			if (d_time != (__u64)-1)
+				dp->d_time = d_time;
+			fprintf(dp->ofp, "%d.%09lu ", (int)SECONDS(q_time),
+				(unsigned long)NANO_SECONDS(q_time));
+		}
+	}
+
+	for (i = 0; i < ndevs; i++) {
+		if (devs[i].c_time != (__u64)-1)
+			pit_close(&devs[i]);
+		fclose(devs[i].ofp);
+	}
+}
+
+/*
+ * Anything else: a header naming the columns, then one line per row
+ */
+static void list_rows(void)
+{
+	int i, g;
+
+	fprintf(out_fp, "# device");
+	for (i = 0; i < ncols; i++)
+		fprintf(out_fp, " %s", cols[i].name);
+	fprintf(out_fp, "\n");
+
+	for (g = 0; g < ngrps; g++) {
+		struct rgrp *gp = &grps[g];
+		unsigned int r;
+
+		for (r = 0; r < gp->nrows; r++) {
+			fprintf(out_fp, "%d,%d", MAJOR(gp->device),
+				MINOR(gp->device));
+			for (i = 0; i < ncols; i++) {
+				char *p = gp->cols[i] + r * cols[i].width;
+				__u64 v;
+
+				if (cols[i].width == 8)
+					v = get64(p);
+				else if (cols[i].width == 4)
+					v = get32(p);
+				else
+					v = *(__u8 *)p;
+
+				if (cols[i].type == 'f') {
+					double f;
+
+					memcpy(&f, &v, sizeof(f));
+					fprintf(out_fp, " %.9lf", f);
+				} else if (cols[i].type == 'i')
+					fprintf(out_fp, " %lld", (long long)v);
+				else
+					fprintf(out_fp, " %llu",
+						(unsigned long long)v);
+			}
+			fprintf(out_fp, "\n");
+		}
+	}
+}
+
+static int is_per_io(void)
+{
+	int i;
+
+	for (i = 0; i < PIO_NCOLS; i++)
+		if ((pio_idx[i] = col_find(pio_cols[i])) < 0)
+			return 0;
+	return 1;
+}
+
+static int is_pit(void)
+{
+	return ncols == 3 && col_find("q") >= 0 && col_find("d") >= 0 &&
+	       col_find("c") >= 0;
+}
+
+int main(int argc, char *argv[])
+{
+	char *oname = NULL;
+	struct stat st;
+	void *p;
+	int c, fd;
+
+	while ((c = getopt_long(argc, argv, S_OPTS, l_opts, NULL)) != -1) {
+		switch (c) {
+		case 'o':
+			oname = optarg;
+			break;
+		case 'V':
+			printf("%s version %s\n", argv[0], bcol2txt_version);
+			return 0;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind != argc - 1) {
+		usage(argv[0]);
+		return 1;
+	}
+	ifile = argv[optind];
+
+	if ((fd = open(ifile, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+		perror(ifile);
+		return 1;
+	}
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p == MAP_FAILED) {
+		perror(ifile);
+		return 1;
+	}
+	madvise(p, st.st_size, MADV_SEQUENTIAL);
+	read_file(p, st.st_size);
+
+	if (oname) {
+		if ((out_fp = fopen(oname, "w")) == NULL) {
+			perror(oname);
+			return 1;
+		}
+	} else
+		out_fp = stdout;
+	setvbuf(out_fp, NULL, _IOFBF, OBUF_SIZE);
+
+	if (is_per_io()) {
+		if (ndevs)
+			per_io_dump();
+	} else if (is_pit())
+		per_io_trees();
+	else
+		list_rows();
+
+	if (fclose(out_fp)) {
+		perror(oname ? oname : "stdout");
+		return 1;
+	}
+	munmap(p, st.st_size);
+	close(fd);
+	return 0;
+}
@@ -22,6 +22,7 @@
 
 struct bno_dump {
 	FILE *rfp, *wfp, *cfp;
+	struct bcol_buf *bp;	/* -b: one row per IO, r/w in a column */
 };
 
 static FILE *bno_dump_open(struct d_info *dip, char rwc)
@@ -52,6 +53,13 @@ void *bno_dump_alloc(struct d_info *dip)
 	if (bno_dump_name == NULL) return NULL;
 
 	bdp = malloc(sizeof(*bdp));
+	if (binary_data) {
+		bdp->rfp = bdp->wfp = bdp->cfp = NULL;
+		bdp->bp = bcol_alloc(BC_BNOS, dip);
+		return bdp;
+	}
+
+	bdp->bp = NULL;
 	bdp->rfp = bno_dump_open(dip, 'r');
 	bdp->wfp = bno_dump_open(dip, 'w');
 	bdp->cfp = bno_dump_open(dip, 'c');
@@ -61,14 +69,21 @@ void *bno_dump_alloc(struct d_info *dip)
 
 void bno_dump_free(void *param)
 {
-	free(param);
+	struct bno_dump *bdp = param;
+
+	if (bdp)
+		bcol_free(bdp->bp);
+	free(bdp);
 }
 
 void bno_dump_add(void *handle, struct io *iop)
 {
 	struct bno_dump *bdp = handle;
 
-	if (bdp) {
+	if (bdp && bdp->bp)
+		bcol_add(bdp->bp, BIT_TIME(iop->t.time), BIT_START(iop),
+			 BIT_END(iop), !IOP_READ(iop));
+	else if (bdp) {
 		FILE *fp = IOP_READ(iop) ? bdp->rfp : bdp->wfp;
 
 		if (fp)
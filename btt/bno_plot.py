@@ -28,7 +28,7 @@ bno_plot.py
 Utilizes gnuplot to generate a 3D plot of the block number output
 from btt.  If no <files> are specified, it will utilize all files
 generated after btt was run with -B blknos (meaning: all files of the
-form blknos*[rw].dat).
+form blknos*[rw].dat, or blknos_bnos.bin if btt was also given -b).
 
 The -K option forces bno_plot.py to put the keys below the graph,
 typically all keys for input files are put in the upper right corner
@@ -38,7 +38,7 @@ automatically push the keys under the graph.
 To exit the plotter, enter 'quit' or ^D at the 'gnuplot> ' prompt.
 """
 
-import getopt, glob, os, sys, tempfile
+import getopt, glob, os, struct, sys, tempfile
 
 verbose	= 0
 cmds	= """
@@ -75,10 +75,50 @@ def parse_args(in_args):
 			keys_below = True
 
 	if len(args) > 0:	bnos = args
-	else:			bnos = glob.glob('blknos*[rw].dat')
+	else:			bnos = glob.glob('blknos*[rw].dat') + \
+				       glob.glob('blknos_bnos.bin')
 
 	return (bnos, keys_below)
 
+#-----------------------------------------------------------------------------
+def read_bin(f):
+	"""Returns a list of (name, rows) for each device and direction in a
+	btt -b block number file: rows are (time, start, end) tuples."""
+
+	fi = open(f, 'rb')
+	data = fi.read()
+	fi.close()
+
+	bo = '<'
+	if struct.unpack('<I', data[8:12])[0] != 0x01020304:
+		bo = '>'
+	(ncols,) = struct.unpack(bo + 'I', data[12:16])
+	if data[0:8] != b'BTTCOL01' or ncols != 4:
+		print >>sys.stderr, '%s is not a btt block number file' % f
+		sys.exit(1)
+
+	off = 16 + ncols * 16
+	out = {}
+	while off + 12 <= len(data):
+		(magic, dev, n) = struct.unpack(bo + '4sII', data[off:off+12])
+		off += 12
+		ts = struct.unpack('%s%dd' % (bo, n), data[off:off+8*n])
+		off += 8 * n
+		ss = struct.unpack('%s%dQ' % (bo, n), data[off:off+8*n])
+		off += 8 * n
+		es = struct.unpack('%s%dQ' % (bo, n), data[off:off+8*n])
+		off += 8 * n
+		ws = struct.unpack('%s%dB' % (bo, n), data[off:off+n])
+		off += n
+
+		for idx in range(n):
+			name = '%s_%d,%d_%s.dat' % (f[:f.rfind('_')], dev >> 20,
+					dev & 0xfffff, 'rw'[ws[idx]])
+			if not name in out: out[name] = []
+			out[name].append((ts[idx], ss[idx], es[idx]))
+
+	return out.items()
+
 #-----------------------------------------------------------------------------
 if __name__ == '__main__':
 	(bnos, keys_below) = parse_args(sys.argv[1:])
@@ -93,22 +133,29 @@ if __name__ == '__main__':
 	os.mkdir(tmpdir)
 
 	plot_cmd = None
+	nfiles = 0
 	for f in bnos:
-		t = '%s/%s' % (tmpdir, f)
+		if f.endswith('.bin'):
+			sets = read_bin(f)
+		else:
+			sets = [(f, [line.split(None) for line in open(f, 'r')])]
+
+		for (name, rows) in sets:
+			t = '%s/%s' % (tmpdir, name)
 
-		fo = open(t, 'w')
-		for line in open(f, 'r'):
-			fld = line.split(None)
-			print >>fo, fld[0], fld[1], int(fld[2])-int(fld[1])
-		fo.close()
+			fo = open(t, 'w')
+			for fld in rows:
+				print >>fo, fld[0], fld[1], int(fld[2])-int(fld[1])
+			fo.close()
 
-		t = t[t.rfind('/')+1:]
-		if plot_cmd == None: plot_cmd = "splot '%s'" % t
-		else:                plot_cmd = "%s,'%s'" % (plot_cmd, t)
+			t = t[t.rfind('/')+1:]
+			if plot_cmd == None: plot_cmd = "splot '%s'" % t
+			else:                plot_cmd = "%s,'%s'" % (plot_cmd, t)
+			nfiles += 1
 
 	fo = open('%s/plot.cmds' % tmpdir, 'w')
 	print >>fo, cmds
-	if len(bnos) > 10 or keys_below: print >>fo, 'set key below'
+	if nfiles > 10 or keys_below: print >>fo, 'set key below'
 	print >>fo, plot_cmd
 	fo.close()
 
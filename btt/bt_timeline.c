@@ -32,43 +32,47 @@ char *d2c_name, *q2c_name, *per_io_name, *unplug_hist_name;
 char *sps_name, *aqd_name, *q2d_name, *per_io_trees;
 FILE *rngs_ofp, *avgs_ofp, *xavgs_ofp, *per_io_ofp, *msgs_ofp;
 int verbose, done, time_bounded, output_all_data, seek_absolute;
-int easy_parse_avgs, ignore_remaps, do_p_live;
+int easy_parse_avgs, ignore_remaps, do_p_live, exact_seeks;
 double t_astart, t_aend, last_t_seen;
-unsigned long n_traces;
-struct avgs_info all_avgs;
+unsigned long n_traces, n_culled;
+__thread struct avgs_info all_avgs;
 unsigned int n_devs;
 time_t genesis, last_vtrace;
 LIST_HEAD(all_devs);
 LIST_HEAD(all_procs);
-LIST_HEAD(all_ios);
-LIST_HEAD(free_ios);
+__thread struct list_head free_ios;
+__thread void *free_pdus;
 LIST_HEAD(free_bilinks);
-__u64 q_histo[N_HIST_BKTS], d_histo[N_HIST_BKTS];
+__thread __u64 q_histo[N_HIST_BKTS], d_histo[N_HIST_BKTS];
 
 double plat_freq = 0.0;
+double cull_horizon = -1.0;
+double *pcts;
+int n_pcts;
 double range_delta = 0.1;
 __u64 last_q = (__u64)-1;
 
-struct region_info all_regions = {
-	.qranges = LIST_HEAD_INIT(all_regions.qranges),
-	.cranges = LIST_HEAD_INIT(all_regions.cranges),
-};
+struct region_info all_regions;
 
 int process(void);
 
 int main(int argc, char *argv[])
 {
+	INIT_LIST_HEAD(&free_ios);
 	handle_args(argc, argv);
 
 	init_dev_heads();
 	iostat_init();
 	if (!rstat_init())
 		return 1;
+	if (resume_name)
+		ckpt_resume();
 
 	if (process() || output_avgs(avgs_ofp) || output_ranges(rngs_ofp))
 		return 1;
 
 	if (iostat_ofp) {
+		iostat_flush();
 		fprintf(iostat_ofp, "\n");
 		iostat_dump_stats(iostat_last_stamp, 1);
 	}
@@ -87,8 +91,8 @@ int main(int argc, char *argv[])
 	dip_exit();
 	rstat_exit();
 	pip_exit();
-	io_free_all();
 	region_exit(&all_regions);
+	lh_free(&all_avgs);
 	p_live_exit();
 	clean_allocs();
 
@@ -108,12 +112,20 @@ int process(void)
 
 	genesis = last_vtrace = time(NULL);
 	gettimeofday(&tvs, NULL);
-	while (!done && next_trace(&iop->t, &iop->pdu)) {
+	if (n_shards > 1)
+		shard_start();
+	while (!done && next_trace(iop)) {
 		add_trace(iop);
 		iop = io_alloc();
+		if (ckpt_name)
+			ckpt_check();
 	}
 
 	io_release(iop);
+	if (n_shards > 1)
+		shard_finish();
+	if (ckpt_name)
+		ckpt_save();
 	gettimeofday(&tve, NULL);
 
 	if (verbose) {
@@ -125,7 +137,13 @@ int process(void)
 		printf("%10lu traces @ %.1lf Ktps in %.6lf seconds\n",
 			n_traces, tps/1000.0,
 			dt_input);
+		if (n_culled)
+			printf("%10lu outstanding IOs culled\n", n_culled);
 	}
 
+	if (strm_late)
+		fprintf(stderr, "%lu traces came in too late to be put in order"
+				" (see -R)\n", strm_late);
+
 	return ret;
 }
@@ -53,6 +53,10 @@ Arguments:
   that type will be made. The output file name will be the default for
   each type. The -L (--no-legend) option will be obeyed for all plots,
   but the -o (--output) and -T (--title) options will be ignored.
+
+  Binary data files written by btt -b (for example 'lat_d2c.bin' or
+  'bno_bnos.bin') may be given in place of, or alongside, text files;
+  each device in them is plotted as if it had its own file.
 """
 
 __author__ = 'Alan D. Brunelle <alan.brunelle@hp.com>'
@@ -61,7 +65,7 @@ __author__ = 'Alan D. Brunelle <alan.brunelle@hp.com>'
 
 import matplotlib
 matplotlib.use('Agg')
-import getopt, glob, os, sys
+import getopt, glob, os, struct, sys
 import matplotlib.pyplot as plt
 
 plot_size	= [10.9, 8.4]	# inches...
@@ -93,6 +97,50 @@ def gen_legends(ax, legends):
 	for t in leg.get_texts():
 		t.set_fontsize('xx-small')
 
+#------------------------------------------------------------------------------
+def read_bin(file):
+	"""Read a btt -b (binary columnar) data file.
+
+	Returns the list of column names, and a dictionary mapping each
+	device ('maj,min') to a dictionary of column name to values.
+	"""
+	codes = { ('f', 8):'d', ('u', 8):'Q', ('i', 8):'q', ('u', 4):'I',
+		  ('u', 1):'B' }
+
+	fi = open(file, 'rb')
+	data = fi.read()
+	fi.close()
+
+	if data[0:8] != b'BTTCOL01':
+		fatal('%s is not a btt binary data file' % file)
+	bo = '<'
+	if struct.unpack('<I', data[8:12])[0] != 0x01020304:
+		bo = '>'
+
+	cols = []
+	(ncols,) = struct.unpack(bo + 'I', data[12:16])
+	off = 16
+	for idx in range(ncols):
+		(name, width, t) = struct.unpack(bo + '8sII', data[off:off+16])
+		name = name.rstrip(b'\0').decode()
+		cols.append((name, codes[(chr(t), width)], width))
+		off += 16
+
+	devs = {}
+	while off + 12 <= len(data):
+		(magic, dev, n) = struct.unpack(bo + '4sII', data[off:off+12])
+		off += 12
+		name = '%d,%d' % (dev >> 20, dev & 0xfffff)
+		if not name in devs:
+			devs[name] = dict([(c[0], []) for c in cols])
+		for (cname, code, width) in cols:
+			fmt = '%s%d%s' % (bo, n, code)
+			devs[name][cname].extend(struct.unpack(fmt,
+						data[off:off+n*width]))
+			off += n * width
+
+	return [c[0] for c in cols], devs
+
 #----------------------------------------------------------------------
 def get_data(files):
 	"""Retrieve data from files provided.
@@ -154,6 +202,46 @@ def get_data(files):
 
 		return axs, ays
 
+	#--------------------------------------------------------------
+	def series(file):
+		"""Returns a (name, Xs, Ys) tuple for each series in file.
+
+		Binary files hold all devices: each gets a name like that of
+		the text file btt would have written for it.
+		"""
+
+		if not file.endswith('.bin'):
+			xs = []
+			ys = []
+			for line in open(file, 'r'):
+				f = line.rstrip().split(None)
+				if line.find('#') == 0 or len(f) < 2:
+					continue
+				xs.append(f[0])
+				ys.append(f[1])
+			return [(file, xs, ys)]
+
+		(cols, devs) = read_bin(file)
+		pre = file[:file.rfind('_')]
+		post = file[file.rfind('_'):file.rfind('.bin')]
+
+		ret = []
+		for dev in devs:
+			xs = devs[dev][cols[0]]
+			ys = devs[dev][cols[1]]
+			if post == '_aqd':	# Only the new depths are kept
+				_xs = []
+				_ys = []
+				last = 0
+				for idx in range(len(xs)):
+					_xs += [xs[idx], xs[idx]]
+					_ys += [last, ys[idx]]
+					last = ys[idx]
+				xs = _xs
+				ys = _ys
+			ret.append(('%s_%s%s.dat' % (pre, dev, post), xs, ys))
+		return ret
+
 	#--------------------------------------------------------------
 	global verbose
 
@@ -165,22 +253,20 @@ def get_data(files):
 		elif verbose:
 			print 'Processing %s' % file
 
-		xs = []
-		ys = []
-		for line in open(file, 'r'):
-			f = line.rstrip().split(None)
-			if line.find('#') == 0 or len(f) < 2:
-				continue
-			(min_x, max_x, x) = check(min_x, max_x, f[0])
-			(min_y, max_y, y) = check(min_y, max_y, f[1])
-			xs.append(x)
-			ys.append(y)
-
-		db[file] = {'x':xs, 'y':ys}
-		if len(xs) > 10:
-			db[file]['ax'], db[file]['ay'] = avg(xs, ys)
-		else:
-			db[file]['ax'] = db[file]['ay'] = None
+		for (name, fxs, fys) in series(file):
+			xs = []
+			ys = []
+			for idx in range(len(fxs)):
+				(min_x, max_x, x) = check(min_x, max_x, fxs[idx])
+				(min_y, max_y, y) = check(min_y, max_y, fys[idx])
+				xs.append(x)
+				ys.append(y)
+
+			db[name] = {'x':xs, 'y':ys}
+			if len(xs) > 10:
+				db[name]['ax'], db[name]['ay'] = avg(xs, ys)
+			else:
+				db[name]['ax'] = db[name]['ay'] = None
 
 	db['min_x'] = min_x
 	db['max_x'] = max_x
@@ -364,8 +450,10 @@ def get_files(type):
 					break
 			else:
 				files.append(fn)
+		files += glob.glob('*_bnos.bin')
 	else:
 		files = glob.glob('*%s.dat' % type)
+		files += glob.glob('*_%s.bin' % type)
 	return files
 
 #------------------------------------------------------------------------------
@@ -0,0 +1,412 @@
+/*
+ * blktrace output analysis: generate a timeline & gather statistics
+ *
+ * Copyright (C) 2006 Alan D. Brunelle <Alan.Brunelle@hp.com>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/*
+ * Checkpoints (-K). Every so often (-W), and once all the input is in,
+ * the state of the analysis is written out: the averages and histograms
+ * behind the report, activity ranges, iostat and I/O rate counts, the
+ * processes, seek and active period summaries, the IOs still outstanding
+ * and how far into each input file it all got. A run that dies can then
+ * be picked up (-c) from the last checkpoint, and a trace that has grown
+ * since a run ended analyzed from where that run stopped.
+ *
+ * Files written as the run goes (.msg, iostat, the _iops_fp.dat and
+ * _mbps_fp.dat rates) are cut back to their length at the checkpoint and
+ * appended to. A checkpoint goes to <name>.tmp first and is then renamed
+ * over the last one, so a crash part way through loses nothing. It is in
+ * the byte order and structure layout of the btt that wrote it.
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <time.h>
+#include "globals.h"
+
+#define CKPT_MAGIC	0x62747463	/* "bttc" */
+#define CKPT_END	0x62747465	/* "btte" */
+#define CKPT_VERSION	2
+#define CKPT_EVERY	4096		/* traces between looks at the clock */
+
+/*
+ * Settings the saved state depends on: a resumed run has to match them
+ */
+struct ckpt_opts {
+	__u64 iostat_interval;
+	int output_all_data, exact_seeks, seek_absolute;
+	int ignore_remaps, do_p_live;
+};
+
+struct ckpt_file {
+	struct list_head head;
+	char *name;
+	FILE *fp;
+	__u64 len;
+};
+
+char *ckpt_name, *resume_name;
+int ckpt_interval = 300;
+
+static FILE *rfp;
+static time_t ckpt_last;
+static LIST_HEAD(ckpt_files);		/* open: their lengths get saved */
+static LIST_HEAD(resume_files);		/* saved: cut back when opened */
+
+static void ckpt_opts_get(struct ckpt_opts *op)
+{
+	memset(op, 0, sizeof(*op));
+	op->iostat_interval = iostat_interval;
+	op->output_all_data = output_all_data;
+	op->exact_seeks = exact_seeks;
+	op->seek_absolute = seek_absolute;
+	op->ignore_remaps = ignore_remaps;
+	op->do_p_live = do_p_live;
+}
+
+void ckpt_put(FILE *fp, void *p, size_t len)
+{
+	if (len)
+		fwrite(p, len, 1, fp);
+}
+
+void ckpt_get(FILE *fp, void *p, size_t len)
+{
+	if (len && fread(p, len, 1, fp) != 1) {
+		fprintf(stderr, "FATAL: checkpoint %s is cut short\n",
+			resume_name);
+		exit(1);
+	}
+}
+
+void ckpt_put_str(FILE *fp, char *str)
+{
+	__u32 len = strlen(str);
+
+	ckpt_put(fp, &len, sizeof(len));
+	ckpt_put(fp, str, len);
+}
+
+char *ckpt_get_str(FILE *fp)
+{
+	__u32 len;
+	char *str;
+
+	ckpt_get(fp, &len, sizeof(len));
+	str = malloc(len + 1);
+	ckpt_get(fp, str, len);
+	str[len] = '\0';
+
+	return str;
+}
+
+void ckpt_put_avg(FILE *fp, struct avg_info *ap)
+{
+	ckpt_put(fp, ap, sizeof(*ap));
+	ckpt_put(fp, ap->hist, ap->hist_nr * sizeof(*ap->hist));
+}
+
+void ckpt_get_avg(FILE *fp, struct avg_info *ap)
+{
+	free(ap->hist);
+	ckpt_get(fp, ap, sizeof(*ap));
+	ap->hist = NULL;
+	if (ap->hist_nr > 0) {
+		ap->hist = malloc(ap->hist_nr * sizeof(*ap->hist));
+		ckpt_get(fp, ap->hist, ap->hist_nr * sizeof(*ap->hist));
+	}
+}
+
+void ckpt_put_avgs(FILE *fp, struct avgs_info *ap)
+{
+	struct avg_info *aip = (struct avg_info *)ap;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(*ap) / sizeof(*aip); i++)
+		ckpt_put_avg(fp, &aip[i]);
+}
+
+void ckpt_get_avgs(FILE *fp, struct avgs_info *ap)
+{
+	struct avg_info *aip = (struct avg_info *)ap;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(*ap) / sizeof(*aip); i++)
+		ckpt_get_avg(fp, &aip[i]);
+}
+
+static void put_ranges(FILE *fp, struct range_list *rlp)
+{
+	ckpt_put(fp, &rlp->nr, sizeof(rlp->nr));
+	ckpt_put(fp, rlp->ranges, rlp->nr * sizeof(*rlp->ranges));
+}
+
+static void get_ranges(FILE *fp, struct range_list *rlp)
+{
+	free(rlp->ranges);
+	ckpt_get(fp, &rlp->nr, sizeof(rlp->nr));
+	rlp->size = rlp->nr;
+	rlp->ranges = NULL;
+	if (rlp->nr) {
+		rlp->ranges = malloc(rlp->nr * sizeof(*rlp->ranges));
+		ckpt_get(fp, rlp->ranges, rlp->nr * sizeof(*rlp->ranges));
+	}
+}
+
+void ckpt_put_region(FILE *fp, struct region_info *reg)
+{
+	put_ranges(fp, &reg->qranges);
+	put_ranges(fp, &reg->cranges);
+}
+
+void ckpt_get_region(FILE *fp, struct region_info *reg)
+{
+	get_ranges(fp, &reg->qranges);
+	get_ranges(fp, &reg->cranges);
+}
+
+/*
+ * Opens an output file written as the run goes. Resuming, one that was
+ * open at the checkpoint is cut back to its length then, and added to.
+ */
+FILE *ckpt_fopen(char *name)
+{
+	struct list_head *p;
+	struct ckpt_file *cfp;
+	char *mode = "w";
+	FILE *fp;
+
+	__list_for_each(p, &resume_files) {
+		cfp = list_entry(p, struct ckpt_file, head);
+		if (!strcmp(cfp->name, name)) {
+			if (truncate(name, cfp->len) < 0 && errno != ENOENT) {
+				perror(name);
+				exit(1);
+			}
+			mode = "a";
+			break;
+		}
+	}
+
+	fp = my_fopen(name, mode);
+	if (fp && *mode == 'a')
+		fseeko(fp, 0, SEEK_END);	/* so ftello tells the length */
+	if (fp && ckpt_name) {
+		cfp = malloc(sizeof(*cfp));
+		cfp->name = strdup(name);
+		cfp->fp = fp;
+		list_add_tail(&cfp->head, &ckpt_files);
+		add_buf(cfp->name);
+		add_buf(cfp);
+	}
+
+	return fp;
+}
+
+static void put_files(FILE *fp)
+{
+	struct list_head *p;
+	__u32 n = 0;
+
+	__list_for_each(p, &ckpt_files)
+		n++;
+	ckpt_put(fp, &n, sizeof(n));
+
+	__list_for_each(p, &ckpt_files) {
+		struct ckpt_file *cfp = list_entry(p, struct ckpt_file, head);
+
+		fflush(cfp->fp);
+		cfp->len = ftello(cfp->fp);
+		ckpt_put_str(fp, cfp->name);
+		ckpt_put(fp, &cfp->len, sizeof(cfp->len));
+	}
+}
+
+static void get_files(FILE *fp)
+{
+	__u32 i, n;
+
+	ckpt_get(fp, &n, sizeof(n));
+	for (i = 0; i < n; i++) {
+		struct ckpt_file *cfp = malloc(sizeof(*cfp));
+
+		cfp->name = ckpt_get_str(fp);
+		cfp->fp = NULL;
+		ckpt_get(fp, &cfp->len, sizeof(cfp->len));
+		list_add_tail(&cfp->head, &resume_files);
+		add_buf(cfp->name);
+		add_buf(cfp);
+	}
+}
+
+static void put_globals(FILE *fp)
+{
+	ckpt_put(fp, &n_traces, sizeof(n_traces));
+	ckpt_put(fp, &n_culled, sizeof(n_culled));
+	ckpt_put(fp, &last_t_seen, sizeof(last_t_seen));
+	ckpt_put(fp, &last_q, sizeof(last_q));
+	ckpt_put(fp, &trace_seq, sizeof(trace_seq));
+	ckpt_put(fp, q_histo, sizeof(q_histo));
+	ckpt_put(fp, d_histo, sizeof(d_histo));
+	ckpt_put_avgs(fp, &all_avgs);
+	ckpt_put_region(fp, &all_regions);
+}
+
+static void get_globals(FILE *fp)
+{
+	ckpt_get(fp, &n_traces, sizeof(n_traces));
+	ckpt_get(fp, &n_culled, sizeof(n_culled));
+	ckpt_get(fp, &last_t_seen, sizeof(last_t_seen));
+	ckpt_get(fp, &last_q, sizeof(last_q));
+	ckpt_get(fp, &trace_seq, sizeof(trace_seq));
+	ckpt_get(fp, q_histo, sizeof(q_histo));
+	ckpt_get(fp, d_histo, sizeof(d_histo));
+	ckpt_get_avgs(fp, &all_avgs);
+	ckpt_get_region(fp, &all_regions);
+}
+
+void ckpt_save(void)
+{
+	FILE *fp;
+	__u32 v;
+	struct ckpt_opts opts;
+	char tmp[strlen(ckpt_name) + 8];
+
+	sprintf(tmp, "%s.tmp", ckpt_name);
+	if ((fp = my_fopen(tmp, "w")) == NULL) {
+		perror(tmp);
+		return;
+	}
+
+	iostat_flush();
+	fflush(msgs_ofp);
+
+	v = CKPT_MAGIC;
+	ckpt_put(fp, &v, sizeof(v));
+	v = CKPT_VERSION;
+	ckpt_put(fp, &v, sizeof(v));
+	ckpt_opts_get(&opts);
+	ckpt_put(fp, &opts, sizeof(opts));
+
+	put_files(fp);
+	ifile_ckpt_save(fp);
+	put_globals(fp);
+	iostat_ckpt_save(fp);
+	rstat_ckpt_save(fp, NULL);
+	p_live_ckpt_save(fp, NULL);
+	pip_ckpt_save(fp);
+	dip_ckpt_save(fp);
+
+	v = CKPT_END;
+	ckpt_put(fp, &v, sizeof(v));
+
+	/*
+	 * A checkpoint that could not be written in full is left aside,
+	 * rather than stopping the run
+	 */
+	if (ferror(fp) | fclose(fp) || rename(tmp, ckpt_name) < 0) {
+		perror(ckpt_name);
+		unlink(tmp);
+	} else if (verbose)
+		printf("\nCheckpoint written to %s\n", ckpt_name);
+
+	ckpt_last = time(NULL);
+}
+
+/*
+ * Checkpoint when -W seconds have gone by since the last one
+ */
+void ckpt_check(void)
+{
+	static int n;
+
+	if (++n < CKPT_EVERY)
+		return;
+	n = 0;
+
+	if (ckpt_last == 0)
+		ckpt_last = time(NULL);
+	else if (time(NULL) - ckpt_last >= ckpt_interval)
+		ckpt_save();
+}
+
+/*
+ * The first part of resuming, before the input and outputs are opened:
+ * where to start reading from, and how much of each output to keep
+ */
+void ckpt_resume_start(void)
+{
+	__u32 v;
+	struct ckpt_opts opts, saved;
+
+	if ((rfp = my_fopen(resume_name, "r")) == NULL) {
+		perror(resume_name);
+		exit(1);
+	}
+
+	ckpt_get(rfp, &v, sizeof(v));
+	if (v != CKPT_MAGIC) {
+		fprintf(stderr, "FATAL: %s is not a btt checkpoint\n",
+			resume_name);
+		exit(1);
+	}
+	ckpt_get(rfp, &v, sizeof(v));
+	if (v != CKPT_VERSION) {
+		fprintf(stderr, "FATAL: checkpoint %s is version %u, "
+			"not %d\n", resume_name, v, CKPT_VERSION);
+		exit(1);
+	}
+
+	ckpt_opts_get(&opts);
+	ckpt_get(rfp, &saved, sizeof(saved));
+	if (memcmp(&opts, &saved, sizeof(opts))) {
+		fprintf(stderr, "FATAL: checkpoint %s was made with other "
+			"-a, -A, -E, -r, -S or -Z settings\n", resume_name);
+		exit(1);
+	}
+
+	get_files(rfp);
+	ifile_ckpt_load(rfp);
+}
+
+/*
+ * The rest of it, once everything is set up
+ */
+void ckpt_resume(void)
+{
+	__u32 v;
+
+	get_globals(rfp);
+	iostat_ckpt_load(rfp);
+	rstat_ckpt_load(rfp, NULL);
+	p_live_ckpt_load(rfp, NULL);
+	pip_ckpt_load(rfp);
+	dip_ckpt_load(rfp);
+
+	ckpt_get(rfp, &v, sizeof(v));
+	if (v != CKPT_END) {
+		fprintf(stderr, "FATAL: checkpoint %s is corrupt\n",
+			resume_name);
+		exit(1);
+	}
+
+	fclose(rfp);
+	rfp = NULL;
+}
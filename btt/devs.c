@@ -19,37 +19,57 @@
  *
  */
 #include <stdio.h>
+#include <pthread.h>
 #include "globals.h"
 
 #define N_DEV_HASH	128
 #define DEV_HASH(dev)	((MAJOR(dev) ^ MINOR(dev)) & (N_DEV_HASH - 1))
+#define PIT_BUF_SIZE	(64 * 1024)
 struct list_head	dev_heads[N_DEV_HASH];
 
-static inline void *dip_rb_mkhds(void)
+/*
+ * Shards set up their own devices concurrently; __dip_find is lock free,
+ * so a new device is only linked into its hash chain once fully built.
+ */
+static pthread_mutex_t dev_lock = PTHREAD_MUTEX_INITIALIZER;
+static __u64 next_cull;
+
+static inline void dev_hash_add(struct list_head *new, struct list_head *head)
 {
-	size_t len = N_IOP_TYPES * sizeof(struct rb_root);
-	return memset(malloc(len), 0, len);
+	new->next = head;
+	new->prev = head->prev;
+	__sync_synchronize();
+	head->prev->next = new;
+	head->prev = new;
 }
 
-static void __destroy(struct rb_node *n)
+static inline void *dip_rb_mkhds(void)
 {
-	if (n) {
-		struct io *iop = rb_entry(n, struct io, rb_node);
-
-		__destroy(n->rb_left);
-		__destroy(n->rb_right);
-		io_release(iop);
-	}
+	size_t len = N_IOP_TYPES * sizeof(struct io_index);
+	return memset(malloc(len), 0, len);
 }
 
-static void __destroy_heads(struct rb_root *roots)
+static void __destroy_heads(struct io_index *ixs)
 {
+	unsigned int j;
 	int i;
 
-	for (i = 0; i < N_IOP_TYPES; i++)
-		__destroy(roots[i].rb_node);
+	for (i = 0; i < N_IOP_TYPES; i++) {
+		struct io_index *ix = &ixs[i];
+
+		/*
+		 * Releasing an IO pulls the rest of its probe run back, so
+		 * only move on once the slot stays empty
+		 */
+		for (j = 0; j < ix->hash_size; )
+			if (ix->hash[j])
+				io_release(ix->hash[j]);
+			else
+				j++;
+		free(ix->hash);
+	}
 
-	free(roots);
+	free(ixs);
 }
 
 void init_dev_heads(void)
@@ -77,6 +97,8 @@ void __dip_exit(struct d_info *dip)
 {
 	list_del(&dip->all_head);
 	__destroy_heads(dip->heads);
+	free(dip->ages);
+	lh_free(&dip->avgs);
 	region_exit(&dip->regions);
 	seeki_free(dip->seek_handle);
 	seeki_free(dip->q2q_handle);
@@ -85,11 +107,17 @@ void __dip_exit(struct d_info *dip)
 	plat_free(dip->q2c_plat_handle);
 	plat_free(dip->d2c_plat_handle);
 	p_live_free(dip->p_live_handle);
+	stacks_free(dip->stacks_handle);
 	bno_dump_free(dip->bno_dump_handle);
 	unplug_hist_free(dip->up_hist_handle);
 	rstat_free(dip->rstat_handle);
 	if (output_all_data)
 		q2d_free(dip->q2d_priv);
+	latency_free(dip);
+	bcol_free(dip->pit_bp);
+	bcol_free(dip->iostat_bp);
+	bcol_free(dip->per_io_bp);
+	iostat_free(dip->iostat_handle);
 	if (dip->pit_fp)
 		fclose(dip->pit_fp);
 	free(dip);
@@ -113,49 +141,130 @@ static inline FILE *open_pit(struct d_info *dip)
 	sprintf(str, "%s_pit.dat", dip->dip_name);
 	if ((fp = my_fopen(str, "w")) == NULL)
 		perror(str);
+	else
+		setvbuf(fp, NULL, _IOFBF, PIT_BUF_SIZE);
 
 	return fp;
 }
 
-struct d_info *dip_alloc(__u32 device, struct io *iop)
+/*
+ * With a cull horizon (-C) each device also keeps the IOs it takes in
+ * the order they came in, which is time order, in a ring. Completed IOs
+ * are not taken off it: an entry whose IO has since been released (or
+ * reused for another) is passed over, and such entries are squeezed out
+ * before the ring grows.
+ */
+static inline struct age_ent *age_at(struct d_info *dip, unsigned int i)
 {
-	struct d_info *dip = __dip_find(device);
+	return &dip->ages[(dip->ages_head + i) & (dip->ages_size - 1)];
+}
 
-	if (dip == NULL) {
-		dip = malloc(sizeof(struct d_info));
-		memset(dip, 0, sizeof(*dip));
-		dip->device = device;
-		dip->devmap = dev_map_find(device);
-		dip->last_q = (__u64)-1;
-		dip->heads = dip_rb_mkhds();
-		region_init(&dip->regions);
-		dip->start_time = BIT_TIME(iop->t.time);
-		dip->pre_culling = 1;
-
-		mkhandle(dip, dip->dip_name, 256);
-
-		latency_alloc(dip);
-		dip->aqd_handle = aqd_alloc(dip);
-		dip->bno_dump_handle = bno_dump_alloc(dip);
-		dip->up_hist_handle = unplug_hist_alloc(dip);
-		dip->seek_handle = seeki_alloc(dip, "_d2d");
-		dip->q2q_handle = seeki_alloc(dip, "_q2q");
-		dip->q2d_plat_handle = plat_alloc(dip, "_q2d");
-		dip->q2c_plat_handle = plat_alloc(dip, "_q2c");
-		dip->d2c_plat_handle = plat_alloc(dip, "_d2c");
-		dip->rstat_handle = rstat_alloc(dip);
-		dip->p_live_handle = p_live_alloc();
-
-		if (per_io_trees)
-			dip->pit_fp = open_pit(dip);
+static inline int age_live(struct d_info *dip, struct age_ent *ap)
+{
+	return ap->iop->linked && ap->iop->dip == dip &&
+					ap->iop->t.time == ap->time;
+}
+
+static void age_make_room(struct d_info *dip)
+{
+	struct io_index *ixs = dip->heads;
+	unsigned int i, n = 0, nlinked = 0, size = dip->ages_size;
+	struct age_ent *ages;
 
-		if (output_all_data)
-			dip->q2d_priv = q2d_alloc();
+	for (i = 0; i < N_IOP_TYPES; i++)
+		nlinked += ixs[i].hash_nr;
+	if (2 * nlinked >= size)
+		size = size ? 2 * size : 64;
+
+	ages = malloc(size * sizeof(*ages));
+	for (i = 0; i < dip->ages_nr; i++) {
+		struct age_ent *ap = age_at(dip, i);
 
-		list_add_tail(&dip->hash_head, &dev_heads[DEV_HASH(device)]);
-		list_add_tail(&dip->all_head, &all_devs);
-		n_devs++;
+		if (age_live(dip, ap))
+			ages[n++] = *ap;
 	}
+	if (n == size) {
+		size *= 2;
+		ages = realloc(ages, size * sizeof(*ages));
+	}
+
+	free(dip->ages);
+	dip->ages = ages;
+	dip->ages_size = size;
+	dip->ages_head = 0;
+	dip->ages_nr = n;
+}
+
+static void age_add(struct d_info *dip, struct io *iop)
+{
+	struct age_ent *ap;
+
+	if (dip->ages_nr == dip->ages_size)
+		age_make_room(dip);
+
+	ap = age_at(dip, dip->ages_nr++);
+	ap->iop = iop;
+	ap->time = iop->t.time;
+}
+
+static struct d_info *dip_new(__u32 device, double start_time)
+{
+	struct d_info *dip;
+
+	pthread_mutex_lock(&dev_lock);
+	dip = malloc(sizeof(struct d_info));
+	memset(dip, 0, sizeof(*dip));
+	dip->device = device;
+	dip->first_seq = cur_seq;
+	dip->devmap = dev_map_find(device);
+	dip->last_q = (__u64)-1;
+	dip->heads = dip_rb_mkhds();
+	region_init(&dip->regions);
+	dip->start_time = start_time;
+	dip->pre_culling = 1;
+	iostat_dev_init(dip);
+
+	mkhandle(dip, dip->dip_name, 256);
+
+	latency_alloc(dip);
+	dip->aqd_handle = aqd_alloc(dip);
+	dip->bno_dump_handle = bno_dump_alloc(dip);
+	dip->up_hist_handle = unplug_hist_alloc(dip);
+	dip->seek_handle = seeki_alloc(dip, "_d2d");
+	dip->q2q_handle = seeki_alloc(dip, "_q2q");
+	dip->q2d_plat_handle = plat_alloc(dip, "_q2d");
+	dip->q2c_plat_handle = plat_alloc(dip, "_q2c");
+	dip->d2c_plat_handle = plat_alloc(dip, "_d2c");
+	dip->rstat_handle = rstat_alloc(dip);
+	dip->p_live_handle = p_live_alloc();
+	dip->stacks_handle = stacks_alloc();
+
+	if (per_io_trees) {
+		if (binary_data)
+			dip->pit_bp = bcol_alloc(BC_PIT, dip);
+		else
+			dip->pit_fp = open_pit(dip);
+	}
+
+	dip->iostat_bp = bcol_alloc(BC_IOSTAT, dip);
+	dip->per_io_bp = bcol_alloc(BC_PER_IO, dip);
+	if (output_all_data)
+		dip->q2d_priv = q2d_alloc();
+
+	dev_hash_add(&dip->hash_head, &dev_heads[DEV_HASH(device)]);
+	list_add_tail(&dip->all_head, &all_devs);
+	n_devs++;
+	pthread_mutex_unlock(&dev_lock);
+
+	return dip;
+}
+
+struct d_info *dip_alloc(__u32 device, struct io *iop)
+{
+	struct d_info *dip = __dip_find(device);
+
+	if (dip == NULL)
+		dip = dip_new(device, BIT_TIME(iop->t.time));
 
 	if (dip->pre_culling) {
 		if (iop->type == IOP_Q || iop->type == IOP_A)
@@ -165,6 +274,8 @@ struct d_info *dip_alloc(__u32 device, struct io *iop)
 	}
 
 	iop->linked = dip_rb_ins(dip, iop);
+	if (iop->linked && cull_horizon > 0.0)
+		age_add(dip, iop);
 	dip->end_time = BIT_TIME(iop->t.time);
 
 	return dip;
@@ -227,6 +338,244 @@ void dip_foreach_out(void (*func)(struct d_info *, void *), void *arg)
 	}
 }
 
+/*
+ * Outstanding IOs whose completions never show up (lost, or the trace
+ * started with them in flight) would otherwise be kept, and searched
+ * past, for good; on a live stream that is without bound. Every quarter
+ * horizon, drop whatever came in more than a horizon ago: the front of
+ * each device's ring.
+ */
+static void __dip_cull(struct d_info *dip, __u64 now, __u64 before)
+{
+	while (dip->ages_nr) {
+		struct age_ent *ap = age_at(dip, 0);
+		struct io *iop = ap->iop;
+
+		if (ap->time >= before)
+			break;
+
+		dip->ages_head = (dip->ages_head + 1) & (dip->ages_size - 1);
+		dip->ages_nr--;
+		if (!age_live(dip, ap))
+			continue;
+
+		if (iop->type == IOP_Q) {
+			__u64 d_time = iop_time(iop, IOT_D);
+
+			iostat_cull(iop, now);
+			if (d_time != (__u64)-1)
+				p_live_drop(dip, d_time);
+			dip->n_culled_q++;
+		}
+		io_release(iop);
+		dip->n_culled++;
+		n_culled++;
+	}
+}
+
+void dip_cull_check(__u64 now)
+{
+	__u64 horizon = (__u64)(cull_horizon * 1.0e9);
+	struct list_head *p;
+
+	if (now < next_cull || now < horizon)
+		return;
+
+	shard_sync();
+	__list_for_each(p, &all_devs)
+		__dip_cull(list_entry(p, struct d_info, all_head), now,
+			   now - horizon);
+	next_cull = now + horizon / 4;
+}
+
+static void io_ckpt_save(FILE *fp, struct io *iop)
+{
+	__u8 has_cold = iop->cold != NULL;
+
+	ckpt_put(fp, &iop->t, sizeof(iop->t));
+	ckpt_put(fp, &iop->type, sizeof(iop->type));
+	ckpt_put(fp, iop->dt, sizeof(iop->dt));
+	ckpt_put(fp, &iop->pdu_len, sizeof(iop->pdu_len));
+	ckpt_put(fp, iop->pdu, iop->pdu_len);
+	ckpt_put(fp, &has_cold, sizeof(has_cold));
+	if (has_cold)
+		ckpt_put(fp, iop->cold, sizeof(*iop->cold));
+}
+
+/*
+ * The IOs outstanding on a device. Those that could not be linked in (a
+ * second IO at a sector) were never kept, so are not saved.
+ */
+static void ios_ckpt_save(FILE *fp, struct d_info *dip)
+{
+	struct io_index *ixs = dip->heads;
+	unsigned int j;
+	__u64 n = 0;
+	int i;
+
+	for (i = 0; i < N_IOP_TYPES; i++)
+		n += ixs[i].hash_nr;
+	ckpt_put(fp, &n, sizeof(n));
+
+	for (i = 0; i < N_IOP_TYPES; i++)
+		for (j = 0; j < ixs[i].hash_size; j++)
+			if (ixs[i].hash[j])
+				io_ckpt_save(fp, ixs[i].hash[j]);
+}
+
+static int age_cmp(const void *a, const void *b)
+{
+	const struct age_ent *x = a, *y = b;
+
+	if (x->time != y->time)
+		return x->time < y->time ? -1 : 1;
+	if (x->iop->t.sector != y->iop->t.sector)
+		return x->iop->t.sector < y->iop->t.sector ? -1 : 1;
+	return 0;
+}
+
+static void ios_ckpt_load(FILE *fp, struct d_info *dip)
+{
+	__u64 n;
+
+	ckpt_get(fp, &n, sizeof(n));
+	while (n--) {
+		struct io *iop = io_alloc();
+		__u8 has_cold;
+
+		ckpt_get(fp, &iop->t, sizeof(iop->t));
+		ckpt_get(fp, &iop->type, sizeof(iop->type));
+		ckpt_get(fp, iop->dt, sizeof(iop->dt));
+		ckpt_get(fp, &iop->pdu_len, sizeof(iop->pdu_len));
+		if (iop->pdu_len) {
+			iop->pdu = pdu_alloc(iop->pdu_len);
+			ckpt_get(fp, iop->pdu, iop->pdu_len);
+		}
+		ckpt_get(fp, &has_cold, sizeof(has_cold));
+		if (has_cold) {
+			iop->cold = malloc(sizeof(*iop->cold));
+			ckpt_get(fp, iop->cold, sizeof(*iop->cold));
+		}
+
+		iop->dip = dip;
+		iop->linked = dip_rb_ins(dip, iop);
+		iop->pip = pip_lookup(iop->t.pid);
+		if (iop->linked && cull_horizon > 0.0)
+			age_add(dip, iop);
+	}
+
+	/* Saved in hash order; the ring wants them back in time order */
+	if (dip->ages_nr)
+		qsort(dip->ages, dip->ages_nr, sizeof(*dip->ages), age_cmp);
+}
+
+static void dip_ckpt_save_one(FILE *fp, struct d_info *dip)
+{
+	ckpt_put(fp, &dip->device, sizeof(dip->device));
+	ckpt_put(fp, &dip->first_seq, sizeof(dip->first_seq));
+	ckpt_put(fp, &dip->start_time, sizeof(dip->start_time));
+	ckpt_put(fp, &dip->end_time, sizeof(dip->end_time));
+	ckpt_put(fp, &dip->last_q, sizeof(dip->last_q));
+	ckpt_put(fp, &dip->n_qs, sizeof(dip->n_qs));
+	ckpt_put(fp, &dip->n_ds, sizeof(dip->n_ds));
+	ckpt_put(fp, &dip->n_culled, sizeof(dip->n_culled));
+	ckpt_put(fp, &dip->n_culled_q, sizeof(dip->n_culled_q));
+	ckpt_put(fp, &dip->n_act_q, sizeof(dip->n_act_q));
+	ckpt_put(fp, &dip->t_act_q, sizeof(dip->t_act_q));
+	ckpt_put(fp, &dip->pre_culling, sizeof(dip->pre_culling));
+	ckpt_put(fp, &dip->is_plugged, sizeof(dip->is_plugged));
+	ckpt_put(fp, &dip->nplugs, sizeof(dip->nplugs));
+	ckpt_put(fp, &dip->nplugs_t, sizeof(dip->nplugs_t));
+	ckpt_put(fp, &dip->nios_up, sizeof(dip->nios_up));
+	ckpt_put(fp, &dip->nios_upt, sizeof(dip->nios_upt));
+	ckpt_put(fp, &dip->last_plug, sizeof(dip->last_plug));
+	ckpt_put(fp, &dip->plugged_time, sizeof(dip->plugged_time));
+	ckpt_put(fp, &dip->stats, sizeof(dip->stats));
+	ckpt_put(fp, &dip->all_stats, sizeof(dip->all_stats));
+	ckpt_put_avgs(fp, &dip->avgs);
+	ckpt_put_region(fp, &dip->regions);
+
+	seeki_ckpt_save(fp, dip->seek_handle);
+	seeki_ckpt_save(fp, dip->q2q_handle);
+	rstat_ckpt_save(fp, dip);
+	p_live_ckpt_save(fp, dip);
+	if (output_all_data)
+		q2d_ckpt_save(fp, dip->q2d_priv);
+
+	ios_ckpt_save(fp, dip);
+}
+
+static void dip_ckpt_load_one(FILE *fp)
+{
+	double start_time;
+	struct d_info *dip;
+	__u64 first_seq;
+	__u32 device;
+
+	ckpt_get(fp, &device, sizeof(device));
+	ckpt_get(fp, &first_seq, sizeof(first_seq));
+	ckpt_get(fp, &start_time, sizeof(start_time));
+	dip = dip_new(device, start_time);
+	dip->first_seq = first_seq;
+
+	ckpt_get(fp, &dip->end_time, sizeof(dip->end_time));
+	ckpt_get(fp, &dip->last_q, sizeof(dip->last_q));
+	ckpt_get(fp, &dip->n_qs, sizeof(dip->n_qs));
+	ckpt_get(fp, &dip->n_ds, sizeof(dip->n_ds));
+	ckpt_get(fp, &dip->n_culled, sizeof(dip->n_culled));
+	ckpt_get(fp, &dip->n_culled_q, sizeof(dip->n_culled_q));
+	ckpt_get(fp, &dip->n_act_q, sizeof(dip->n_act_q));
+	ckpt_get(fp, &dip->t_act_q, sizeof(dip->t_act_q));
+	ckpt_get(fp, &dip->pre_culling, sizeof(dip->pre_culling));
+	ckpt_get(fp, &dip->is_plugged, sizeof(dip->is_plugged));
+	ckpt_get(fp, &dip->nplugs, sizeof(dip->nplugs));
+	ckpt_get(fp, &dip->nplugs_t, sizeof(dip->nplugs_t));
+	ckpt_get(fp, &dip->nios_up, sizeof(dip->nios_up));
+	ckpt_get(fp, &dip->nios_upt, sizeof(dip->nios_upt));
+	ckpt_get(fp, &dip->last_plug, sizeof(dip->last_plug));
+	ckpt_get(fp, &dip->plugged_time, sizeof(dip->plugged_time));
+	ckpt_get(fp, &dip->stats, sizeof(dip->stats));
+	ckpt_get(fp, &dip->all_stats, sizeof(dip->all_stats));
+	ckpt_get_avgs(fp, &dip->avgs);
+	ckpt_get_region(fp, &dip->regions);
+
+	seeki_ckpt_load(fp, dip->seek_handle);
+	seeki_ckpt_load(fp, dip->q2q_handle);
+	rstat_ckpt_load(fp, dip);
+	p_live_ckpt_load(fp, dip);
+	if (output_all_data)
+		q2d_ckpt_load(fp, dip->q2d_priv);
+
+	ios_ckpt_load(fp, dip);
+}
+
+/*
+ * Devices go in the order they showed up in, which is the order output
+ * goes in. Processes have to be loaded first, for the IOs.
+ */
+void dip_ckpt_save(FILE *fp)
+{
+	struct list_head *p;
+	__u32 n = 0;
+
+	ckpt_put(fp, &next_cull, sizeof(next_cull));
+	__list_for_each(p, &all_devs)
+		n++;
+	ckpt_put(fp, &n, sizeof(n));
+	__list_for_each(p, &all_devs)
+		dip_ckpt_save_one(fp, list_entry(p, struct d_info, all_head));
+}
+
+void dip_ckpt_load(FILE *fp)
+{
+	__u32 n;
+
+	ckpt_get(fp, &next_cull, sizeof(next_cull));
+	ckpt_get(fp, &n, sizeof(n));
+	while (n--)
+		dip_ckpt_load_one(fp);
+}
+
 void dip_plug(__u32 dev, double cur_time)
 {
 	struct d_info *dip = __dip_find(dev);
@@ -21,6 +21,97 @@
 #include <stdio.h>
 #include "globals.h"
 
+/*
+ * Open addressed, linearly probed table of IOs keyed on start sector.
+ * Removal shifts the rest of the probe run back, so no tombstones.
+ */
+#define SEC_HASH_MIN	64
+
+static inline unsigned int sec_hash(__u64 sec, unsigned int size)
+{
+	return (unsigned int)((sec * 0x9e3779b97f4a7c15ULL) >> 32) & (size - 1);
+}
+
+static void sec_hash_grow(struct io_index *ix)
+{
+	unsigned int i, j, old_size = ix->hash_size;
+	struct io **old = ix->hash;
+
+	ix->hash_size = old_size ? old_size * 2 : SEC_HASH_MIN;
+	ix->hash = calloc(ix->hash_size, sizeof(*ix->hash));
+
+	for (i = 0; i < old_size; i++)
+		if (old[i]) {
+			j = sec_hash(BIT_START(old[i]), ix->hash_size);
+			while (ix->hash[j])
+				j = (j + 1) & (ix->hash_size - 1);
+			ix->hash[j] = old[i];
+		}
+
+	free(old);
+}
+
+/*
+ * Returns 0 if an IO with the same start sector is already there
+ */
+int sec_hash_ins(struct io_index *ix, struct io *iop)
+{
+	__u64 s = BIT_START(iop);
+	unsigned int i;
+
+	if (2 * (ix->hash_nr + 1) > ix->hash_size)
+		sec_hash_grow(ix);
+
+	i = sec_hash(s, ix->hash_size);
+	while (ix->hash[i]) {
+		if (BIT_START(ix->hash[i]) == s)
+			return 0;
+		i = (i + 1) & (ix->hash_size - 1);
+	}
+
+	ix->hash[i] = iop;
+	ix->hash_nr++;
+	return 1;
+}
+
+struct io *sec_hash_find(struct io_index *ix, __u64 sec)
+{
+	unsigned int i;
+
+	if (!ix->hash_nr)
+		return NULL;
+
+	i = sec_hash(sec, ix->hash_size);
+	while (ix->hash[i]) {
+		if (BIT_START(ix->hash[i]) == sec)
+			return ix->hash[i];
+		i = (i + 1) & (ix->hash_size - 1);
+	}
+
+	return NULL;
+}
+
+void sec_hash_rem(struct io_index *ix, struct io *iop)
+{
+	unsigned int mask = ix->hash_size - 1;
+	unsigned int i, j, k;
+
+	i = sec_hash(BIT_START(iop), ix->hash_size);
+	while (ix->hash[i] != iop)
+		i = (i + 1) & mask;
+
+	for (j = (i + 1) & mask; ix->hash[j]; j = (j + 1) & mask) {
+		k = sec_hash(BIT_START(ix->hash[j]), ix->hash_size);
+		if (((j - k) & mask) >= ((j - i) & mask)) {
+			ix->hash[i] = ix->hash[j];
+			i = j;
+		}
+	}
+
+	ix->hash[i] = NULL;
+	ix->hash_nr--;
+}
+
 int rb_insert(struct rb_root *root, struct io *iop)
 {
 	struct io *__iop;
@@ -78,9 +169,41 @@ void rb_foreach(struct rb_node *n, struct io *iop,
 			if (head)
 				list_add_tail(&this->f_head, head);
 		}
+		/*
+		 * Prune on start sectors only: a wide IO here says nothing
+		 * about where the ones to its right end
+		 */
 		if (iop_s < this_s)
 			rb_foreach(n->rb_left, iop, fnc, head);
-		if (this_e < iop_e)
+		if (this_s < iop_e)
 			rb_foreach(n->rb_right, iop, fnc, head);
 	}
 }
+
+/*
+ * Usually a D or C covers just the Q that starts where it does. When the
+ * next Q in sector order starts at or past its end, that Q is the whole
+ * answer and the tree walk can be skipped.
+ */
+void index_foreach(struct io_index *ix, struct io *iop,
+		   void (*fnc)(struct io *iop, struct io *this),
+		   struct list_head *head)
+{
+	struct io *this = sec_hash_find(ix, BIT_START(iop));
+
+	if (this) {
+		struct rb_node *n = rb_next(&this->rb_node);
+
+		if (!n || BIT_START(rb_entry(n, struct io, rb_node)) >=
+							BIT_END(iop)) {
+			if (BIT_END(this) <= BIT_END(iop)) {
+				if (fnc) fnc(iop, this);
+				if (head)
+					list_add_tail(&this->f_head, head);
+			}
+			return;
+		}
+	}
+
+	rb_foreach(ix->root.rb_node, iop, fnc, head);
+}
@@ -36,6 +36,13 @@
  */
 #define N_HIST_BKTS	1025
 
+#define IO_SLAB_NR	512		/* struct io's per slab */
+#define PDU_SMALL	64		/* pdus up to this come from slabs */
+#define PDU_SLAB_NR	1024		/* small pdus per slab */
+
+#define LH_SUB_BITS	6		/* 64 histogram buckets per octave */
+#define N_PCTS_MAX	16		/* percentiles given to -H */
+
 #define BIT_TIME(t)	((double)SECONDS(t) + ((double)NANO_SECONDS(t) / 1.0e9))
 
 #define BIT_START(iop)	((iop)->t.sector)
@@ -60,9 +67,33 @@ enum iop_type {
 };
 #define N_IOP_TYPES	(IOP_S + 1)
 
+/*
+ * Metric families written by -b, one file each (see bcol.c)
+ */
+enum bcol_fam {
+	BC_Q2D = 0,
+	BC_D2C = 1,
+	BC_Q2C = 2,
+	BC_AQD = 3,
+	BC_BNOS = 4,
+	BC_SPS = 5,
+	BC_D2D_SEEK = 6,
+	BC_Q2Q_SEEK = 7,
+	BC_Q2D_PLAT = 8,
+	BC_Q2C_PLAT = 9,
+	BC_D2C_PLAT = 10,
+	BC_PIT = 11,
+	BC_IOSTAT = 12,
+	BC_PER_IO = 13
+};
+#define BC_NR	(BC_PER_IO + 1)
+
+struct bcol_buf;
+
 struct mode {
 	int most_seeks, nmds;
 	long long *modes;
+	int err;		/* most_seeks may be low by up to this */
 };
 
 struct io;
@@ -76,6 +107,8 @@ struct avg_info {
 	__u64 min, max, total;
 	double avg;
 	int n;
+	__u32 *hist;		/* log-linear histogram (-H), see lhist.c */
+	int hist_nr;
 };
 
 struct avgs_info {
@@ -98,18 +131,25 @@ struct avgs_info {
 };
 
 struct range_info {
-	struct list_head head;		/* on: qranges OR cranges */
 	__u64 start, end;
 };
 
+/*
+ * Activity ranges in time order, in an array grown by doubling
+ */
+struct range_list {
+	struct range_info *ranges;
+	unsigned int nr, size;
+};
+
 struct region_info {
-	struct list_head qranges;
-	struct list_head cranges;
+	struct range_list qranges;
+	struct range_list cranges;
 };
 
 struct p_info {
 	struct region_info regions;
-	struct avgs_info avgs;
+	struct avgs_info avgs, *shard_avgs;
 	__u64 last_q;
 	__u32 pid;
 	char *name;
@@ -117,6 +157,7 @@ struct p_info {
 
 struct stats {
 	__u64 rqm[2], ios[2], sec[2], wait, svctm;
+	__u64 n_lat, q2c, q2c_max, d2c, d2c_max;	/* streaming only */
 	double last_qu_change, last_dev_change, tot_qusz, idle_time;
 	int cur_qusz, cur_dev;
 };
@@ -127,6 +168,25 @@ struct stats_t {
 	double avgrq_sz, avgqu_sz, await, svctm, p_util;
 };
 
+/*
+ * Outstanding IOs of one type on a device. All are hashed by their exact
+ * start sector; Qs are also kept in sector order for range lookups.
+ */
+struct io_index {
+	struct rb_root root;
+	struct io **hash;
+	unsigned int hash_size, hash_nr;
+};
+#define IOP_ORDERED(type)	((type) == IOP_Q)
+
+/*
+ * An IO as it came in to a device, for culling (see devs.c)
+ */
+struct age_ent {
+	struct io *iop;
+	__u64 time;
+};
+
 struct d_info {
 	struct list_head all_head, hash_head;
 	void *heads;
@@ -135,10 +195,16 @@ struct d_info {
 	void *q2q_handle, *seek_handle, *bno_dump_handle, *up_hist_handle;
 	void *q2d_priv, *aqd_handle, *rstat_handle, *p_live_handle;
 	void *q2d_plat_handle, *q2c_plat_handle, *d2c_plat_handle;
+	void *stacks_handle, *iostat_handle;
 	FILE *q2d_ofp, *d2c_ofp, *q2c_ofp, *pit_fp;
+	struct bcol_buf *q2d_bp, *d2c_bp, *q2c_bp, *pit_bp, *iostat_bp;
+	struct bcol_buf *per_io_bp;
+	struct age_ent *ages;		/* ring, oldest first (-C only) */
+	unsigned int ages_head, ages_nr, ages_size;
 	struct avgs_info avgs;
 	struct stats stats, all_stats;
 	__u64 last_q, n_qs, n_ds;
+	__u64 n_culled, n_culled_q;
 	__u64 n_act_q, t_act_q;	/* # currently active when Q comes in */
 	__u32 device;
 
@@ -146,22 +212,55 @@ struct d_info {
 	int is_plugged, nplugs, nplugs_t;
 	__u64 nios_up, nios_upt;
 	double start_time, last_plug, plugged_time, end_time;
+	__u64 first_seq;
+};
+
+/*
+ * The parts of a struct blk_io_trace btt looks at
+ */
+struct io_trace {
+	__u64 time, sector;
+	__u32 bytes, action, pid, device;
+};
+
+/*
+ * Times noted on an outstanding Q, kept as signed 32-bit nanosecond
+ * deltas from its queue time (see iop_time/iop_set_time). The rare delta
+ * that does not fit goes in the cold record, along with the issue
+ * position that only per-IO (-p) output needs.
+ */
+enum iop_time {
+	IOT_G = 0,
+	IOT_I = 1,
+	IOT_M = 2,
+	IOT_D = 3,
+	IOT_S = 4
+};
+#define N_IOT_TIMES	(IOT_S + 1)
+
+#define IO_DT_NONE	((__s32)0x80000000)
+#define IO_DT_WIDE	((__s32)0x80000001)
+
+struct io_cold {
+	__u64 times[N_IOT_TIMES];
+	__u64 d_sec;
+	__u32 d_nsec;
 };
 
 struct io {
 	struct rb_node rb_node;
-	struct list_head f_head, a_head;
+	struct list_head f_head;
 	struct d_info *dip;
 	struct p_info *pip;
 	void *pdu;
-	__u64 bytes_left, g_time, i_time, m_time, d_time, c_time, d_sec, c_sec;
-	__u64 s_time;
-	__u32 d_nsec, c_nsec;
+	struct io_cold *cold;
 
-	struct blk_io_trace t;
+	struct io_trace t;
 
-	int linked;
-	enum iop_type type;
+	__u16 pdu_len;
+	__u8 linked;
+	__u8 type;
+	__s32 dt[N_IOT_TIMES];
 };
 
 struct p_live_info {
@@ -175,22 +274,25 @@ extern char bt_timeline_version[], *devices, *exes, *input_name, *output_name;
 extern char *seek_name, *iostat_name, *d2c_name, *q2c_name, *per_io_name;
 extern char *bno_dump_name, *unplug_hist_name, *sps_name, *aqd_name, *q2d_name;
 extern char *per_io_trees;
-extern double range_delta, plat_freq, last_t_seen;
+extern double range_delta, plat_freq, last_t_seen, cull_horizon;
 extern FILE *rngs_ofp, *avgs_ofp, *xavgs_ofp, *iostat_ofp, *per_io_ofp;
 extern FILE *msgs_ofp;
 extern int verbose, done, time_bounded, output_all_data, seek_absolute;
-extern int easy_parse_avgs, ignore_remaps, do_p_live;
+extern int easy_parse_avgs, ignore_remaps, do_p_live, exact_seeks;
 extern unsigned int n_devs;
-extern unsigned long n_traces;
+extern unsigned long n_traces, n_culled;
 extern struct list_head all_devs, all_procs;
-extern struct avgs_info all_avgs;
+extern __thread struct avgs_info all_avgs;
 extern __u64 last_q;
 extern struct region_info all_regions;
-extern struct list_head all_ios, free_ios;
+extern __thread struct list_head free_ios;
+extern __thread void *free_pdus;
 extern __u64 iostat_interval, iostat_last_stamp;
 extern time_t genesis, last_vtrace;
 extern double t_astart, t_aend;
-extern __u64 q_histo[N_HIST_BKTS], d_histo[N_HIST_BKTS];
+extern __thread __u64 q_histo[N_HIST_BKTS], d_histo[N_HIST_BKTS];
+extern double *pcts;
+extern int n_pcts;
 
 /* args.c */
 void handle_args(int argc, char *argv[]);
@@ -203,6 +305,25 @@ void aqd_clean(void);
 void aqd_issue(void *info, double ts);
 void aqd_complete(void *info, double ts);
 
+/* ckpt.c */
+extern char *ckpt_name, *resume_name;
+extern int ckpt_interval;
+void ckpt_put(FILE *fp, void *p, size_t len);
+void ckpt_get(FILE *fp, void *p, size_t len);
+void ckpt_put_str(FILE *fp, char *str);
+char *ckpt_get_str(FILE *fp);
+void ckpt_put_avg(FILE *fp, struct avg_info *ap);
+void ckpt_get_avg(FILE *fp, struct avg_info *ap);
+void ckpt_put_avgs(FILE *fp, struct avgs_info *ap);
+void ckpt_get_avgs(FILE *fp, struct avgs_info *ap);
+void ckpt_put_region(FILE *fp, struct region_info *reg);
+void ckpt_get_region(FILE *fp, struct region_info *reg);
+FILE *ckpt_fopen(char *name);
+void ckpt_save(void);
+void ckpt_check(void);
+void ckpt_resume_start(void);
+void ckpt_resume(void);
+
 /* devmap.c */
 int dev_map_read(char *fname);
 char *dev_map_find(__u32 device);
@@ -223,13 +344,22 @@ void dip_unplug(__u32 dev, double cur_time, __u64 nio_ups);
 void dip_unplug_tm(__u32 dev, double cur_time, __u64 nio_ups);
 void dip_exit(void);
 void dip_cleanup(void);
+void dip_cull_check(__u64 now);
+void dip_ckpt_save(FILE *fp);
+void dip_ckpt_load(FILE *fp);
 
 /* dip_rb.c */
+int sec_hash_ins(struct io_index *ix, struct io *iop);
+void sec_hash_rem(struct io_index *ix, struct io *iop);
+struct io *sec_hash_find(struct io_index *ix, __u64 sec);
 int rb_insert(struct rb_root *root, struct io *iop);
 struct io *rb_find_sec(struct rb_root *root, __u64 sec);
 void rb_foreach(struct rb_node *n, struct io *iop,
 		      void (*fnc)(struct io *iop, struct io *this),
 		      struct list_head *head);
+void index_foreach(struct io_index *ix, struct io *iop,
+		   void (*fnc)(struct io *iop, struct io *this),
+		   struct list_head *head);
 
 /* iostat.c */
 void iostat_init(void);
@@ -237,11 +367,19 @@ void iostat_getrq(struct io *iop);
 void iostat_merge(struct io *iop);
 void iostat_issue(struct io *iop);
 void iostat_complete(struct io *d_iop, struct io *c_iop);
+void iostat_complete_rq(struct io *c_iop, __u64 g_time, __u64 d_time);
+void iostat_cull(struct io *q_iop, __u64 stamp);
 void iostat_check_time(__u64 stamp);
 void iostat_dump_stats(__u64 stamp, int all);
+void iostat_flush(void);
+void iostat_dev_init(struct d_info *dip);
+void iostat_free(void *handle);
+void iostat_ckpt_save(FILE *fp);
+void iostat_ckpt_load(FILE *fp);
 
 /* latency.c */
 void latency_alloc(struct d_info *dip);
+void latency_free(struct d_info *dip);
 void latency_clean(void);
 void latency_q2d(struct d_info *dip, __u64 tstamp, __u64 latency);
 void latency_d2c(struct d_info *dip, __u64 tstamp, __u64 latency);
@@ -256,23 +394,48 @@ FILE *my_fopen(const char *path, const char *mode);
 int my_open(const char *path, int flags);
 void dbg_ping(void);
 void clean_allocs(void);
+void io_slab_grow(void);
+void pdu_slab_grow(void);
+
+/* lhist.c */
+void lh_grow(struct avg_info *ap, int idx);
+void lh_merge(struct avg_info *ap, struct avg_info *from);
+__u64 lh_pct(struct avg_info *ap, double pct);
+void lh_free(struct avgs_info *ap);
 
 /* mmap.c */
+extern int streaming, reorder_nr;
+extern unsigned long strm_late;
 void setup_ifile(char *fname);
 void cleanup_ifile(void);
-int next_trace(struct blk_io_trace *t, void **pdu);
+int next_trace(struct io *iop);
 double pct_done(void);
+void ifile_ckpt_save(FILE *fp);
+void ifile_ckpt_load(FILE *fp);
 
 /* output.c */
 int output_avgs(FILE *ofp);
 int output_ranges(FILE *ofp);
+void output_hdr(FILE *ofp, char *hdr);
+void __output_avg(FILE *ofp, char *hdr, struct avg_info *ap, FILE *xofp);
 
 /* proc.c */
 void process_alloc(__u32 pid, char *name);
 struct p_info *find_process(__u32 pid, char *name);
-void pip_update_q(struct io *iop);
+struct p_info *pip_lookup(__u32 pid);
+void pip_update_q(struct p_info *pip, __u64 time, int dm);
+void pip_merge_shards(void);
 void pip_foreach_out(void (*f)(struct p_info *, void *), void *arg);
 void pip_exit(void);
+void pip_ckpt_save(FILE *fp);
+void pip_ckpt_load(FILE *fp);
+
+/* bcol.c */
+extern int binary_data;
+void bcol_init(void);
+struct bcol_buf *bcol_alloc(int fam, struct d_info *dip);
+void bcol_free(struct bcol_buf *bp);
+void bcol_add(struct bcol_buf *bp, ...);
 
 /* bno_dump.c */
 void *bno_dump_alloc(struct d_info *dip);
@@ -290,8 +453,14 @@ void plat_x2c(void *info, __u64 ts, __u64 latency);
 void *p_live_alloc(void);
 void p_live_free(void *p);
 void p_live_add(struct d_info *dip, __u64 dt, __u64 ct);
+void p_live_add_sys(__u64 dt, __u64 ct);
+void p_live_issue(struct d_info *dip, __u64 dt);
+void p_live_drop(struct d_info *dip, __u64 dt);
+void p_live_trim_sys(void);
 void p_live_exit(void);
 struct p_live_info *p_live_get(struct d_info *dip, int base_y);
+void p_live_ckpt_save(FILE *fp, struct d_info *dip);
+void p_live_ckpt_load(FILE *fp, struct d_info *dip);
 
 /* q2d.c */
 void q2d_histo_add(void *priv, __u64 q2d);
@@ -302,13 +471,30 @@ void q2d_display_dashes(FILE *fp);
 void q2d_display(FILE *fp, void *priv);
 int q2d_ok(void *priv);
 void q2d_acc(void *a1, void *a2);
+void q2d_ckpt_save(FILE *fp, void *priv);
+void q2d_ckpt_load(FILE *fp, void *priv);
 
 /* rstats.c */
 void *rstat_alloc(struct d_info *dip);
 void rstat_free(void *ptr);
 void rstat_add(void *ptr, double cur, unsigned long long nblks);
+void rstat_add_sys(double cur, unsigned long long nblks);
 int rstat_init(void);
 void rstat_exit(void);
+void rstat_ckpt_save(FILE *fp, struct d_info *dip);
+void rstat_ckpt_load(FILE *fp, struct d_info *dip);
+
+/* shard.c */
+extern int n_shards;
+extern __thread int shard_id;
+extern __thread __u64 cur_seq;
+void shard_start(void);
+void shard_dispatch(struct io *iop);
+void shard_sync(void);
+void shard_finish(void);
+void sys_update_q(struct p_info *pip, __u64 time, int dm);
+void sys_update_c(struct p_info *pip, __u64 time, __u64 nblks);
+void sys_update_live(__u64 dt, __u64 ct);
 
 /* seek.c */
 void *seeki_alloc(struct d_info *dip, char *post);
@@ -319,9 +505,22 @@ double seeki_mean(void *handle);
 long long seeki_nseeks(void *handle);
 long long seeki_median(void *handle);
 int seeki_mode(void *handle, struct mode *mp);
+int seeki_approx(void *handle);
+void seeki_ckpt_save(FILE *fp, void *handle);
+void seeki_ckpt_load(FILE *fp, void *handle);
+
+/* stacks.c */
+extern int do_stacks;
+void *stacks_alloc(void);
+void stacks_free(void *info);
+void stacks_queue(struct io *q_iop);
+void stacks_complete(struct io *q_iop, struct io *c_iop);
+void output_stacks(FILE *ofp, struct d_info *dip);
 
 /* trace.c */
+extern __u64 trace_seq;
 void add_trace(struct io *iop);
+void trace_io(struct io *iop);
 
 /* trace_complete.c */
 void trace_complete(struct io *c_iop);
@@ -27,33 +27,22 @@ static inline int remapper_dev(__u32 dev)
 
 static inline void region_init(struct region_info *reg)
 {
-	INIT_LIST_HEAD(&reg->qranges);
-	INIT_LIST_HEAD(&reg->cranges);
-}
-
-static inline void __region_exit(struct list_head *range_head)
-{
-	struct list_head *p, *q;
-	struct range_info *rip;
-
-	list_for_each_safe(p, q, range_head) {
-		rip = list_entry(p, struct range_info, head);
-		free(rip);
-	}
+	memset(reg, 0, sizeof(*reg));
 }
 
 static inline void region_exit(struct region_info *reg)
 {
-	__region_exit(&reg->qranges);
-	__region_exit(&reg->cranges);
+	free(reg->qranges.ranges);
+	free(reg->cranges.ranges);
+	region_init(reg);
 }
 
-static inline void update_range(struct list_head *head_p, __u64 time)
+static inline void update_range(struct range_list *rlp, __u64 time)
 {
 	struct range_info *rip;
 
-	if (!list_empty(head_p)) {
-		rip = list_entry(head_p->prev, struct range_info, head);
+	if (rlp->nr) {
+		rip = &rlp->ranges[rlp->nr - 1];
 
 		if (time < rip->end)
 			return;
@@ -64,9 +53,14 @@ static inline void update_range(struct list_head *head_p, __u64 time)
 		}
 	}
 
-	rip = malloc(sizeof(*rip));
+	if (rlp->nr == rlp->size) {
+		rlp->size = rlp->size ? 2 * rlp->size : 4;
+		rlp->ranges = realloc(rlp->ranges,
+				      rlp->size * sizeof(*rlp->ranges));
+	}
+
+	rip = &rlp->ranges[rlp->nr++];
 	rip->start = rip->end = time;
-	list_add_tail(&rip->head, head_p);
 }
 
 static inline void update_qregion(struct region_info *reg, __u64 time)
@@ -79,8 +73,35 @@ static inline void update_cregion(struct region_info *reg, __u64 time)
 	update_range(&reg->cranges, time);
 }
 
+/*
+ * Values below 2^(LH_SUB_BITS+1) get a bucket each, above that every
+ * power of 2 is split in 2^LH_SUB_BITS linear buckets.
+ */
+static inline int lh_idx(__u64 v)
+{
+	int shift;
+
+	if (v < (2ULL << LH_SUB_BITS))
+		return (int)v;
+
+	shift = (63 - __builtin_clzll(v)) - LH_SUB_BITS;
+	return ((shift + 1) << LH_SUB_BITS) +
+				(int)((v >> shift) - (1ULL << LH_SUB_BITS));
+}
+
+static inline void lh_add(struct avg_info *ap, __u64 t, int n)
+{
+	int idx = lh_idx(t);
+
+	if (idx >= ap->hist_nr)
+		lh_grow(ap, idx);
+	ap->hist[idx] += n;
+}
+
 static inline void avg_update(struct avg_info *ap, __u64 t)
 {
+	if (n_pcts)
+		lh_add(ap, t, 1);
         if (ap->n++ == 0)
                 ap->min = ap->total = ap->max = t;
         else {
@@ -94,6 +115,8 @@ static inline void avg_update(struct avg_info *ap, __u64 t)
 
 static inline void avg_update_n(struct avg_info *ap, __u64 t, int n)
 {
+	if (n_pcts)
+		lh_add(ap, t, n);
         if (ap->n == 0) {
                 ap->min = ap->max = t;
 		ap->total = (n * t);
@@ -108,8 +131,43 @@ static inline void avg_update_n(struct avg_info *ap, __u64 t, int n)
 	ap->n += n;
 }
 
+static inline void avg_merge(struct avg_info *ap, struct avg_info *from)
+{
+	if (from->n == 0)
+		return;
+
+	if (ap->n == 0) {
+		ap->min = from->min;
+		ap->max = from->max;
+	} else {
+		if (from->min < ap->min)
+			ap->min = from->min;
+		if (from->max > ap->max)
+			ap->max = from->max;
+	}
+	ap->total += from->total;
+	ap->n += from->n;
+	if (from->hist)
+		lh_merge(ap, from);
+}
+
+/*
+ * struct avgs_info is made up of nothing but avg_info's
+ */
+static inline void avgs_merge(struct avgs_info *ap, struct avgs_info *from)
+{
+	struct avg_info *d = (struct avg_info *)ap;
+	struct avg_info *s = (struct avg_info *)from;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(*ap) / sizeof(*d); i++)
+		avg_merge(&d[i], &s[i]);
+}
+
 static inline void avg_unupdate(struct avg_info *ap, __u64 t)
 {
+	if (n_pcts)
+		lh_add(ap, t, -1);
 	ap->n--;
 	ap->total -= t;
 }
@@ -132,28 +190,87 @@ static inline void dip_update_q(struct d_info *dip, struct io *iop)
 
 static inline struct io *io_alloc(void)
 {
-	struct io *iop = malloc(sizeof(*iop));
+	struct io *iop;
+
+	if (list_empty(&free_ios))
+		io_slab_grow();
 
+	iop = list_entry(free_ios.next, struct io, f_head);
+	list_del(&iop->f_head);
 	memset(iop, 0, sizeof(struct io));
-	list_add_tail(&iop->a_head, &all_ios);
 
 	return iop;
 }
 
 static inline void io_free(struct io *iop)
 {
-	list_del(&iop->a_head);
-	free(iop);
+	list_add(&iop->f_head, &free_ios);
 }
 
-static inline void io_free_all(void)
+static inline void *pdu_alloc(int len)
 {
-	struct io *iop;
-	struct list_head *p, *q;
+	void *pdu;
+
+	if (len > PDU_SMALL)
+		return malloc(len);
 
-	list_for_each_safe(p, q, &all_ios) {
-		iop = list_entry(p, struct io, a_head);
-		free(iop);
+	if (!free_pdus)
+		pdu_slab_grow();
+
+	pdu = free_pdus;
+	free_pdus = *(void **)pdu;
+	return pdu;
+}
+
+static inline void pdu_free(void *pdu, int len)
+{
+	if (len > PDU_SMALL)
+		free(pdu);
+	else {
+		*(void **)pdu = free_pdus;
+		free_pdus = pdu;
+	}
+}
+
+static inline struct io_cold *io_cold(struct io *iop)
+{
+	if (!iop->cold)
+		iop->cold = malloc(sizeof(*iop->cold));
+	return iop->cold;
+}
+
+static inline void iop_clear_times(struct io *iop)
+{
+	int i;
+
+	for (i = 0; i < N_IOT_TIMES; i++)
+		iop->dt[i] = IO_DT_NONE;
+}
+
+/*
+ * Returns (__u64)-1 if the time was never set
+ */
+static inline __u64 iop_time(struct io *iop, enum iop_time which)
+{
+	__s32 dt = iop->dt[which];
+
+	if (dt == IO_DT_NONE)
+		return (__u64)-1;
+	if (dt == IO_DT_WIDE)
+		return iop->cold->times[which];
+	return iop->t.time + dt;
+}
+
+static inline void iop_set_time(struct io *iop, enum iop_time which,
+				__u64 time)
+{
+	__s64 dt = (__s64)(time - iop->t.time);
+
+	if (dt > IO_DT_WIDE && dt <= 0x7fffffffLL)
+		iop->dt[which] = dt;
+	else {
+		io_cold(iop)->times[which] = time;
+		iop->dt[which] = IO_DT_WIDE;
 	}
 }
 
@@ -161,10 +278,8 @@ static inline int io_setup(struct io *iop, enum iop_type type)
 {
 	iop->type = type;
 	iop->dip = dip_alloc(iop->t.device, iop);
-	if (iop->linked) {
-		iop->pip = find_process(iop->t.pid, NULL);
-		iop->bytes_left = iop->t.bytes;
-	}
+	if (iop->linked)
+		iop->pip = pip_lookup(iop->t.pid);
 
 	return iop->linked;
 }
@@ -174,27 +289,37 @@ static inline void io_release(struct io *iop)
 	if (iop->linked)
 		iop_rem_dip(iop);
 	if (iop->pdu)
-		free(iop->pdu);
+		pdu_free(iop->pdu, iop->pdu_len);
+	if (iop->cold)
+		free(iop->cold);
 
 	io_free(iop);
 }
 
+/*
+ * Shards keep their own per-process sums, merged once all is done
+ */
+static inline struct avgs_info *pip_avgs(struct p_info *pip)
+{
+	return shard_id ? &pip->shard_avgs[shard_id - 1] : &pip->avgs;
+}
+
 #define UPDATE_AVGS(_avg, _iop, _pip, _time) do {			\
 		avg_update(&all_avgs. _avg , _time);			\
 		avg_update(&_iop->dip->avgs. _avg , _time);		\
-		if (_pip) avg_update(&_pip->avgs. _avg , _time);	\
+		if (_pip) avg_update(&pip_avgs(_pip)-> _avg , _time);	\
 	} while (0)
 
 #define UPDATE_AVGS_N(_avg, _iop, _pip, _time, _n) do {			\
 		avg_update_n(&all_avgs. _avg , _time, _n);		\
 		avg_update_n(&_iop->dip->avgs. _avg , _time, _n);	\
-		if (_pip) avg_update_n(&_pip->avgs. _avg , _time,_n);	\
+		if (_pip) avg_update_n(&pip_avgs(_pip)-> _avg , _time,_n);\
 	} while (0)
 
 #define UNUPDATE_AVGS(_avg, _iop, _pip, _time) do {			\
 		avg_unupdate(&all_avgs. _avg , _time);			\
 		avg_unupdate(&_iop->dip->avgs. _avg , _time);		\
-		if (_pip) avg_unupdate(&_pip->avgs. _avg , _time);	\
+		if (_pip) avg_unupdate(&pip_avgs(_pip)-> _avg , _time);	\
 	} while (0)
 
 static inline void update_q2c(struct io *iop, __u64 c_time)
@@ -279,23 +404,34 @@ static inline void update_blks(struct io *iop)
 	avg_update(&all_avgs.blks, nblks);
 	avg_update(&iop->dip->avgs.blks, nblks);
 	if (iop->pip)
-		avg_update(&iop->pip->avgs.blks, nblks);
+		avg_update(&pip_avgs(iop->pip)->blks, nblks);
 }
 
-static inline struct rb_root *__get_root(struct d_info *dip, enum iop_type type)
+static inline struct io_index *__get_index(struct d_info *dip,
+					   enum iop_type type)
 {
-	struct rb_root *roots = dip->heads;
-	return &roots[type];
+	struct io_index *ixs = dip->heads;
+	return &ixs[type];
 }
 
 static inline int dip_rb_ins(struct d_info *dip, struct io *iop)
 {
-	return rb_insert(__get_root(dip, iop->type), iop);
+	struct io_index *ix = __get_index(dip, iop->type);
+
+	if (!sec_hash_ins(ix, iop))
+		return 0;
+	if (IOP_ORDERED(iop->type))
+		rb_insert(&ix->root, iop);
+	return 1;
 }
 
 static inline void dip_rb_rem(struct io *iop)
 {
-	rb_erase(&iop->rb_node, __get_root(iop->dip, iop->type));
+	struct io_index *ix = __get_index(iop->dip, iop->type);
+
+	sec_hash_rem(ix, iop);
+	if (IOP_ORDERED(iop->type))
+		rb_erase(&iop->rb_node, &ix->root);
 }
 
 static inline void dip_rb_fe(struct d_info *dip, enum iop_type type,
@@ -303,13 +439,22 @@ static inline void dip_rb_fe(struct d_info *dip, enum iop_type type,
 			     void (*fnc)(struct io *iop, struct io *this),
 			     struct list_head *head)
 {
-	rb_foreach(__get_root(dip, type)->rb_node, iop, fnc, head);
+	index_foreach(__get_index(dip, type), iop, fnc, head);
 }
 
+/*
+ * An exact start sector match is by far the common case; only fall back
+ * to a containing range when there is none.
+ */
 static inline struct io *dip_rb_find_sec(struct d_info *dip,
 		                         enum iop_type type, __u64 sec)
 {
-	return rb_find_sec(__get_root(dip, type), sec);
+	struct io_index *ix = __get_index(dip, type);
+	struct io *iop = sec_hash_find(ix, sec);
+
+	if (!iop && IOP_ORDERED(type))
+		iop = rb_find_sec(&ix->root, sec);
+	return iop;
 }
 
 static inline __u64 tdelta(__u64 from, __u64 to)
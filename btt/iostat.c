@@ -48,11 +48,33 @@
 		(dip)->all_stats. fld -= __v;				\
 	} while (0)
 
+/*
+ * Each interval's counts are kept per device in a ring and formatted a
+ * ring's worth at a time, so short intervals (-S 0.001) across many
+ * devices cost a copy per device at each interval's end rather than a
+ * trip through stdio. With -b they go to <name>_iostat.bin instead.
+ */
+#define IOSTAT_RING	256
+
+struct iostat_ring {
+	int first;			/* first interval held for this device */
+	struct stats recs[IOSTAT_RING];
+};
+
+struct dump_arg {
+	int idx;
+	__u64 stamp;
+	struct stats_t *asp;
+};
+
 __u64 last_start, iostat_last_stamp;
 __u64 iostat_interval = 1000000000;
 char *iostat_name = NULL;
 FILE *iostat_ofp = NULL;
 
+static __u64 ring_stamps[IOSTAT_RING];
+static int ring_nr, iostat_on, stamp_prec = 2;
+
 static void dump_hdr(void)
 {
 	fprintf(iostat_ofp, "Device:       rrqm/s   wrqm/s     r/s     w/s    "
@@ -70,9 +92,13 @@ static void update_tot_qusz(struct d_info *dip, double now)
 	dip->stats.last_qu_change = dip->all_stats.last_qu_change = now;
 }
 
-static void update_idle_time(struct d_info *dip, double now, int force)
+/*
+ * Only time with nothing out at the device is idle: an interval ending
+ * while IOs are in flight is busy up to its end
+ */
+static void update_idle_time(struct d_info *dip, double now)
 {
-	if (dip->stats.cur_dev == 0 || force) {
+	if (dip->stats.cur_dev == 0) {
 		dip->stats.idle_time += (now - dip->stats.last_dev_change);
 		dip->all_stats.idle_time +=
 				       (now - dip->all_stats.last_dev_change);
@@ -80,25 +106,19 @@ static void update_idle_time(struct d_info *dip, double now, int force)
 	dip->stats.last_dev_change = dip->all_stats.last_dev_change = now;
 }
 
-void __dump_stats(__u64 stamp, int all, struct d_info *dip, struct stats_t *asp)
+static void __dump_stats(__u64 stamp, int all, struct d_info *dip,
+			 struct stats *sp, struct stats_t *asp)
 {
 	char hdr[16];
-	struct stats *sp;
 	double dt, nios, avgrq_sz, p_util, nrqm, await, svctm;
-	double now = TO_SEC(stamp);
 
-	if (all) {
+	if (all)
 		dt = (double)stamp / 1.0e9;
-		sp = &dip->all_stats;
-	} else {
-		dt = (double)(stamp-last_start) / 1.0e9;
-		sp = &dip->stats;
-	}
+	else
+		dt = (double)iostat_interval / 1.0e9;
 
 	nios = (double)(sp->ios[0] + sp->ios[1]);
 	nrqm = (double)(sp->rqm[0] + sp->rqm[1]);
-	update_idle_time(dip, now, 1);
-	update_tot_qusz(dip, now);
 
 	if (nios > 0.0) {
 		avgrq_sz = (double)(sp->sec[0] + sp->sec[1]) / nios;
@@ -115,31 +135,18 @@ void __dump_stats(__u64 stamp, int all, struct d_info *dip, struct stats_t *asp)
 	 * and we add in nrqm (number of merges), which should give
 	 * us the total number of IOs sent to the block IO layer.
 	 */
-	fprintf(iostat_ofp, "%-11s ", make_dev_hdr(hdr, 11, dip, 1));
-	fprintf(iostat_ofp, "%8.2lf ", (double)sp->rqm[1] / dt);
-	fprintf(iostat_ofp, "%8.2lf ", (double)sp->rqm[0] / dt);
-	fprintf(iostat_ofp, "%7.2lf ", (double)sp->ios[1] / dt);
-	fprintf(iostat_ofp, "%7.2lf ", (double)sp->ios[0] / dt);
-	fprintf(iostat_ofp, "%9.2lf ", (double)sp->sec[1] / dt);
-	fprintf(iostat_ofp, "%9.2lf ", (double)sp->sec[0] / dt);
-	fprintf(iostat_ofp, "%9.2lf ", (double)(sp->sec[1] / 2) / dt);
-	fprintf(iostat_ofp, "%9.2lf ", (double)(sp->sec[0] / 2) / dt);
-	fprintf(iostat_ofp, "%8.2lf ", avgrq_sz);
-	fprintf(iostat_ofp, "%8.2lf ", (double)sp->tot_qusz / dt);
-	fprintf(iostat_ofp, "%7.2lf ", await);
-	fprintf(iostat_ofp, "%7.2lf ", svctm);
-	fprintf(iostat_ofp, "%6.2lf", p_util);
+	fprintf(iostat_ofp, "%-11s %8.2lf %8.2lf %7.2lf %7.2lf %9.2lf %9.2lf "
+			    "%9.2lf %9.2lf %8.2lf %8.2lf %7.2lf %7.2lf %6.2lf",
+		make_dev_hdr(hdr, 11, dip, 1),
+		(double)sp->rqm[1] / dt, (double)sp->rqm[0] / dt,
+		(double)sp->ios[1] / dt, (double)sp->ios[0] / dt,
+		(double)sp->sec[1] / dt, (double)sp->sec[0] / dt,
+		(double)(sp->sec[1] / 2) / dt, (double)(sp->sec[0] / 2) / dt,
+		avgrq_sz, (double)sp->tot_qusz / dt, await, svctm, p_util);
 	if (all)
 		fprintf(iostat_ofp, "%8s\n", "TOTAL");
-	else {
-		fprintf(iostat_ofp, "%8.2lf\n", TO_SEC(stamp));
-		sp->rqm[0] = sp->rqm[1] = 0;
-		sp->ios[0] = sp->ios[1] = 0;
-		sp->sec[0] = sp->sec[1] = 0;
-		sp->wait = sp->svctm = 0;
-
-		sp->tot_qusz = sp->idle_time = 0.0;
-	}
+	else
+		fprintf(iostat_ofp, "%8.*lf\n", stamp_prec, TO_SEC(stamp));
 
 	if (asp) {
 		int i;
@@ -162,77 +169,249 @@ static void __dump_stats_t(__u64 stamp, struct stats_t *asp, int all)
 {
 	if (asp->n < 2.0) return;	// What's the point?
 
-	fprintf(iostat_ofp, "%-11s ", "TOTAL");
-	fprintf(iostat_ofp, "%8.2lf ", asp->rqm_s[0]);
-	fprintf(iostat_ofp, "%8.2lf ", asp->rqm_s[1]);
-	fprintf(iostat_ofp, "%7.2lf ", asp->ios_s[0]);
-	fprintf(iostat_ofp, "%7.2lf ", asp->ios_s[1]);
-	fprintf(iostat_ofp, "%9.2lf ", asp->sec_s[0]);
-	fprintf(iostat_ofp, "%9.2lf ", asp->sec_s[1]);
-	fprintf(iostat_ofp, "%9.2lf ", asp->sec_s[0] / 2.0);
-	fprintf(iostat_ofp, "%9.2lf ", asp->sec_s[1] / 2.0);
-	fprintf(iostat_ofp, "%8.2lf ", asp->avgrq_sz / asp->n);
-	fprintf(iostat_ofp, "%8.2lf ", asp->avgqu_sz / asp->n);
-	fprintf(iostat_ofp, "%7.2lf ", asp->await / asp->n);
-	fprintf(iostat_ofp, "%7.2lf ", asp->svctm / asp->n);
-	fprintf(iostat_ofp, "%6.2lf", asp->p_util / asp->n);
+	fprintf(iostat_ofp, "%-11s %8.2lf %8.2lf %7.2lf %7.2lf %9.2lf %9.2lf "
+			    "%9.2lf %9.2lf %8.2lf %8.2lf %7.2lf %7.2lf %6.2lf",
+		"TOTAL", asp->rqm_s[0], asp->rqm_s[1],
+		asp->ios_s[0], asp->ios_s[1], asp->sec_s[0], asp->sec_s[1],
+		asp->sec_s[0] / 2.0, asp->sec_s[1] / 2.0,
+		asp->avgrq_sz / asp->n, asp->avgqu_sz / asp->n,
+		asp->await / asp->n, asp->svctm / asp->n, asp->p_util / asp->n);
 	if (all)
 		fprintf(iostat_ofp, "%8s\n", "TOTAL");
-	else 
-		fprintf(iostat_ofp, "%8.2lf\n", TO_SEC(stamp));
+	else
+		fprintf(iostat_ofp, "%8.*lf\n", stamp_prec, TO_SEC(stamp));
 }
 
 void iostat_init(void)
 {
 	last_start = (__u64)-1;
-	if (iostat_ofp)
+	iostat_on = iostat_ofp || (binary_data && iostat_name);
+
+	/* Enough places in the stamps to tell the intervals apart */
+	if (iostat_interval < 1000000ULL)
+		stamp_prec = 6;
+	else if (iostat_interval < 10000000ULL)
+		stamp_prec = 3;
+
+	/* A resumed run adds to the file it left off */
+	if (iostat_ofp && !resume_name)
 		dump_hdr();
 }
 
-void iostat_dump_stats(__u64 stamp, int all)
+/*
+ * A device showing up part way through is idle from the start of the
+ * interval it showed up in, not from time 0
+ */
+void iostat_dev_init(struct d_info *dip)
 {
-	struct d_info *dip;
+	if (last_start != (__u64)-1)
+		dip->stats.last_qu_change = dip->stats.last_dev_change =
+							TO_SEC(last_start);
+}
+
+void iostat_free(void *handle)
+{
+	free(handle);
+}
+
+/*
+ * Per-interval latencies, printed along with the iostat data when the
+ * input is a live stream
+ */
+static void __dump_lat(struct d_info *dip, void *arg)
+{
+	char hdr[16];
+	struct dump_arg *dap = arg;
+	struct iostat_ring *rp = dip ? dip->iostat_handle : NULL;
+	struct stats *sp;
+	double n;
+
+	if (!rp || dap->idx < rp->first)
+		return;
+
+	sp = &rp->recs[dap->idx];
+	n = sp->n_lat ? (double)sp->n_lat : 1.0;
+	fprintf(iostat_ofp, "%-11s %8llu %9.3lf %9.3lf %9.3lf %9.3lf",
+		make_dev_hdr(hdr, 11, dip, 1), (unsigned long long)sp->n_lat,
+		TO_MSEC(sp->q2c) / n, TO_MSEC(sp->q2c_max),
+		TO_MSEC(sp->d2c) / n, TO_MSEC(sp->d2c_max));
+	fprintf(iostat_ofp, "%8.*lf\n", stamp_prec, TO_SEC(dap->stamp));
+}
+
+static void __dump_rec(struct d_info *dip, void *arg)
+{
+	struct dump_arg *dap = arg;
+	struct iostat_ring *rp = dip ? dip->iostat_handle : NULL;
+
+	if (rp && dap->idx >= rp->first)
+		__dump_stats(dap->stamp, 0, dip, &rp->recs[dap->idx], dap->asp);
+}
+
+/*
+ * Format the intervals held in the rings, oldest first
+ */
+void iostat_flush(void)
+{
+	struct list_head *p;
+	struct dump_arg da;
 	struct stats_t as;
 
-	memset(&as, 0, sizeof(struct stats_t));
-	if (all)
-		dump_hdr();
+	if (!iostat_ofp)
+		return;
+
+	for (da.idx = 0; da.idx < ring_nr; da.idx++) {
+		memset(&as, 0, sizeof(as));
+		da.stamp = ring_stamps[da.idx];
+		da.asp = &as;
 
-	if (devices == NULL) {
-		struct list_head *p;
+		dip_foreach_out(__dump_rec, &da);
+		__dump_stats_t(da.stamp, &as, 0);
 
-		__list_for_each(p, &all_devs) {
-			dip = list_entry(p, struct d_info, all_head);
-			__dump_stats(stamp, all, dip, &as);
+		if (streaming) {
+			fprintf(iostat_ofp, "\nDevice:        # C   Q2C(ms)"
+					    "   max(ms)   D2C(ms)   max(ms)"
+					    "   Stamp\n");
+			dip_foreach_out(__dump_lat, &da);
 		}
-	} else {
-		int i;
-		unsigned int mjr, mnr;
-		char *p = devices;
+		fprintf(iostat_ofp, "\n");
+	}
 
-		while (p && ((i = sscanf(p, "%u,%u", &mjr, &mnr)) == 2)) {
-			dip = __dip_find((__u32)((mjr << MINORBITS) | mnr));
-			__dump_stats(stamp, all, dip, &as);
+	ring_nr = 0;
+	__list_for_each(p, &all_devs) {
+		struct d_info *dip = list_entry(p, struct d_info, all_head);
+		struct iostat_ring *rp = dip->iostat_handle;
 
-			p = strchr(p, ';');
-			if (p) p++;
+		if (rp)
+			rp->first = 0;
+	}
+
+	if (streaming)
+		fflush(iostat_ofp);
+}
+
+/*
+ * Only called once the rings have been flushed
+ */
+void iostat_ckpt_save(FILE *fp)
+{
+	ckpt_put(fp, &last_start, sizeof(last_start));
+	ckpt_put(fp, &iostat_last_stamp, sizeof(iostat_last_stamp));
+}
+
+void iostat_ckpt_load(FILE *fp)
+{
+	ckpt_get(fp, &last_start, sizeof(last_start));
+	ckpt_get(fp, &iostat_last_stamp, sizeof(iostat_last_stamp));
+}
+
+/*
+ * Close out the interval ending at stamp on one device: bring the queue
+ * size and idle time integrals up to the interval's end, keep (or write
+ * out) its counts and start the next one from zero
+ */
+static void __iostat_tick(struct d_info *dip, void *arg)
+{
+	__u64 stamp = *(__u64 *)arg;
+	double now = TO_SEC(stamp);
+	struct stats *sp;
+
+	if (!dip)
+		return;
+
+	sp = &dip->stats;
+	update_tot_qusz(dip, now);
+	update_idle_time(dip, now);
+
+	if (dip->iostat_bp) {
+		double dt = (double)iostat_interval / 1.0e9;
+
+		bcol_add(dip->iostat_bp, now,
+			 (unsigned int)sp->rqm[1], (unsigned int)sp->rqm[0],
+			 (unsigned int)sp->ios[1], (unsigned int)sp->ios[0],
+			 sp->sec[1], sp->sec[0], sp->wait, sp->svctm,
+			 sp->tot_qusz / dt, (sp->idle_time <= dt) ?
+				100.0 * (1.0 - (sp->idle_time / dt)) : 0.0);
+	} else if (iostat_ofp) {
+		struct iostat_ring *rp = dip->iostat_handle;
+
+		if (!rp) {
+			rp = malloc(sizeof(*rp));
+			rp->first = ring_nr;
+			dip->iostat_handle = rp;
 		}
+		rp->recs[ring_nr] = *sp;
 	}
 
-	__dump_stats_t(stamp, &as, all);
+	sp->rqm[0] = sp->rqm[1] = 0;
+	sp->ios[0] = sp->ios[1] = 0;
+	sp->sec[0] = sp->sec[1] = 0;
+	sp->wait = sp->svctm = 0;
+	sp->n_lat = sp->q2c = sp->q2c_max = sp->d2c = sp->d2c_max = 0;
 
-	if (!all && iostat_ofp)
-		fprintf(iostat_ofp, "\n");
+	sp->tot_qusz = sp->idle_time = 0.0;
+}
+
+static void iostat_tick(__u64 stamp)
+{
+	if (ring_nr == IOSTAT_RING)
+		iostat_flush();
+
+	dip_foreach_out(__iostat_tick, &stamp);
+	if (iostat_ofp)
+		ring_stamps[ring_nr++] = stamp;
+}
+
+static void __dump_all(struct d_info *dip, void *arg)
+{
+	struct dump_arg *dap = arg;
+	double now = TO_SEC(dap->stamp);
+
+	if (!dip)
+		return;
+
+	update_tot_qusz(dip, now);
+	update_idle_time(dip, now);
+	__dump_stats(dap->stamp, 1, dip, &dip->all_stats, dap->asp);
+}
+
+/*
+ * Totals over the whole run
+ */
+void iostat_dump_stats(__u64 stamp, int all)
+{
+	struct dump_arg da;
+	struct stats_t as;
+
+	if (!all)
+		return;
+
+	memset(&as, 0, sizeof(struct stats_t));
+	da.stamp = stamp;
+	da.asp = &as;
+
+	dump_hdr();
+	dip_foreach_out(__dump_all, &da);
+	__dump_stats_t(stamp, &as, all);
 }
 
+/*
+ * Intervals end on exact multiples of the interval from the first trace,
+ * however many have gone by since the last trace
+ */
 void iostat_check_time(__u64 stamp)
 {
-	if (iostat_ofp) {
+	if (iostat_on) {
 		if (last_start == (__u64)-1)
 			last_start = stamp;
-		else if ((stamp - last_start) >= iostat_interval) {
-			iostat_dump_stats(stamp, 0);
-			last_start = stamp;
+		else if (stamp >= last_start + iostat_interval) {
+			shard_sync();
+			do {
+				last_start += iostat_interval;
+				iostat_tick(last_start);
+			} while (stamp >= last_start + iostat_interval);
+
+			if (streaming)
+				iostat_flush();
 		}
 
 		iostat_last_stamp = stamp;
@@ -259,25 +438,85 @@ void iostat_issue(struct io *iop)
 	INC_STAT(dip, ios[rw]);
 	ADD_STAT(dip, sec[rw], iop->t.bytes >> 9);
 
-	update_idle_time(dip, now, 0);
+	update_idle_time(dip, now);
 	INC_STAT(dip, cur_dev);
 }
 
-void iostat_complete(struct io *q_iop, struct io *c_iop)
+/*
+ * A request done: it went into the queue count at its G and onto the
+ * device at its D, once however many Qs were merged into it. g_time and
+ * d_time are those of the Qs it completed, or -1 if none had one.
+ */
+void iostat_complete_rq(struct io *c_iop, __u64 g_time, __u64 d_time)
 {
+	struct d_info *dip = c_iop->dip;
 	double now = TO_SEC(c_iop->t.time);
-	struct d_info *dip = q_iop->dip;
 
-	if (q_iop->i_time != (__u64)-1)
-		ADD_STAT(c_iop->dip, wait, tdelta(q_iop->i_time,c_iop->t.time));
-	else if (q_iop->m_time != (__u64)-1)
-		ADD_STAT(c_iop->dip, wait, tdelta(q_iop->m_time,c_iop->t.time));
+	if (g_time != (__u64)-1) {
+		update_tot_qusz(dip, now);
+		DEC_STAT(dip, cur_qusz);
+	}
 
-	update_tot_qusz(dip, now);
-	DEC_STAT(dip, cur_qusz);
+	if (d_time != (__u64)-1) {
+		update_idle_time(dip, now);
+		DEC_STAT(dip, cur_dev);
+	}
+}
+
+void iostat_complete(struct io *q_iop, struct io *c_iop)
+{
+	struct d_info *dip = q_iop->dip;
 
-	update_idle_time(dip, now, 0);
-	DEC_STAT(dip, cur_dev);
+	__u64 i_time = iop_time(q_iop, IOT_I);
+	__u64 m_time = iop_time(q_iop, IOT_M);
+
+	if (i_time != (__u64)-1)
+		ADD_STAT(c_iop->dip, wait, tdelta(i_time, c_iop->t.time));
+	else if (m_time != (__u64)-1)
+		ADD_STAT(c_iop->dip, wait, tdelta(m_time, c_iop->t.time));
 
 	ADD_STAT(dip, svctm, tdelta(q_iop->t.time, c_iop->t.time));
+
+	if (streaming) {
+		struct stats *sp = &dip->stats;
+		__u64 q2c = tdelta(q_iop->t.time, c_iop->t.time);
+		__u64 d2c = tdelta(iop_time(q_iop, IOT_D), c_iop->t.time);
+
+		sp->n_lat++;
+		sp->q2c += q2c;
+		sp->d2c += d2c;
+		if (q2c > sp->q2c_max)
+			sp->q2c_max = q2c;
+		if (d2c > sp->d2c_max)
+			sp->d2c_max = d2c;
+	}
+}
+
+/*
+ * A Q dropped before its completion came in (see dip_cull_check). The
+ * request's queue and device counts went with the Q that took its G;
+ * undo those for it alone. It is taken to have been out until the cull,
+ * at stamp; the integrals only ever move forward.
+ */
+void iostat_cull(struct io *q_iop, __u64 stamp)
+{
+	struct d_info *dip = q_iop->dip;
+	double now = TO_SEC(stamp);
+	int issued = iop_time(q_iop, IOT_D) != (__u64)-1;
+
+	if (!issued && iop_time(q_iop, IOT_M) == (__u64)-1 &&
+							dip->n_act_q != 0)
+		dip->n_act_q--;
+
+	if (iop_time(q_iop, IOT_G) == (__u64)-1)
+		return;
+
+	if (dip->stats.cur_qusz > 0) {
+		update_tot_qusz(dip, now);
+		DEC_STAT(dip, cur_qusz);
+	}
+	if (issued && dip->stats.cur_dev > 0) {
+		update_idle_time(dip, now);
+		DEC_STAT(dip, cur_dev);
+	}
 }
@@ -20,9 +20,12 @@
  */
 #include "globals.h"
 
-static inline void latency_out(FILE *ofp, __u64 tstamp, __u64 latency)
+static inline void latency_out(FILE *ofp, struct bcol_buf *bp,
+			       __u64 tstamp, __u64 latency)
 {
-	if (ofp)
+	if (bp)
+		bcol_add(bp, TO_SEC(tstamp), TO_SEC(latency));
+	else if (ofp)
 		fprintf(ofp, "%lf %lf\n", TO_SEC(tstamp), TO_SEC(latency));
 }
 
@@ -47,6 +50,13 @@ FILE *latency_open(struct d_info *dip, char *name, char *post)
 
 void latency_alloc(struct d_info *dip)
 {
+	if (binary_data) {
+		dip->q2d_bp = bcol_alloc(BC_Q2D, dip);
+		dip->d2c_bp = bcol_alloc(BC_D2C, dip);
+		dip->q2c_bp = bcol_alloc(BC_Q2C, dip);
+		return;
+	}
+
 	dip->q2d_ofp = latency_open(dip, q2d_name, "q2d");
 	dip->d2c_ofp = latency_open(dip, d2c_name, "d2c");
 	dip->q2c_ofp = latency_open(dip, q2c_name, "q2c");
@@ -55,17 +65,24 @@ void latency_alloc(struct d_info *dip)
 void latency_q2d(struct d_info *dip, __u64 tstamp, __u64 latency)
 {
 	plat_x2c(dip->q2d_plat_handle, tstamp, latency);
-	latency_out(dip->q2d_ofp, tstamp, latency);
+	latency_out(dip->q2d_ofp, dip->q2d_bp, tstamp, latency);
 }
 
 void latency_d2c(struct d_info *dip, __u64 tstamp, __u64 latency)
 {
 	plat_x2c(dip->d2c_plat_handle, tstamp, latency);
-	latency_out(dip->d2c_ofp, tstamp, latency);
+	latency_out(dip->d2c_ofp, dip->d2c_bp, tstamp, latency);
 }
 
 void latency_q2c(struct d_info *dip, __u64 tstamp, __u64 latency)
 {
 	plat_x2c(dip->q2c_plat_handle, tstamp, latency);
-	latency_out(dip->q2c_ofp, tstamp, latency);
+	latency_out(dip->q2c_ofp, dip->q2c_bp, tstamp, latency);
+}
+
+void latency_free(struct d_info *dip)
+{
+	bcol_free(dip->q2d_bp);
+	bcol_free(dip->d2c_bp);
+	bcol_free(dip->q2c_bp);
 }
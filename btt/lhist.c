@@ -0,0 +1,102 @@
+/*
+ * blktrace output analysis: generate a timeline & gather statistics
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/*
+ * Log-linear latency histograms behind the -H percentiles. Each avg_info
+ * carries one, grown to the largest bucket seen: latencies up to a few
+ * seconds need ~2000 buckets, and any value is reported to within
+ * 1/2^LH_SUB_BITS (1.6%) of its true size. Histograms add up bucket by
+ * bucket, so they merge exactly.
+ */
+#include "globals.h"
+
+void lh_grow(struct avg_info *ap, int idx)
+{
+	int nr = ap->hist_nr ? ap->hist_nr : 256;
+
+	while (nr <= idx)
+		nr *= 2;
+
+	ap->hist = realloc(ap->hist, nr * sizeof(*ap->hist));
+	memset(ap->hist + ap->hist_nr, 0,
+	       (nr - ap->hist_nr) * sizeof(*ap->hist));
+	ap->hist_nr = nr;
+}
+
+void lh_merge(struct avg_info *ap, struct avg_info *from)
+{
+	int i;
+
+	if (from->hist_nr > ap->hist_nr)
+		lh_grow(ap, from->hist_nr - 1);
+	for (i = 0; i < from->hist_nr; i++)
+		ap->hist[i] += from->hist[i];
+}
+
+/*
+ * Middle of the bucket holding the pct'th percentile, kept within the
+ * (exact) min and max
+ */
+__u64 lh_pct(struct avg_info *ap, double pct)
+{
+	__u64 rank, sum = 0, lo, width;
+	int i, shift;
+
+	if (ap->n <= 0 || !ap->hist)
+		return 0;
+
+	rank = (__u64)((pct / 100.0) * ap->n + 0.999999);
+	if (rank < 1)
+		rank = 1;
+
+	for (i = 0; i < ap->hist_nr; i++) {
+		sum += ap->hist[i];
+		if (sum >= rank)
+			break;
+	}
+
+	if (i < (2 << LH_SUB_BITS)) {
+		lo = i;
+		width = 1;
+	} else {
+		shift = (i >> LH_SUB_BITS) - 1;
+		lo = (__u64)((i & ((1 << LH_SUB_BITS) - 1)) +
+						(1 << LH_SUB_BITS)) << shift;
+		width = 1ULL << shift;
+	}
+
+	lo += width / 2;
+	if (lo < ap->min)
+		lo = ap->min;
+	if (lo > ap->max)
+		lo = ap->max;
+	return lo;
+}
+
+void lh_free(struct avgs_info *ap)
+{
+	struct avg_info *aip = (struct avg_info *)ap;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(*ap) / sizeof(*aip); i++) {
+		free(aip[i].hist);
+		aip[i].hist = NULL;
+		aip[i].hist_nr = 0;
+	}
+}
@@ -27,6 +27,7 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <fcntl.h>
+#include <pthread.h>
 
 #define INLINE_DECLARE
 #include "globals.h"
@@ -44,6 +45,7 @@ struct buf_info {
 
 LIST_HEAD(files_to_clean);
 LIST_HEAD(all_bufs);
+static pthread_mutex_t clean_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static void clean_files(void)
 {
@@ -115,7 +117,9 @@ void add_file(FILE *fp, char *oname)
 
 	fip->ofp = fp;
 	fip->oname = oname;
+	pthread_mutex_lock(&clean_lock);
 	list_add_tail(&fip->head, &files_to_clean);
+	pthread_mutex_unlock(&clean_lock);
 }
 
 void add_buf(void *buf)
@@ -123,7 +127,37 @@ void add_buf(void *buf)
 	struct buf_info *bip = malloc(sizeof(*bip));
 
 	bip->buf = buf;
+	pthread_mutex_lock(&clean_lock);
 	list_add_tail(&bip->head, &all_bufs);
+	pthread_mutex_unlock(&clean_lock);
+}
+
+/*
+ * struct io's and small pdus are carved out of slabs and recycled through
+ * free lists (see io_alloc and pdu_alloc); the slabs go at exit.
+ */
+void io_slab_grow(void)
+{
+	struct io *iops = malloc(IO_SLAB_NR * sizeof(*iops));
+	int i;
+
+	for (i = 0; i < IO_SLAB_NR; i++)
+		list_add_tail(&iops[i].f_head, &free_ios);
+	add_buf(iops);
+}
+
+void pdu_slab_grow(void)
+{
+	char *pdus = malloc(PDU_SLAB_NR * PDU_SMALL);
+	int i;
+
+	for (i = PDU_SLAB_NR - 1; i >= 0; i--) {
+		void **p = (void **)(pdus + i * PDU_SMALL);
+
+		*p = free_pdus;
+		free_pdus = p;
+	}
+	add_buf(pdus);
 }
 
 void clean_allocs(void)
@@ -21,89 +21,499 @@
 
 #include <stdio.h>
 #include <unistd.h>
+#include <errno.h>
+#include <signal.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <string.h>
+#include <pthread.h>
+#include <semaphore.h>
 
 #include "blktrace.h"
 #include "globals.h"
 
-#define DEF_LEN	(16 * 1024 * 1024)
+/*
+ * Inputs are mapped whole where the address space allows it, otherwise in
+ * large windows; either way the kernel is told they are read once, front
+ * to back.
+ */
+#define WIN_LEN		(64 * 1024 * 1024)
+#define MAP_WHOLE	(sizeof(void *) >= 8)
+
+/*
+ * Reading ahead: pages are asked for PF_AHEAD in front of the decoder,
+ * PF_CHUNK at a time. With more than one CPU (and whole file maps) a
+ * thread also faults them in, so the decoder seldom waits on the disk.
+ */
+#define PF_AHEAD	(32 * 1024 * 1024)
+#define PF_CHUNK	(1024 * 1024)
+
+#define N_GENESIS	64
+
+/*
+ * Foreign headers are copied out of the map, and converted, this many at
+ * a time
+ */
+#define N_BATCH		64
+
+/*
+ * One input stream: either a single (blkparse -d) merged file, or one
+ * per-CPU <dev>.blktrace.<cpu> file straight from blktrace. Native headers
+ * are used in place in the map (or copied into tbuf, if misaligned);
+ * foreign ones are converted in runs into batch, batch_off holding where
+ * each came from.
+ */
+struct ifile {
+	char *name;
+	int fd;
+	int raw;
+	void *map;
+	off_t min, cur, max, size;
+	size_t len;
+
+	struct blk_io_trace *t, tbuf;
+	void *pdu;
+	off_t next;
+
+	struct blk_io_trace *batch;
+	off_t *batch_off;
+	int batch_nr, batch_idx;
+
+	unsigned long stamp;
+
+	off_t pf_want, pf_cur;
+	struct ifile *pf_next;
+};
+
+/*
+ * Streams are merged through a heap ordered by the time of their next
+ * trace. On equal times the stream advanced most recently goes first,
+ * which is the order blkparse's merge (and so blkparse -d) produces.
+ */
+static struct ifile **heap;
+static int nheap;
+static unsigned long stamp;
+static off_t total_size;
+
+/*
+ * Per-CPU files carry absolute times, blkparse -d rebases them to the
+ * first trace seen; do the same so results match either way.
+ */
+static __u64 genesis_time = -1ULL;
+
+/*
+ * Where each input file was at a checkpoint (see ckpt.c): those still
+ * being read and, so that a trace that grows can be picked up again,
+ * those already read to the end
+ */
+struct ifile_pos {
+	char *name;
+	off_t off;
+	unsigned long stamp;
+	int used;
+	struct ifile_pos *next;
+};
+
+static struct ifile_pos *ipos, *idone;
+static int ipos_nr, idone_nr;
 
-static int fd;
-static void *cur_map = MAP_FAILED;
-static off_t cur_min, cur, cur_max, total_size;
-static size_t len;
-static struct blk_io_trace *next_t;
 static long pgsz;
 
 int data_is_native = -1;
 
+/*
+ * Streaming input, from a pipe or socket (-i - for stdin). There is no
+ * file to map and the traces may be out of order (blktrace -o - writes
+ * each CPU's buffer as it fills), so they are read through a buffer and
+ * put right by a heap holding up to reorder_nr traces. A trace that
+ * shows up after a later one has already gone out is passed on as is
+ * and counted.
+ *
+ * Non-message notifies (process names, timestamps) are kept out of the
+ * heap and passed on in the order they came in, as they are from a
+ * file: blkparse -d writes them out of band, with times it does not
+ * rebase, and they have to get ahead of the IOs they name.
+ */
+struct strm_ent {
+	__u64 seq;
+	struct blk_io_trace t;
+	void *pdu;
+};
+
+#define STRM_BUF_LEN	(1024 * 1024)
+
+int streaming;
+int reorder_nr = 65536;
+unsigned long strm_late;
+
+static int strm_fd = -1, strm_eof;
+static volatile sig_atomic_t strm_intr;
+static char *strm_buf;
+static size_t strm_len, strm_off;
+static struct strm_ent *strm_heap, *strm_notes;
+static int strm_nr, strm_notes_nr, strm_notes_head, strm_notes_size;
+static __u64 strm_seq, strm_last;
+
 static inline size_t min_len(size_t a, size_t b)
 {
 	return a < b ? a : b;
 }
 
-static inline size_t convert_to_cpu(struct blk_io_trace *t,
-                                    struct blk_io_trace *tp,
-				    void **pdu)
+/*
+ * Only a few actions are looked at past the header: notifies (process
+ * names, messages), remaps and unplugs. Their pdus are copied out, as
+ * they are changed in place later on; all others are skipped.
+ */
+static inline int pdu_wanted(__u32 action)
 {
-	if (data_is_native == -1)
-		check_data_endianness(t->magic);
+	if (action & BLK_TC_ACT(BLK_TC_NOTIFY))
+		return 1;
 
-	if (data_is_native)
-		memcpy(tp, t, sizeof(*tp));
-	else {
-		tp->magic	= be32_to_cpu(t->magic);
-		tp->sequence	= be32_to_cpu(t->sequence);
-		tp->time	= be64_to_cpu(t->time);
-		tp->sector	= be64_to_cpu(t->sector);
-		tp->bytes	= be32_to_cpu(t->bytes);
-		tp->action	= be32_to_cpu(t->action);
-		tp->pid		= be32_to_cpu(t->pid);
-		tp->device	= be32_to_cpu(t->device);
-		tp->cpu		= be16_to_cpu(t->cpu);
-		tp->error	= be16_to_cpu(t->error);
-		tp->pdu_len	= be16_to_cpu(t->pdu_len);
-	}
-
-	if (tp->pdu_len) {
-		*pdu = malloc(tp->pdu_len);
-		memcpy(*pdu, t+1, tp->pdu_len);
-	} else
-		*pdu = NULL;
+	switch (action & 0xffff) {
+	case __BLK_TA_REMAP:
+	case __BLK_TA_UNPLUG_IO:
+	case __BLK_TA_UNPLUG_TIMER:
+		return 1;
+	}
 
-	return sizeof(*tp) + tp->pdu_len;
+	return 0;
 }
 
-static int move_map(void)
+static pthread_t pf_thread;
+static pthread_mutex_t pf_lock = PTHREAD_MUTEX_INITIALIZER;
+static sem_t pf_sem;
+static int pf_on;
+static volatile int pf_stop;
+static struct ifile *pf_files;
+static volatile unsigned char pf_sink;
+
+/*
+ * Fault in the next chunk of ifp ahead of the decoder, if it wants it
+ */
+static int pf_chunk(struct ifile *ifp)
 {
-	if (cur_map != MAP_FAILED)
-		munmap(cur_map, len);
+	off_t want = __atomic_load_n(&ifp->pf_want, __ATOMIC_RELAXED);
+	unsigned char *p, sum = 0;
+	size_t len, off;
 
-	cur_min = (cur & ~(pgsz-1));
-	len = min_len(DEF_LEN, total_size - cur_min);
-	if (len < sizeof(*next_t))
+	if (ifp->pf_cur >= want)
 		return 0;
 
-	cur_map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd,
-		       cur_min);
-	if (cur_map == MAP_FAILED) {
+	len = min_len(PF_CHUNK, want - ifp->pf_cur);
+	p = ifp->map + (ifp->pf_cur - ifp->min);
+	madvise(p, len, MADV_WILLNEED);
+	for (off = 0; off < len; off += pgsz)
+		sum += p[off];
+	pf_sink = sum;
+
+	ifp->pf_cur += len;
+	return 1;
+}
+
+static void *pf_main(void *arg)
+{
+	struct ifile *ifp;
+	int busy;
+
+	(void)arg;
+	while (!pf_stop) {
+		if (sem_wait(&pf_sem) < 0)
+			continue;
+
+		do {
+			busy = 0;
+			pthread_mutex_lock(&pf_lock);
+			for (ifp = pf_files; ifp && !pf_stop; ifp = ifp->pf_next)
+				busy |= pf_chunk(ifp);
+			pthread_mutex_unlock(&pf_lock);
+		} while (busy && !pf_stop);
+	}
+
+	return NULL;
+}
+
+static void pf_start(void)
+{
+	if (!MAP_WHOLE || sysconf(_SC_NPROCESSORS_ONLN) < 2)
+		return;
+
+	sem_init(&pf_sem, 0, 0);
+	if (pthread_create(&pf_thread, NULL, pf_main, NULL)) {
+		sem_destroy(&pf_sem);
+		return;
+	}
+	pf_on = 1;
+}
+
+static void pf_end(void)
+{
+	if (!pf_on)
+		return;
+
+	pf_stop = 1;
+	sem_post(&pf_sem);
+	pthread_join(pf_thread, NULL);
+	sem_destroy(&pf_sem);
+	pf_on = 0;
+}
+
+/*
+ * The decoder has moved into a new chunk: ask for the one PF_AHEAD on
+ */
+static void pf_kick(struct ifile *ifp)
+{
+	off_t want = (ifp->cur & ~((off_t)PF_CHUNK - 1)) + PF_AHEAD;
+
+	if (pf_on) {
+		if (want > ifp->size)
+			want = ifp->size;
+		__atomic_store_n(&ifp->pf_want, want, __ATOMIC_RELAXED);
+		sem_post(&pf_sem);
+	} else if (want - PF_CHUNK < ifp->max) {
+		off_t from = want - PF_CHUNK;
+
+		if (from < ifp->min)
+			from = ifp->min;
+		madvise(ifp->map + (from - ifp->min),
+			min_len(PF_CHUNK, ifp->max - from), MADV_WILLNEED);
+	}
+}
+
+static int move_map(struct ifile *ifp)
+{
+	if (ifp->map != MAP_FAILED)
+		munmap(ifp->map, ifp->len);
+
+	ifp->min = (ifp->cur & ~(pgsz-1));
+	if (MAP_WHOLE)
+		ifp->len = ifp->size - ifp->min;
+	else
+		ifp->len = min_len(WIN_LEN, ifp->size - ifp->min);
+	if (ifp->len < sizeof(struct blk_io_trace)) {
+		ifp->map = MAP_FAILED;
+		return 0;
+	}
+
+	ifp->map = mmap(NULL, ifp->len, PROT_READ, MAP_SHARED, ifp->fd,
+			ifp->min);
+	if (ifp->map == MAP_FAILED) {
 		perror("mmap");
 		exit(1);
 	}
+	madvise(ifp->map, ifp->len, MADV_SEQUENTIAL);
 
-	cur_max = cur_min + len;
-	return (cur < cur_max);
+	ifp->max = ifp->min + ifp->len;
+	return (ifp->cur < ifp->max);
 }
 
-void setup_ifile(char *fname)
+static inline __u16 raw_pdu_len(struct blk_io_trace *t)
 {
-	struct stat buf;
+	return data_is_native ? t->pdu_len : __bswap_16(t->pdu_len);
+}
 
-	pgsz = sysconf(_SC_PAGESIZE);
+/*
+ * Copy out and convert the run of foreign headers at ifp->cur: as many
+ * as there are whole in the map, up to N_BATCH. The one at ifp->cur is
+ * known to be.
+ */
+static void ifile_batch(struct ifile *ifp)
+{
+	off_t off = ifp->cur;
+	int n = 0;
+
+	if (!ifp->batch) {
+		ifp->batch = malloc(N_BATCH * sizeof(*ifp->batch));
+		ifp->batch_off = malloc(N_BATCH * sizeof(*ifp->batch_off));
+	}
+
+	while (n < N_BATCH &&
+	       off + (off_t)sizeof(struct blk_io_trace) <= ifp->max) {
+		struct blk_io_trace *t = ifp->map + (off - ifp->min);
+		off_t end = off + sizeof(*t) + raw_pdu_len(t);
+
+		if (end > ifp->max)
+			break;
+		memcpy(&ifp->batch[n], t, sizeof(*t));
+		ifp->batch_off[n++] = off;
+		off = end;
+	}
+
+	traces_to_cpu(ifp->batch, n);
+	ifp->batch_nr = n;
+	ifp->batch_idx = 0;
+}
+
+/*
+ * Make ifp->t the header at ifp->next (and ifp->pdu its pdu, if wanted);
+ * 0 at the end of the file
+ */
+static int ifile_next(struct ifile *ifp)
+{
+	struct blk_io_trace *t;
+	off_t prev = ifp->cur;
+	__u16 pdu_len;
+
+	ifp->cur = ifp->next;
+	if (ifp->cur + (off_t)sizeof(*t) > ifp->max)
+		if (ifp->max == ifp->size || !move_map(ifp) ||
+		    ifp->cur + (off_t)sizeof(*t) > ifp->max)
+			return 0;
+
+	t = ifp->map + (ifp->cur - ifp->min);
+	if (data_is_native == -1)
+		check_data_endianness(t->magic);
+
+	pdu_len = raw_pdu_len(t);
+	if (ifp->cur + (off_t)sizeof(*t) + pdu_len > ifp->max) {
+		if (ifp->max == ifp->size || !move_map(ifp))
+			return 0;
+		t = ifp->map + (ifp->cur - ifp->min);
+		if (ifp->cur + (off_t)sizeof(*t) + pdu_len > ifp->max)
+			return 0;
+	}
+
+	if (!data_is_native) {
+		if (ifp->batch_idx == ifp->batch_nr ||
+		    ifp->batch_off[ifp->batch_idx] != ifp->cur)
+			ifile_batch(ifp);
+		ifp->t = &ifp->batch[ifp->batch_idx++];
+	} else if ((unsigned long)t & 7) {
+		memcpy(&ifp->tbuf, t, sizeof(*t));
+		ifp->t = &ifp->tbuf;
+	} else
+		ifp->t = t;
+
+	if (pdu_len && pdu_wanted(ifp->t->action)) {
+		ifp->pdu = pdu_alloc(pdu_len);
+		memcpy(ifp->pdu, t + 1, pdu_len);
+	} else
+		ifp->pdu = NULL;
+
+	ifp->next = ifp->cur + sizeof(*t) + pdu_len;
+	if ((ifp->cur ^ prev) & ~((off_t)PF_CHUNK - 1))
+		pf_kick(ifp);
+	return 1;
+}
+
+static void close_ifile(struct ifile *ifp)
+{
+	struct ifile **pp;
+
+	if (ifp->pdu)
+		pdu_free(ifp->pdu, ifp->t->pdu_len);
+
+	pthread_mutex_lock(&pf_lock);
+	for (pp = &pf_files; *pp; pp = &(*pp)->pf_next)
+		if (*pp == ifp) {
+			*pp = ifp->pf_next;
+			break;
+		}
+	pthread_mutex_unlock(&pf_lock);
+
+	if (ifp->map != MAP_FAILED)
+		munmap(ifp->map, ifp->len);
+	close(ifp->fd);
+
+	if (ckpt_name && ifp->name) {
+		struct ifile_pos *ip = malloc(sizeof(*ip));
+
+		ip->name = ifp->name;
+		ip->off = ifp->cur;
+		ip->stamp = ifp->stamp;
+		ip->next = idone;
+		idone = ip;
+		idone_nr++;
+		add_buf(ip->name);
+		add_buf(ip);
+	} else
+		free(ifp->name);
+	free(ifp->batch);
+	free(ifp->batch_off);
+	free(ifp);
+}
+
+static inline int ifile_before(struct ifile *a, struct ifile *b)
+{
+	__u64 ta = a->t->time;
+	__u64 tb = b->t->time;
+
+	return ta < tb || (ta == tb && a->stamp > b->stamp);
+}
+
+static void heap_down(int i)
+{
+	struct ifile *ifp = heap[i];
+	int c;
+
+	while ((c = 2 * i + 1) < nheap) {
+		if (c + 1 < nheap && ifile_before(heap[c + 1], heap[c]))
+			c++;
+		if (!ifile_before(heap[c], ifp))
+			break;
+		heap[i] = heap[c];
+		i = c;
+	}
+	heap[i] = ifp;
+}
+
+static void heap_up(int i)
+{
+	struct ifile *ifp = heap[i];
+	int p;
+
+	while (i > 0 && ifile_before(ifp, heap[p = (i - 1) / 2])) {
+		heap[i] = heap[p];
+		i = p;
+	}
+	heap[i] = ifp;
+}
+
+/*
+ * blkparse handles non-message notifies out of band, so they do not count
+ * towards its first trace time. Look over the start of the file for it.
+ */
+static void raw_genesis(struct ifile *ifp)
+{
+	off_t off = ifp->cur;
+	int i;
+
+	for (i = 0; i < N_GENESIS; i++) {
+		struct blk_io_trace t;
+
+		if (off + (off_t)sizeof(t) > ifp->max)
+			break;
+		memcpy(&t, ifp->map + (off - ifp->min), sizeof(t));
+		trace_to_cpu(&t);
+		off += sizeof(t) + t.pdu_len;
+
+		if (t.action & BLK_TC_ACT(BLK_TC_NOTIFY) &&
+		    t.action != BLK_TN_MESSAGE)
+			continue;
+		if (t.time < genesis_time)
+			genesis_time = t.time;
+		break;
+	}
+}
+
+static struct ifile_pos *ipos_find(char *fname)
+{
+	int i;
+
+	for (i = 0; i < ipos_nr; i++)
+		if (!ipos[i].used && !strcmp(ipos[i].name, fname))
+			return &ipos[i];
+
+	return NULL;
+}
+
+static int add_ifile(char *fname, int raw)
+{
+	struct ifile *ifp;
+	struct ifile_pos *ip = NULL;
+	struct stat buf;
+	int fd;
 
 	fd = my_open(fname, O_RDONLY);
 	if (fd < 0) {
@@ -114,37 +524,488 @@ void setup_ifile(char *fname)
 		perror(fname);
 		exit(1);
 	}
-	total_size = buf.st_size;
 
-	if (!move_map())
-		exit(0);
+	ifp = malloc(sizeof(*ifp));
+	memset(ifp, 0, sizeof(*ifp));
+	ifp->fd = fd;
+	ifp->raw = raw;
+	ifp->map = MAP_FAILED;
+	ifp->size = buf.st_size;
+	total_size += ifp->size;
+
+	if (resume_name && (ip = ipos_find(fname)) != NULL) {
+		if (ip->off > ifp->size) {
+			fprintf(stderr, "FATAL: %s is shorter than when "
+				"checkpointed\n", fname);
+			exit(1);
+		}
+		ip->used = 1;
+		ifp->cur = ifp->next = ip->off;
+	}
+	ifp->name = strdup(fname);
+
+	if (!move_map(ifp) || !ifile_next(ifp)) {
+		if (ip)
+			ifp->stamp = ip->stamp;
+		close_ifile(ifp);
+		return 0;
+	}
+
+	/* Resuming, the times are already based */
+	if (raw && !resume_name)
+		raw_genesis(ifp);
+
+	if (MAP_WHOLE) {
+		/* A resumed file is mapped from where it was left off */
+		ifp->pf_cur = ifp->min;
+		pthread_mutex_lock(&pf_lock);
+		ifp->pf_next = pf_files;
+		pf_files = ifp;
+		pthread_mutex_unlock(&pf_lock);
+	}
+	pf_kick(ifp);
+
+	heap = realloc(heap, (nheap + 1) * sizeof(*heap));
+	ifp->stamp = ip ? ip->stamp : ++stamp;
+	heap[nheap] = ifp;
+	heap_up(nheap++);
+	return 1;
 }
 
-void cleanup_ifile(void)
+/*
+ * Add the per-CPU files <name>.blktrace.0, 1, ... like blkparse -i does
+ */
+static int add_cpu_files(char *name)
+{
+	char fname[PATH_MAX];
+	struct stat buf;
+	int cpu;
+
+	for (cpu = 0; ; cpu++) {
+		snprintf(fname, sizeof(fname), "%s.blktrace.%d", name, cpu);
+		if (stat(fname, &buf) < 0)
+			break;
+		if (buf.st_size)
+			add_ifile(fname, 1);
+	}
+
+	return cpu;
+}
+
+static void strm_stop(int sig)
+{
+	(void)sig;
+	strm_intr = 1;
+}
+
+/*
+ * Copy the next len bytes of the stream to dst (or pass over them if dst
+ * is NULL); 0 at the end of it
+ */
+static int strm_read(void *dst, size_t len)
+{
+	size_t n;
+	ssize_t ret;
+
+	while (len) {
+		if (strm_off == strm_len) {
+			if (strm_intr)
+				return 0;
+			ret = read(strm_fd, strm_buf, STRM_BUF_LEN);
+			if (ret < 0 && errno == EINTR && !strm_intr)
+				continue;
+			if (ret < 0 && errno != EINTR) {
+				perror(input_name);
+				exit(1);
+			}
+			if (ret <= 0)
+				return 0;
+			strm_len = ret;
+			strm_off = 0;
+		}
+
+		n = min_len(len, strm_len - strm_off);
+		if (dst) {
+			memcpy(dst, strm_buf + strm_off, n);
+			dst += n;
+		}
+		strm_off += n;
+		len -= n;
+	}
+
+	return 1;
+}
+
+static inline int strm_before(struct strm_ent *a, struct strm_ent *b)
+{
+	return a->t.time < b->t.time ||
+			(a->t.time == b->t.time && a->seq < b->seq);
+}
+
+static void strm_down(int i)
+{
+	struct strm_ent e = strm_heap[i];
+	int c;
+
+	while ((c = 2 * i + 1) < strm_nr) {
+		if (c + 1 < strm_nr && strm_before(&strm_heap[c + 1],
+						   &strm_heap[c]))
+			c++;
+		if (!strm_before(&strm_heap[c], &e))
+			break;
+		strm_heap[i] = strm_heap[c];
+		i = c;
+	}
+	strm_heap[i] = e;
+}
+
+static void strm_up(int i)
 {
-	if (cur_map != MAP_FAILED)
-		munmap(cur_map, len);
-	close(fd);
+	struct strm_ent e = strm_heap[i];
+	int p;
+
+	while (i > 0 && strm_before(&e, &strm_heap[p = (i - 1) / 2])) {
+		strm_heap[i] = strm_heap[p];
+		i = p;
+	}
+	strm_heap[i] = e;
 }
 
-int next_trace(struct blk_io_trace *t, void **pdu)
+/*
+ * Read one trace (and its pdu, if wanted) into the heap
+ */
+static int strm_get(void)
 {
-	size_t this_len;
+	struct strm_ent *ep = &strm_heap[strm_nr];
+
+	if (!strm_read(&ep->t, sizeof(ep->t)))
+		return 0;
+
+	if (data_is_native == -1 && check_data_endianness(ep->t.magic)) {
+		fprintf(stderr, "%s: not a blktrace stream\n", input_name);
+		exit(1);
+	}
+	trace_to_cpu(&ep->t);
+	if ((ep->t.magic & 0xffffff00) != BLK_IO_TRACE_MAGIC) {
+		fprintf(stderr, "%s: bad trace magic %x\n", input_name,
+			ep->t.magic);
+		exit(1);
+	}
 
-	if ((cur + 512) > cur_max)
-		if (!move_map()) {
-			cleanup_ifile();
+	if (ep->t.pdu_len && !pdu_wanted(ep->t.action)) {
+		if (!strm_read(NULL, ep->t.pdu_len))
+			return 0;
+		ep->pdu = NULL;
+	} else if (ep->t.pdu_len) {
+		ep->pdu = pdu_alloc(ep->t.pdu_len);
+		if (!strm_read(ep->pdu, ep->t.pdu_len)) {
+			pdu_free(ep->pdu, ep->t.pdu_len);
 			return 0;
 		}
+	} else
+		ep->pdu = NULL;
+
+	if (ep->t.action & BLK_TC_ACT(BLK_TC_NOTIFY) &&
+	    ep->t.action != BLK_TN_MESSAGE) {
+		if (strm_notes_nr == strm_notes_size) {
+			strm_notes_size = strm_notes_size ?
+						2 * strm_notes_size : 16;
+			strm_notes = realloc(strm_notes,
+				     strm_notes_size * sizeof(*strm_notes));
+		}
+		strm_notes[strm_notes_nr++] = *ep;
+		return 1;
+	}
+
+	ep->seq = strm_seq++;
+	strm_up(strm_nr++);
+	return 1;
+}
+
+/*
+ * Like per-CPU files, a raw stream carries absolute times: rebase them
+ * to the first trace in the opening window. The IOs of a blkparse -d
+ * stream already start at 0, so are left as they are.
+ */
+static void strm_genesis(void)
+{
+	int i;
+
+	for (i = 0; i < strm_nr; i++) {
+		struct blk_io_trace *t = &strm_heap[i].t;
+
+		if (t->time < genesis_time)
+			genesis_time = t->time;
+	}
+	if (genesis_time == -1ULL)
+		genesis_time = 0;
+}
+
+static void setup_stream(char *fname)
+{
+	struct sigaction sa;
+
+	if (!strcmp(fname, "-"))
+		strm_fd = 0;
+	else if ((strm_fd = my_open(fname, O_RDONLY)) < 0) {
+		perror(fname);
+		exit(1);
+	}
+
+	strm_buf = malloc(STRM_BUF_LEN);
+	strm_heap = malloc(reorder_nr * sizeof(*strm_heap));
+	streaming = 1;
+
+	/*
+	 * On an interrupt stop reading (rather than restarting the read it
+	 * cuts short), and finish off what is already in hand
+	 */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = strm_stop;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+}
+
+static void strm_fill(struct io *iop, struct strm_ent *ep)
+{
+	iop->t.time = ep->t.time > genesis_time ? ep->t.time - genesis_time
+						: 0;
+	iop->t.sector = ep->t.sector;
+	iop->t.bytes = ep->t.bytes;
+	iop->t.action = ep->t.action;
+	iop->t.pid = ep->t.pid;
+	iop->t.device = ep->t.device;
+	iop->pdu_len = ep->pdu ? ep->t.pdu_len : 0;
+	iop->pdu = ep->pdu;
+}
+
+static int next_strm_trace(struct io *iop)
+{
+	struct strm_ent *ep;
+
+	while (!strm_eof && strm_nr < reorder_nr)
+		if (!strm_get())
+			strm_eof = 1;
+
+	if (strm_notes_head < strm_notes_nr) {
+		strm_fill(iop, &strm_notes[strm_notes_head++]);
+		if (strm_notes_head == strm_notes_nr)
+			strm_notes_head = strm_notes_nr = 0;
+		return 1;
+	}
+
+	if (!strm_nr) {
+		cleanup_ifile();
+		return 0;
+	}
+	if (genesis_time == -1ULL)
+		strm_genesis();
+
+	ep = &strm_heap[0];
+	if (ep->t.time < strm_last)
+		strm_late++;
+	else
+		strm_last = ep->t.time;
+
+	strm_fill(iop, ep);
+
+	strm_heap[0] = strm_heap[--strm_nr];
+	if (strm_nr)
+		strm_down(0);
+
+	return 1;
+}
+
+static void cleanup_stream(void)
+{
+	while (strm_nr > 0) {
+		struct strm_ent *ep = &strm_heap[--strm_nr];
+
+		if (ep->pdu)
+			pdu_free(ep->pdu, ep->t.pdu_len);
+	}
+	while (strm_notes_head < strm_notes_nr) {
+		struct strm_ent *ep = &strm_notes[strm_notes_head++];
+
+		if (ep->pdu)
+			pdu_free(ep->pdu, ep->t.pdu_len);
+	}
+	if (strm_fd > 0)
+		close(strm_fd);
+	strm_fd = -1;
+	free(strm_heap);
+	free(strm_notes);
+	free(strm_buf);
+	strm_heap = strm_notes = NULL;
+	strm_buf = NULL;
+}
+
+/*
+ * Nothing to read is the end of it, unless checkpointing or resuming:
+ * the trace may yet grow, and a checkpoint has a report in it
+ */
+static void ifile_check(void)
+{
+	int i;
+
+	for (i = 0; i < ipos_nr; i++)
+		if (!ipos[i].used) {
+			fprintf(stderr, "FATAL: input %s checkpointed in %s is "
+				"missing\n", ipos[i].name, resume_name);
+			exit(1);
+		}
+
+	if (!nheap && !ckpt_name && !resume_name)
+		exit(0);
+}
+
+/*
+ * fname is either a single merged file, or a comma separated list of
+ * per-CPU base names (e.g. "sda,sdb" for sda.blktrace.N, sdb.blktrace.N)
+ */
+void setup_ifile(char *fname)
+{
+	struct stat buf;
+	char *name, *p;
+
+	pgsz = sysconf(_SC_PAGESIZE);
+
+	if (!strcmp(fname, "-") ||
+	    (!stat(fname, &buf) && !S_ISREG(buf.st_mode))) {
+		setup_stream(fname);
+		return;
+	}
+
+	pf_start();
+	if (!strchr(fname, ',') && !strstr(fname, ".blktrace.") &&
+	    !stat(fname, &buf)) {
+		add_ifile(fname, 0);
+		ifile_check();
+		return;
+	}
+
+	name = strdup(fname);
+	for (p = strtok(name, ","); p; p = strtok(NULL, ",")) {
+		char *b = strstr(p, ".blktrace.");
+
+		if (b)
+			*b = '\0';
+		if (!add_cpu_files(p)) {
+			fprintf(stderr, "%s: no such file or %s.blktrace.* set\n",
+				p, p);
+			exit(1);
+		}
+	}
+	free(name);
+	ifile_check();
+}
+
+void cleanup_ifile(void)
+{
+	if (streaming) {
+		cleanup_stream();
+		return;
+	}
+
+	pf_end();
+	while (nheap > 0)
+		close_ifile(heap[--nheap]);
+	free(heap);
+	heap = NULL;
+}
+
+int next_trace(struct io *iop)
+{
+	struct blk_io_trace *t;
+	struct ifile *ifp;
+
+	if (streaming)
+		return next_strm_trace(iop);
+
+	if (!nheap) {
+		cleanup_ifile();
+		return 0;
+	}
 
-	next_t = cur_map + (cur - cur_min);
-	this_len = convert_to_cpu(next_t, t, pdu);
-	cur += this_len;
+	ifp = heap[0];
+	t = ifp->t;
+	iop->t.time = t->time;
+	iop->t.sector = t->sector;
+	iop->t.bytes = t->bytes;
+	iop->t.action = t->action;
+	iop->t.pid = t->pid;
+	iop->t.device = t->device;
+	iop->pdu = ifp->pdu;
+	iop->pdu_len = ifp->pdu ? t->pdu_len : 0;
+	if (ifp->raw)
+		iop->t.time -= genesis_time;
+
+	ifp->pdu = NULL;
+	if (!ifile_next(ifp)) {
+		heap[0] = heap[--nheap];
+		close_ifile(ifp);
+	} else
+		ifp->stamp = ++stamp;
+
+	if (nheap)
+		heap_down(0);
 
 	return 1;
 }
 
+void ifile_ckpt_save(FILE *fp)
+{
+	__u32 n = nheap + idone_nr;
+	struct ifile_pos *ip;
+	int i;
+
+	ckpt_put(fp, &genesis_time, sizeof(genesis_time));
+	ckpt_put(fp, &stamp, sizeof(stamp));
+	ckpt_put(fp, &n, sizeof(n));
+	for (i = 0; i < nheap; i++) {
+		ckpt_put_str(fp, heap[i]->name);
+		ckpt_put(fp, &heap[i]->cur, sizeof(heap[i]->cur));
+		ckpt_put(fp, &heap[i]->stamp, sizeof(heap[i]->stamp));
+	}
+	for (ip = idone; ip; ip = ip->next) {
+		ckpt_put_str(fp, ip->name);
+		ckpt_put(fp, &ip->off, sizeof(ip->off));
+		ckpt_put(fp, &ip->stamp, sizeof(ip->stamp));
+	}
+}
+
+/*
+ * Called before the inputs are opened: add_ifile picks up from these
+ */
+void ifile_ckpt_load(FILE *fp)
+{
+	__u32 i, n;
+
+	ckpt_get(fp, &genesis_time, sizeof(genesis_time));
+	ckpt_get(fp, &stamp, sizeof(stamp));
+	ckpt_get(fp, &n, sizeof(n));
+	ipos = malloc(n * sizeof(*ipos));
+	add_buf(ipos);
+	for (i = 0; i < n; i++) {
+		ipos[i].name = ckpt_get_str(fp);
+		ckpt_get(fp, &ipos[i].off, sizeof(ipos[i].off));
+		ckpt_get(fp, &ipos[i].stamp, sizeof(ipos[i].stamp));
+		ipos[i].used = 0;
+		add_buf(ipos[i].name);
+	}
+	ipos_nr = n;
+}
+
 double pct_done(void)
 {
+	off_t cur = total_size;
+	int i;
+
+	if (streaming)
+		return 0.0;
+
+	for (i = 0; i < nheap; i++)
+		cur -= heap[i]->size - heap[i]->cur;
+
 	return 100.0 * ((double)cur / (double)total_size);
 }
@@ -18,40 +18,131 @@
  *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  *
  */
+
+/*
+ * The devices and processes to report on (after -D and -e) are gathered
+ * once into a table of rows, with their names formatted. The report is
+ * then made up of pieces - one per table - that each only read the rows
+ * and their own data. With -j the pieces are formatted by worker threads,
+ * each into a buffer of its own, and written out in order; only a few
+ * pieces ahead of the one being written are formatted at any time.
+ */
 #include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
 #include "globals.h"
 
-static int base_y;
-
-typedef struct avg_info *ai_dip_t;
-ai_dip_t dip_q2q_dm_avg(struct d_info *dip) { return &dip->avgs.q2q_dm; }
-ai_dip_t dip_q2a_dm_avg(struct d_info *dip) { return &dip->avgs.q2a_dm; }
-ai_dip_t dip_q2c_dm_avg(struct d_info *dip) { return &dip->avgs.q2c_dm; }
-
-ai_dip_t dip_q2q_avg(struct d_info *dip) { return &dip->avgs.q2q; }
-ai_dip_t dip_q2c_avg(struct d_info *dip) { return &dip->avgs.q2c; }
-ai_dip_t dip_q2a_avg(struct d_info *dip) { return &dip->avgs.q2a; }
-ai_dip_t dip_q2g_avg(struct d_info *dip) { return &dip->avgs.q2g; }
-ai_dip_t dip_s2g_avg(struct d_info *dip) { return &dip->avgs.s2g; }
-ai_dip_t dip_g2i_avg(struct d_info *dip) { return &dip->avgs.g2i; }
-ai_dip_t dip_q2m_avg(struct d_info *dip) { return &dip->avgs.q2m; }
-ai_dip_t dip_i2d_avg(struct d_info *dip) { return &dip->avgs.i2d; }
-ai_dip_t dip_d2c_avg(struct d_info *dip) { return &dip->avgs.d2c; }
-
-typedef struct avg_info *ai_pip_t;
-ai_pip_t pip_q2q_dm_avg(struct p_info *pip) { return &pip->avgs.q2q_dm; }
-ai_pip_t pip_q2a_dm_avg(struct p_info *pip) { return &pip->avgs.q2a_dm; }
-ai_pip_t pip_q2c_dm_avg(struct p_info *pip) { return &pip->avgs.q2c_dm; }
-
-ai_pip_t pip_q2q_avg(struct p_info *pip) { return &pip->avgs.q2q; }
-ai_pip_t pip_q2c_avg(struct p_info *pip) { return &pip->avgs.q2c; }
-ai_pip_t pip_q2a_avg(struct p_info *pip) { return &pip->avgs.q2a; }
-ai_pip_t pip_q2g_avg(struct p_info *pip) { return &pip->avgs.q2g; }
-ai_pip_t pip_s2g_avg(struct p_info *pip) { return &pip->avgs.s2g; }
-ai_pip_t pip_g2i_avg(struct p_info *pip) { return &pip->avgs.g2i; }
-ai_pip_t pip_q2m_avg(struct p_info *pip) { return &pip->avgs.q2m; }
-ai_pip_t pip_i2d_avg(struct p_info *pip) { return &pip->avgs.i2d; }
-ai_pip_t pip_d2c_avg(struct p_info *pip) { return &pip->avgs.d2c; }
+#define OPIECE_AHEAD	2	/* pieces formatted ahead, per thread */
+
+struct orow {
+	struct d_info *dip;
+	struct p_info *pip;
+	struct avgs_info *avgs;
+	char hdr[15];
+};
+
+struct otable {
+	struct orow *devs, *procs;
+	int ndevs, nprocs;
+};
+
+struct opiece {
+	void (*func)(struct opiece *);
+	char *sect;		/* section header to start with */
+	char *hdr;		/* per-metric tables: the metric */
+	size_t off;		/*   and where it is in avgs_info */
+	int nl;			/* followed by a blank line */
+	void *arg;
+
+	FILE *ofp, *xofp;
+	char *buf, *xbuf;
+	size_t len, xlen;
+	int done;
+};
+
+struct opieces {
+	struct opiece *pieces;
+	int n, next, written, ahead;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+static struct otable otbl;
+static int otbl_ok;
+
+static struct {
+	char *hdr;
+	size_t off;
+} avg_tables[] = {
+	{ "Q2Qdm", offsetof(struct avgs_info, q2q_dm) },
+	{ "Q2Adm", offsetof(struct avgs_info, q2a_dm) },
+	{ "Q2Cdm", offsetof(struct avgs_info, q2c_dm) },
+	{ NULL, 0 },
+	{ "Q2Q", offsetof(struct avgs_info, q2q) },
+	{ "Q2A", offsetof(struct avgs_info, q2a) },
+	{ "Q2G", offsetof(struct avgs_info, q2g) },
+	{ "S2G", offsetof(struct avgs_info, s2g) },
+	{ "G2I", offsetof(struct avgs_info, g2i) },
+	{ "Q2M", offsetof(struct avgs_info, q2m) },
+	{ "I2D", offsetof(struct avgs_info, i2d) },
+	{ "D2C", offsetof(struct avgs_info, d2c) },
+	{ "Q2C", offsetof(struct avgs_info, q2c) },
+};
+#define N_AVG_TABLES	(sizeof(avg_tables) / sizeof(avg_tables[0]))
+
+static struct orow *orow_add(struct orow **rows, int *nr)
+{
+	struct orow *rp;
+
+	if (*nr == 0 || !(*nr & (*nr - 1)))
+		*rows = realloc(*rows, (*nr ? 2 * *nr : 1) * sizeof(**rows));
+	rp = &(*rows)[(*nr)++];
+	memset(rp, 0, sizeof(*rp));
+	return rp;
+}
+
+/*
+ * The few fix-ups the report makes to the devices are done here, once,
+ * before any piece reads them
+ */
+static void __otbl_dev(struct d_info *dip, __attribute__((__unused__)) void *arg)
+{
+	struct orow *rp;
+
+	if (dip == NULL)	/* -D names a device not in the trace */
+		return;
+
+	if (dip->n_qs && dip->n_ds && dip->n_qs < dip->n_ds)
+		dip->n_qs = dip->n_ds;
+	if (dip->is_plugged)
+		dip_unplug(dip->device, dip->end_time, 0);
+
+	rp = orow_add(&otbl.devs, &otbl.ndevs);
+	rp->dip = dip;
+	rp->avgs = &dip->avgs;
+	make_dev_hdr(rp->hdr, sizeof(rp->hdr), dip, 1);
+}
+
+static void __otbl_proc(struct p_info *pip, __attribute__((__unused__)) void *arg)
+{
+	struct orow *rp = orow_add(&otbl.procs, &otbl.nprocs);
+
+	rp->pip = pip;
+	rp->avgs = &pip->avgs;
+	snprintf(rp->hdr, sizeof(rp->hdr), "%s", pip->name);
+}
+
+static void otbl_init(void)
+{
+	if (otbl_ok)
+		return;
+
+	dip_foreach_out(__otbl_dev, NULL);
+	pip_foreach_out(__otbl_proc, NULL);
+	add_buf(otbl.devs);
+	add_buf(otbl.procs);
+	otbl_ok = 1;
+}
 
 void output_section_hdr(FILE *ofp, char *hdr)
 {
@@ -62,120 +153,150 @@ void output_section_hdr(FILE *ofp, char *hdr)
 
 void output_hdr(FILE *ofp, char *hdr)
 {
-	fprintf(ofp, "%15s %13s %13s %13s %11s\n",
+	int i;
+
+	fprintf(ofp, "%15s %13s %13s %13s %11s",
 	        hdr, "MIN", "AVG", "MAX", "N" );
-	fprintf(ofp, "--------------- ------------- ------------- ------------- -----------\n");
+	for (i = 0; i < n_pcts; i++) {
+		char name[16];
+
+		snprintf(name, sizeof(name), "P%g", pcts[i]);
+		fprintf(ofp, " %13s", name);
+	}
+	fprintf(ofp, "\n");
+
+	fprintf(ofp, "--------------- ------------- ------------- ------------- -----------");
+	for (i = 0; i < n_pcts; i++)
+		fprintf(ofp, " -------------");
+	fprintf(ofp, "\n");
 }
 
-void __output_avg(FILE *ofp, char *hdr, struct avg_info *ap, int do_easy)
+/*
+ * xofp: where the easy-parse (-X) line goes too, if anywhere
+ */
+void __output_avg(FILE *ofp, char *hdr, struct avg_info *ap, FILE *xofp)
 {
+	int i;
+
 	if (ap->n > 0) {
 		ap->avg = BIT_TIME(ap->total) / (double)ap->n;
-		fprintf(ofp, "%-15s %13.9f %13.9f %13.9f %11d\n", hdr,
+		fprintf(ofp, "%-15s %13.9f %13.9f %13.9f %11d", hdr,
 			BIT_TIME(ap->min), ap->avg, BIT_TIME(ap->max), ap->n);
+		for (i = 0; i < n_pcts; i++)
+			fprintf(ofp, " %13.9f", BIT_TIME(lh_pct(ap, pcts[i])));
+		fprintf(ofp, "\n");
 
-		if (do_easy && easy_parse_avgs) {
-			fprintf(xavgs_ofp,
-				"%s %.9lf %.9lf %.9lf %d\n",
+		if (xofp) {
+			fprintf(xofp,
+				"%s %.9lf %.9lf %.9lf %d",
 				hdr, BIT_TIME(ap->min), ap->avg,
 						BIT_TIME(ap->max), ap->n);
+			for (i = 0; i < n_pcts; i++)
+				fprintf(xofp, " %.9lf",
+					BIT_TIME(lh_pct(ap, pcts[i])));
+			fprintf(xofp, "\n");
 		}
 	}
 }
 
-static inline char *avg2string(struct avg_info *ap, char *string)
+static void output_avg_table(struct opiece *op, struct orow *rows, int nr)
 {
-	if (ap->n > 0)
-		sprintf(string, "%13.9f", ap->avg);
-	else
-		sprintf(string, " ");
-	return string;
+	int i;
+
+	output_hdr(op->ofp, op->hdr);
+	for (i = 0; i < nr; i++) {
+		struct avg_info *ap = (void *)((char *)rows[i].avgs + op->off);
+
+		if (ap->n > 0)
+			__output_avg(op->ofp, rows[i].hdr, ap, NULL);
+	}
+	fprintf(op->ofp, "\n");
 }
 
-struct __oda {
-	FILE *ofp;
-	ai_dip_t (*func)(struct d_info *);
-};
-void __output_dip_avg(struct d_info *dip, void *arg)
+static void output_dip_avg(struct opiece *op)
 {
-	struct __oda *odap = arg;
-	ai_dip_t ap = odap->func(dip);
-	if (ap->n > 0) {
-		char dev_info[15];
-		ap->avg = BIT_TIME(ap->total) / (double)ap->n;
-		__output_avg(odap->ofp, make_dev_hdr(dev_info, 15, dip, 1),
-				ap, 0);
-	}
+	output_avg_table(op, otbl.devs, otbl.ndevs);
 }
 
-void output_dip_avg(FILE *ofp, char *hdr, ai_dip_t (*func)(struct d_info *))
+static void output_pip_avg(struct opiece *op)
 {
-	struct __oda oda = { .ofp = ofp, .func = func};
-	output_hdr(ofp, hdr);
-	dip_foreach_out(__output_dip_avg, &oda);
-	fprintf(ofp, "\n");
+	output_avg_table(op, otbl.procs, otbl.nprocs);
 }
 
-struct __q2d {
-	FILE *ofp;
-	void *q2d_all;
-	int n;
-};
-void __output_q2d_histo(struct d_info *dip, void *arg)
+/*
+ * all_avgs is per thread: op->arg is the main thread's
+ */
+static void output_all_avgs(struct opiece *op)
 {
-	struct __q2d *q2dp = arg;
+	FILE *ofp = op->ofp, *xofp = op->xofp;
+	struct avgs_info *ap = op->arg;
 
-	if (q2d_ok(dip->q2d_priv)) {
-		char dev_info[15];
-		FILE *ofp = q2dp->ofp;
+	output_hdr(ofp, "ALL");
+	__output_avg(ofp, "Q2Qdm", &ap->q2q_dm, NULL);
+	__output_avg(ofp, "Q2Adm", &ap->q2a_dm, NULL);
+	__output_avg(ofp, "Q2Cdm", &ap->q2c_dm, NULL);
+	fprintf(ofp, "\n");
 
-		fprintf(q2dp->ofp, "%10s | ",
-					make_dev_hdr(dev_info, 15, dip, 1));
-		q2d_display(ofp, dip->q2d_priv);
-		q2d_acc(q2dp->q2d_all, dip->q2d_priv);
-		q2dp->n++;
-	}
+	__output_avg(ofp, "Q2Q", &ap->q2q, xofp);
+	__output_avg(ofp, "Q2A", &ap->q2a, xofp);
+	__output_avg(ofp, "Q2G", &ap->q2g, xofp);
+	__output_avg(ofp, "S2G", &ap->s2g, xofp);
+	__output_avg(ofp, "G2I", &ap->g2i, xofp);
+	__output_avg(ofp, "Q2M", &ap->q2m, xofp);
+	__output_avg(ofp, "I2D", &ap->i2d, xofp);
+	__output_avg(ofp, "M2D", &ap->m2d, xofp);
+	__output_avg(ofp, "D2C", &ap->d2c, xofp);
+	__output_avg(ofp, "Q2C", &ap->q2c, xofp);
+	fprintf(ofp, "\n");
 }
 
-void output_q2d_histo(FILE *ofp)
+static void output_q2d_histo(struct opiece *op)
 {
-	struct __q2d __q2d = {
-		.ofp = ofp,
-		.q2d_all = q2d_alloc(),
-		.n = 0
-	};
+	FILE *ofp = op->ofp;
+	void *q2d_all = q2d_alloc();
+	int i, n = 0;
 
 	fprintf(ofp, "%10s | ", "DEV");
 	q2d_display_header(ofp);
 	fprintf(ofp, "--------- | ");
 	q2d_display_dashes(ofp);
-	dip_foreach_out(__output_q2d_histo, &__q2d);
+	for (i = 0; i < otbl.ndevs; i++) {
+		struct orow *rp = &otbl.devs[i];
+
+		if (q2d_ok(rp->dip->q2d_priv)) {
+			fprintf(ofp, "%10s | ", rp->hdr);
+			q2d_display(ofp, rp->dip->q2d_priv);
+			q2d_acc(q2d_all, rp->dip->q2d_priv);
+			n++;
+		}
+	}
 
-	if (__q2d.n) {
+	if (n) {
 		fprintf(ofp, "========== | ");
 		q2d_display_dashes(ofp);
 		fprintf(ofp, "%10s | ", "AVG");
-		q2d_display(ofp, __q2d.q2d_all);
+		q2d_display(ofp, q2d_all);
 		fprintf(ofp, "\n");
 	}
 
-	q2d_free(__q2d.q2d_all);
+	q2d_free(q2d_all);
 }
 
-int n_merges = 0;
-struct {
+struct merge_info {
 	unsigned long long nq, nd, blkmin, blkmax, total;
-} merge_data;
-void __output_dip_merge_ratio(struct d_info *dip, void *arg)
+	int n;
+};
+
+static void __output_dip_merge_ratio(struct opiece *op, struct orow *rp,
+				     struct merge_info *mip)
 {
+	struct d_info *dip = rp->dip;
 	double blks_avg;
 	char dev_info[15];
 	double ratio, q2c_n, d2c_n;
 
 	if (dip->n_qs == 0 || dip->n_ds == 0)
 		return;
-	else if (dip->n_qs < dip->n_ds)
-		dip->n_qs = dip->n_ds;
 
 	q2c_n = dip->n_qs;
 	d2c_n = dip->n_ds;
@@ -185,9 +306,9 @@ void __output_dip_merge_ratio(struct d_info *dip, void *arg)
 		else
 			ratio = q2c_n / d2c_n;
 		blks_avg = (double)dip->avgs.blks.total / d2c_n;
-		fprintf((FILE *)arg,
+		fprintf(op->ofp,
 			"%10s | %8llu %8llu %7.1lf | %8llu %8llu %8llu %8llu\n",
-			make_dev_hdr(dev_info, 15, dip, 1),
+			rp->hdr,
 			(unsigned long long)dip->n_qs,
 			(unsigned long long)dip->n_ds,
 			ratio,
@@ -196,8 +317,8 @@ void __output_dip_merge_ratio(struct d_info *dip, void *arg)
 			(unsigned long long)dip->avgs.blks.max,
 			(unsigned long long)dip->avgs.blks.total);
 
-		if (easy_parse_avgs) {
-			fprintf(xavgs_ofp,
+		if (op->xofp) {
+			fprintf(op->xofp,
 				"DMI %s %llu %llu %.9lf %llu %llu %llu %llu\n",
 				make_dev_hdr(dev_info, 15, dip, 0),
 				(unsigned long long)dip->n_qs,
@@ -209,36 +330,42 @@ void __output_dip_merge_ratio(struct d_info *dip, void *arg)
 				(unsigned long long)dip->avgs.blks.total);
 		}
 
-		if (n_merges++ == 0) {
-			merge_data.blkmin = dip->avgs.blks.min;
-			merge_data.blkmax = dip->avgs.blks.max;
+		if (mip->n++ == 0) {
+			mip->blkmin = dip->avgs.blks.min;
+			mip->blkmax = dip->avgs.blks.max;
 		}
 
-		merge_data.nq += dip->n_qs;
-		merge_data.nd += dip->n_ds;
-		merge_data.total += dip->avgs.blks.total;
-		if (dip->avgs.blks.min < merge_data.blkmin)
-			merge_data.blkmin = dip->avgs.blks.min;
-		if (dip->avgs.blks.max > merge_data.blkmax)
-			merge_data.blkmax = dip->avgs.blks.max;
+		mip->nq += dip->n_qs;
+		mip->nd += dip->n_ds;
+		mip->total += dip->avgs.blks.total;
+		if (dip->avgs.blks.min < mip->blkmin)
+			mip->blkmin = dip->avgs.blks.min;
+		if (dip->avgs.blks.max > mip->blkmax)
+			mip->blkmax = dip->avgs.blks.max;
 	}
 }
 
-void output_dip_merge_ratio(FILE *ofp)
+static void output_dip_merge_ratio(struct opiece *op)
 {
+	FILE *ofp = op->ofp;
+	struct merge_info mi;
+	int i;
+
+	memset(&mi, 0, sizeof(mi));
 	fprintf(ofp, "%10s | %8s %8s %7s | %8s %8s %8s %8s\n", "DEV", "#Q", "#D", "Ratio", "BLKmin", "BLKavg", "BLKmax", "Total");
 	fprintf(ofp, "---------- | -------- -------- ------- | -------- -------- -------- --------\n");
-	dip_foreach_out(__output_dip_merge_ratio, ofp);
-	if (n_merges > 1) {
+	for (i = 0; i < otbl.ndevs; i++)
+		__output_dip_merge_ratio(op, &otbl.devs[i], &mi);
+	if (mi.n > 1) {
 		fprintf(ofp, "---------- | -------- -------- ------- | -------- -------- -------- --------\n");
 		fprintf(ofp, "%10s | %8s %8s %7s | %8s %8s %8s %8s\n", "DEV", "#Q", "#D", "Ratio", "BLKmin", "BLKavg", "BLKmax", "Total");
 		fprintf((FILE *)ofp,
 			"%10s | %8llu %8llu %7.1lf | %8llu %8llu %8llu %8llu\n",
-			"TOTAL", merge_data.nq, merge_data.nd,
-			(float)merge_data.nq / (float)merge_data.nd,
-			merge_data.blkmin,
-			merge_data.total / merge_data.nd,
-			merge_data.blkmax, merge_data.total);
+			"TOTAL", mi.nq, mi.nd,
+			(float)mi.nq / (float)mi.nd,
+			mi.blkmin,
+			mi.total / mi.nd,
+			mi.blkmax, mi.total);
 	}
 	fprintf(ofp, "\n");
 }
@@ -249,7 +376,6 @@ struct __ohead_data {
 };
 
 struct ohead_data {
-	FILE *ofp;
 	struct __ohead_data q2g, g2i, q2m, i2d, d2c, q2c;
 };
 
@@ -259,16 +385,17 @@ struct ohead_data {
 		(odp)-> fld .n     += dip->avgs. fld . n;		\
 	} while (0)
 
-void __output_dip_prep_ohead(struct d_info *dip, void *arg)
+static void __output_dip_prep_ohead(FILE *ofp, struct orow *rp,
+				    struct ohead_data *odp)
 {
+	struct d_info *dip = rp->dip;
+
 	if (dip->avgs.q2c.n > 0 && dip->avgs.q2c.total > 0) {
-		char dev_info[15];
-		struct ohead_data *odp = arg;
 		double q2c_total = (double)(dip->avgs.q2c.total);
 
-		fprintf(odp->ofp,
+		fprintf(ofp,
 			"%10s | %8.4lf%% %8.4lf%% %8.4lf%% %8.4lf%% %8.4lf%%\n",
-			make_dev_hdr(dev_info, 15, dip, 1),
+			rp->hdr,
 			100.0 * (double)(dip->avgs.q2g.total) / q2c_total,
 			100.0 * (double)(dip->avgs.g2i.total) / q2c_total,
 			100.0 * (double)(dip->avgs.q2m.total) / q2c_total,
@@ -288,18 +415,20 @@ void __output_dip_prep_ohead(struct d_info *dip, void *arg)
 	(od. fld .n == 0) ? (double)0.0 :				\
 		(100.0 * ((double)((od). fld . total) / q2c))
 
-void output_dip_prep_ohead(FILE *ofp)
+static void output_dip_prep_ohead(struct opiece *op)
 {
+	FILE *ofp = op->ofp;
 	double q2c;
 	struct ohead_data od;
+	int i;
 
 	memset(&od, 0, sizeof(od));
-	od.ofp = ofp;
 
 	fprintf(ofp, "%10s | %9s %9s %9s %9s %9s\n",
 				"DEV", "Q2G", "G2I", "Q2M", "I2D", "D2C");
 	fprintf(ofp, "---------- | --------- --------- --------- --------- ---------\n");
-	dip_foreach_out(__output_dip_prep_ohead, &od);
+	for (i = 0; i < otbl.ndevs; i++)
+		__output_dip_prep_ohead(ofp, &otbl.devs[i], &od);
 
 	if (od.q2g.n == 0 && od.g2i.n == 0 && od.q2m.n == 0 &&
 						od.i2d.n == 0 && od.d2c.n == 0)
@@ -317,18 +446,18 @@ out:
 }
 
 struct seek_mode_info {
-	struct seek_mode_info *next;
+	struct seek_mode_info *next, *alloc_next;
 	long long mode;
 	int nseeks;
 };
 struct o_seek_info {
 	long long nseeks, median;
 	double mean;
-	struct seek_mode_info *head;
-} seek_info;
-int n_seeks;
+	struct seek_mode_info *head, *allocs;
+	int n_seeks, approx, approx_err;
+};
 
-void output_seek_mode_info(FILE *ofp, struct o_seek_info *sip)
+static void output_seek_mode_info(FILE *ofp, struct o_seek_info *sip)
 {
 	struct seek_mode_info *p, *this, *new_list = NULL;
 
@@ -363,13 +492,13 @@ void output_seek_mode_info(FILE *ofp, struct o_seek_info *sip)
 	}
 }
 
-void add_seek_mode_info(struct o_seek_info *sip, struct mode *mp)
+static void add_seek_mode_info(struct o_seek_info *sip, struct mode *mp)
 {
 	int i;
 	long long *lp = mp->modes;
 	struct seek_mode_info *smip;
 
-	n_seeks++;
+	sip->n_seeks++;
 	for (i = 0; i < mp->nmds; i++, lp++) {
 		for (smip = sip->head; smip; smip = smip->next) {
 			if (smip->mode == *lp) {
@@ -385,13 +514,17 @@ void add_seek_mode_info(struct o_seek_info *sip, struct mode *mp)
 			new->mode = *lp;
 			new->nseeks = mp->most_seeks;
 
-			add_buf(new);
+			new->alloc_next = sip->allocs;
+			sip->allocs = new;
 		}
 	}
 }
 
-static void do_output_dip_seek_info(struct d_info *dip, FILE *ofp, int is_q2q)
+static void do_output_dip_seek_info(struct opiece *op, struct orow *rp,
+				    struct o_seek_info *sip, int is_q2q)
 {
+	FILE *ofp = op->ofp;
+	struct d_info *dip = rp->dip;
 	double mean;
 	int i, nmodes;
 	long long nseeks;
@@ -407,7 +540,7 @@ static void do_output_dip_seek_info(struct d_info *dip, FILE *ofp, int is_q2q)
 		nmodes = seeki_mode(handle, &m);
 
 		fprintf(ofp, "%10s | %15lld %15.1lf %15lld | %lld(%d)",
-			make_dev_hdr(dev_info, 15, dip, 1), nseeks, mean,
+			rp->hdr, nseeks, mean,
 			median, nmodes > 0 ? m.modes[0] : 0, m.most_seeks);
 		if (nmodes > 2)
 			fprintf(ofp, "\n%10s   %15s %15s %15s   ...(%d more)\n", "", "", "", "", nmodes-1);
@@ -417,191 +550,163 @@ static void do_output_dip_seek_info(struct d_info *dip, FILE *ofp, int is_q2q)
 			fprintf(ofp, "\n");
 		}
 
-		if (easy_parse_avgs) {
+		if (op->xofp) {
 			char *rec = is_q2q ? "QSK" : "DSK";
-			fprintf(xavgs_ofp,
+			fprintf(op->xofp,
 				"%s %s %lld %.9lf %lld %lld %d",
 				rec, make_dev_hdr(dev_info, 15, dip, 0),
 				nseeks, mean, median,
 				nmodes > 0 ? m.modes[0] : 0, m.most_seeks);
 				for (i = 1; i < nmodes; i++)
-					fprintf(xavgs_ofp, " %lld", m.modes[i]);
-				fprintf(xavgs_ofp, "\n");
+					fprintf(op->xofp, " %lld", m.modes[i]);
+				fprintf(op->xofp, "\n");
 		}
 
-		seek_info.nseeks += nseeks;
-		seek_info.mean += (nseeks * mean);
-		seek_info.median += (nseeks * median);
-		add_seek_mode_info(&seek_info, &m);
+		if (seeki_approx(handle)) {
+			sip->approx = 1;
+			if (m.err > sip->approx_err)
+				sip->approx_err = m.err;
+		}
+
+		sip->nseeks += nseeks;
+		sip->mean += (nseeks * mean);
+		sip->median += (nseeks * median);
+		add_seek_mode_info(sip, &m);
 		free(m.modes);
 	}
 }
 
-void __output_dip_seek_info(struct d_info *dip, void *arg)
-{
-	do_output_dip_seek_info(dip, (FILE *)arg, 0);
-}
-
-void __output_dip_q2q_seek_info(struct d_info *dip, void *arg)
+static void __output_dip_seek_info(struct opiece *op, int is_q2q)
 {
-	do_output_dip_seek_info(dip, (FILE *)arg, 1);
-}
+	FILE *ofp = op->ofp;
+	struct o_seek_info si;
+	struct seek_mode_info *smip;
+	int i;
 
-void output_dip_seek_info(FILE *ofp)
-{
-	n_seeks = 1;
-	memset(&seek_info, 0, sizeof(seek_info));
+	memset(&si, 0, sizeof(si));
+	si.n_seeks = 1;
 
 	fprintf(ofp, "%10s | %15s %15s %15s | %-15s\n", "DEV", "NSEEKS",
 			"MEAN", "MEDIAN", "MODE");
 	fprintf(ofp, "---------- | --------------- --------------- --------------- | ---------------\n");
-	dip_foreach_out(__output_dip_seek_info, ofp);
-	if (n_seeks > 1) {
+	for (i = 0; i < otbl.ndevs; i++)
+		do_output_dip_seek_info(op, &otbl.devs[i], &si, is_q2q);
+	if (si.n_seeks > 1) {
 		fprintf(ofp, "---------- | --------------- --------------- --------------- | ---------------\n");
 		fprintf(ofp, "%10s | %15s %15s %15s | %-15s\n",
 		        "Overall", "NSEEKS", "MEAN", "MEDIAN", "MODE");
-		output_seek_mode_info(ofp, &seek_info);
+		output_seek_mode_info(ofp, &si);
 		fprintf(ofp, "\n");
 	}
+	if (si.approx && si.approx_err)
+		fprintf(ofp, "(median within 1.6%%, mode counts may be low "
+			     "by up to %d; see -E)\n", si.approx_err);
+	else if (si.approx)
+		fprintf(ofp, "(median within 1.6%%; see -E)\n");
 	fprintf(ofp, "\n");
-}
-
-void output_dip_q2q_seek_info(FILE *ofp)
-{
-	n_seeks = 1;
-	memset(&seek_info, 0, sizeof(seek_info));
 
-	fprintf(ofp, "%10s | %15s %15s %15s | %-15s\n", "DEV", "NSEEKS",
-			"MEAN", "MEDIAN", "MODE");
-	fprintf(ofp, "---------- | --------------- --------------- --------------- | ---------------\n");
-	dip_foreach_out(__output_dip_q2q_seek_info, ofp);
-	if (n_seeks > 1) {
-		fprintf(ofp, "---------- | --------------- --------------- --------------- | ---------------\n");
-		fprintf(ofp, "%10s | %15s %15s %15s | %-15s\n",
-		        "Overall", "NSEEKS", "MEAN", "MEDIAN", "MODE");
-		output_seek_mode_info(ofp, &seek_info);
-		fprintf(ofp, "\n");
+	while ((smip = si.allocs) != NULL) {
+		si.allocs = smip->alloc_next;
+		free(smip);
 	}
-	fprintf(ofp, "\n");
 }
 
-struct __opa {
-	FILE *ofp;
-	ai_pip_t (*func)(struct p_info *);
-};
-
-void __output_pip_avg(struct p_info *pip, void *arg)
+static void output_dip_seek_info(struct opiece *op)
 {
-	struct __opa *opap = arg;
-	ai_pip_t ap = opap->func(pip);
-
-	if (ap->n > 0) {
-		char proc_name[15];
-		snprintf(proc_name, 15, "%s", pip->name);
-
-		ap->avg = BIT_TIME(ap->total) / (double)ap->n;
-		__output_avg(opap->ofp, proc_name, ap, 0);
-	}
+	__output_dip_seek_info(op, 0);
 }
 
-void output_pip_avg(FILE *ofp, char *hdr, ai_pip_t (*func)(struct p_info *))
+static void output_dip_q2q_seek_info(struct opiece *op)
 {
-	struct __opa opa = { .ofp = ofp, .func = func };
-
-	output_hdr(ofp, hdr);
-	pip_foreach_out(__output_pip_avg, &opa);
-	fprintf(ofp, "\n");
+	__output_dip_seek_info(op, 1);
 }
 
-int n_plugs;
 struct plug_info {
 	long n_plugs, n_unplugs_t;
 	double t_percent;
-} plug_info;
+	int n;
+
+	__u64 n_nios_uplugs, n_nios_uplugs_t;
+	__u64 tot_nios_up, tot_nios_up_t;
+};
 
-void __dip_output_plug(struct d_info *dip, void *arg)
+static void __dip_output_plug(struct opiece *op, struct orow *rp,
+			      struct plug_info *pp)
 {
+	struct d_info *dip = rp->dip;
 	char dev_info[15];
-	FILE *ofp = arg;
 	double delta, pct;
 
-	if (dip->is_plugged)
-		dip_unplug(dip->device, dip->end_time, 0);
 	if ((dip->nplugs + dip->nplugs_t) > 0) {
 		delta = dip->end_time - dip->start_time;
 		pct = 100.0 * (dip->plugged_time / delta);
 
-		fprintf(ofp, "%10s | %10d(%10d) | %13.9lf%%\n",
-			make_dev_hdr(dev_info, 15, dip, 1),
-			dip->nplugs, dip->nplugs_t, pct);
+		fprintf(op->ofp, "%10s | %10d(%10d) | %13.9lf%%\n",
+			rp->hdr, dip->nplugs, dip->nplugs_t, pct);
 
-		if (easy_parse_avgs) {
-			fprintf(xavgs_ofp,
+		if (op->xofp) {
+			fprintf(op->xofp,
 				"PLG %s %d %d %.9lf\n",
 				make_dev_hdr(dev_info, 15, dip, 0),
 				dip->nplugs, dip->nplugs_t, pct);
 		}
 
-		n_plugs++;
-		plug_info.n_plugs += dip->nplugs;
-		plug_info.n_unplugs_t += dip->nplugs_t;
-		plug_info.t_percent += pct;
+		pp->n++;
+		pp->n_plugs += dip->nplugs;
+		pp->n_unplugs_t += dip->nplugs_t;
+		pp->t_percent += pct;
 	}
 }
 
-void __dip_output_plug_all(FILE *ofp, struct plug_info *p)
+static void __dip_output_plug_all(FILE *ofp, struct plug_info *p)
 {
 	fprintf(ofp, "---------- | ---------- ----------  | ----------------\n");
 	fprintf(ofp, "%10s | %10s %10s  | %s\n",
 	        "Overall", "# Plugs", "# Timer Us", "% Time Q Plugged");
 	fprintf(ofp, "%10s | %10ld(%10ld) | %13.9lf%%\n", "Average",
-	        p->n_plugs / n_plugs, p->n_unplugs_t / n_plugs,
-		p->t_percent / n_plugs);
+	        p->n_plugs / p->n, p->n_unplugs_t / p->n,
+		p->t_percent / p->n);
 
 }
 
-__u64 n_nios_uplugs, n_nios_uplugs_t;
-struct nios_plug_info {
-	__u64 tot_nios_up, tot_nios_up_t;
-} nios_plug_info;
-
-void __dip_output_plug_nios(struct d_info *dip, void *arg)
+static void __dip_output_plug_nios(struct opiece *op, struct orow *rp,
+				   struct plug_info *pp)
 {
+	struct d_info *dip = rp->dip;
 	char dev_info[15];
-	FILE *ofp = arg;
 	double a_nios_uplug = 0.0, a_nios_uplug_t = 0.0;
 
 	if (dip->nios_up && dip->nplugs) {
 		a_nios_uplug = (double)dip->nios_up / (double)dip->nplugs;
-		n_nios_uplugs += dip->nplugs;
-		nios_plug_info.tot_nios_up += dip->nios_up;
+		pp->n_nios_uplugs += dip->nplugs;
+		pp->tot_nios_up += dip->nios_up;
 	}
 	if (dip->nios_upt && dip->nplugs_t) {
 		a_nios_uplug_t = (double)dip->nios_upt / (double)dip->nplugs_t;
-		n_nios_uplugs_t += dip->nplugs_t;
-		nios_plug_info.tot_nios_up_t += dip->nios_upt;
+		pp->n_nios_uplugs_t += dip->nplugs_t;
+		pp->tot_nios_up_t += dip->nios_upt;
 	}
 
-	fprintf(ofp, "%10s | %10.1lf   %10.1lf\n",
-		make_dev_hdr(dev_info, 15, dip, 1),
-		a_nios_uplug, a_nios_uplug_t);
+	fprintf(op->ofp, "%10s | %10.1lf   %10.1lf\n",
+		rp->hdr, a_nios_uplug, a_nios_uplug_t);
 
-	if (easy_parse_avgs) {
-		fprintf(xavgs_ofp,
+	if (op->xofp) {
+		fprintf(op->xofp,
 			"UPG %s %.9lf %.9lf\n",
 			make_dev_hdr(dev_info, 15, dip, 0),
 			a_nios_uplug, a_nios_uplug_t);
 	}
 }
 
-void __dip_output_uplug_all(FILE *ofp, struct nios_plug_info *p)
+static void __dip_output_uplug_all(FILE *ofp, struct plug_info *p)
 {
 	double ios_unp = 0.0, ios_unp_to = 0.0;
 
-	if (n_nios_uplugs)
-		ios_unp = (double)p->tot_nios_up / (double)n_nios_uplugs;
-	if (n_nios_uplugs_t)
-		ios_unp_to = (double)p->tot_nios_up_t / (double)n_nios_uplugs_t;
+	if (p->n_nios_uplugs)
+		ios_unp = (double)p->tot_nios_up / (double)p->n_nios_uplugs;
+	if (p->n_nios_uplugs_t)
+		ios_unp_to = (double)p->tot_nios_up_t /
+						(double)p->n_nios_uplugs_t;
 
 	fprintf(ofp, "---------- | ----------   ----------\n");
 	fprintf(ofp, "%10s | %10s   %10s\n",
@@ -610,53 +715,62 @@ void __dip_output_uplug_all(FILE *ofp, struct nios_plug_info *p)
 		"Average", ios_unp, ios_unp_to);
 }
 
-void output_plug_info(FILE *ofp)
+static void output_plug_info(struct opiece *op)
 {
+	FILE *ofp = op->ofp;
+	struct plug_info pi;
+	int i;
+
+	memset(&pi, 0, sizeof(pi));
 	fprintf(ofp, "%10s | %10s %10s  | %s\n",
 	        "DEV", "# Plugs", "# Timer Us", "% Time Q Plugged");
 	fprintf(ofp, "---------- | ---------- ----------  | ----------------\n");
-	dip_foreach_out(__dip_output_plug, ofp);
-	if (n_plugs > 1)
-		__dip_output_plug_all(ofp, &plug_info);
+	for (i = 0; i < otbl.ndevs; i++)
+		__dip_output_plug(op, &otbl.devs[i], &pi);
+	if (pi.n > 1)
+		__dip_output_plug_all(ofp, &pi);
 	fprintf(ofp, "\n");
 
 	fprintf(ofp, "%10s | %10s   %10s\n",
 		"DEV", "IOs/Unp", "IOs/Unp(to)");
 	fprintf(ofp, "---------- | ----------   ----------\n");
-	dip_foreach_out(__dip_output_plug_nios, ofp);
-	if (n_nios_uplugs || n_nios_uplugs_t)
-		__dip_output_uplug_all(ofp, &nios_plug_info);
+	for (i = 0; i < otbl.ndevs; i++)
+		__dip_output_plug_nios(op, &otbl.devs[i], &pi);
+	if (pi.n_nios_uplugs || pi.n_nios_uplugs_t)
+		__dip_output_uplug_all(ofp, &pi);
 	fprintf(ofp, "\n");
 }
 
-int n_actQs;
 struct actQ_info {
 	__u64 t_qs;
 	__u64 t_act_qs;
-} actQ_info;
+	int n;
+};
 
-void __dip_output_actQ(struct d_info *dip, void *arg)
+static void __dip_output_actQ(struct opiece *op, struct orow *rp,
+			      struct actQ_info *ap)
 {
+	struct d_info *dip = rp->dip;
+
 	if (dip->n_qs > 0 && !remapper_dev(dip->device)) {
 		char dev_info[15];
 		double a_actQs = (double)dip->t_act_q / (double)dip->n_qs;
 
-		fprintf((FILE *)arg, "%10s | %13.1lf\n",
-			make_dev_hdr(dev_info, 15, dip, 1), a_actQs);
+		fprintf(op->ofp, "%10s | %13.1lf\n", rp->hdr, a_actQs);
 
-		if (easy_parse_avgs) {
-			fprintf(xavgs_ofp,
+		if (op->xofp) {
+			fprintf(op->xofp,
 				"ARQ %s %.9lf\n",
 				make_dev_hdr(dev_info, 15, dip, 0), a_actQs);
 		}
 
-		n_actQs++;
-		actQ_info.t_qs += dip->n_qs;
-		actQ_info.t_act_qs += dip->t_act_q;
+		ap->n++;
+		ap->t_qs += dip->n_qs;
+		ap->t_act_qs += dip->t_act_q;
 	}
 }
 
-void __dip_output_actQ_all(FILE *ofp, struct actQ_info *p)
+static void __dip_output_actQ_all(FILE *ofp, struct actQ_info *p)
 {
 	fprintf(ofp, "---------- | -------------\n");
 	fprintf(ofp, "%10s | %13s\n", "Overall", "Avgs Reqs @ Q");
@@ -664,44 +778,227 @@ void __dip_output_actQ_all(FILE *ofp, struct actQ_info *p)
 		(double)p->t_act_qs / (double)p->t_qs);
 }
 
-void output_actQ_info(FILE *ofp)
+static void output_actQ_info(struct opiece *op)
 {
+	FILE *ofp = op->ofp;
+	struct actQ_info ai;
+	int i;
+
+	memset(&ai, 0, sizeof(ai));
 	fprintf(ofp, "%10s | %13s\n", "DEV", "Avg Reqs @ Q");
 	fprintf(ofp, "---------- | -------------\n");
-	dip_foreach_out(__dip_output_actQ, ofp);
-	if (n_actQs > 1)
-		__dip_output_actQ_all(ofp, &actQ_info);
+	for (i = 0; i < otbl.ndevs; i++)
+		__dip_output_actQ(op, &otbl.devs[i], &ai);
+	if (ai.n > 1)
+		__dip_output_actQ_all(ofp, &ai);
 	fprintf(ofp, "\n");
 }
 
-void __dip_output_p_live(struct d_info *dip, void *arg)
+static void __dip_output_culled(struct opiece *op, struct orow *rp)
 {
-	char dev_info[15];
-	FILE *ofp = arg;
-	char *ttl = dip ? make_dev_hdr(dev_info, 15, dip, 1) : "Total Sys";
-	struct p_live_info *plip = p_live_get(dip, base_y);
+	struct d_info *dip = rp->dip;
+
+	if (dip->n_culled > 0) {
+		char dev_info[15];
+
+		fprintf(op->ofp, "%10s | %10llu %10llu\n", rp->hdr,
+			(unsigned long long)dip->n_culled,
+			(unsigned long long)dip->n_culled_q);
+
+		if (op->xofp) {
+			fprintf(op->xofp, "CUL %s %llu %llu\n",
+				make_dev_hdr(dev_info, 15, dip, 0),
+				(unsigned long long)dip->n_culled,
+				(unsigned long long)dip->n_culled_q);
+		}
+	}
+}
+
+/*
+ * Outstanding IOs dropped by the cull horizon (-C)
+ */
+static void output_culled(struct opiece *op)
+{
+	FILE *ofp = op->ofp;
+	int i;
+
+	fprintf(ofp, "%10s | %10s %10s\n", "DEV", "# Culled", "# Qs");
+	fprintf(ofp, "---------- | ---------- ----------\n");
+	for (i = 0; i < otbl.ndevs; i++)
+		__dip_output_culled(op, &otbl.devs[i]);
+	fprintf(ofp, "---------- | ---------- ----------\n");
+	fprintf(ofp, "%10s | %10lu\n", "Total", n_culled);
+	fprintf(ofp, "\n");
+}
+
+static void __dip_output_p_live(FILE *ofp, struct orow *rp, int *base_y)
+{
+	char *ttl = rp ? rp->hdr : "Total Sys";
+	struct p_live_info *plip = p_live_get(rp ? rp->dip : NULL, *base_y);
 
 	fprintf(ofp, "%10s | %10lu %13.9lf %13.9lf %6.2lf\n", ttl,
 		plip->nlives, plip->avg_live, plip->avg_lull, plip->p_live);
 	if (plip->nlives)
-		base_y += 1;
+		*base_y += 1;
 }
 
-void output_p_live(FILE *ofp)
+static void output_p_live(struct opiece *op)
 {
+	FILE *ofp = op->ofp;
+	int i, base_y;
+
 	fprintf(ofp, "%10s | %10s %13s %13s %6s\n", "DEV",
 		"# Live", "Avg. Act", "Avg. !Act", "% Live");
 	fprintf(ofp, "---------- | ---------- "
 		     "------------- ------------- ------\n");
 	base_y = 1;
-	dip_foreach_out(__dip_output_p_live, ofp);
+	for (i = 0; i < otbl.ndevs; i++)
+		__dip_output_p_live(ofp, &otbl.devs[i], &base_y);
 	fprintf(ofp, "---------- | ---------- "
 		     "------------- ------------- ------\n");
 	base_y = 0;
-	__dip_output_p_live(NULL, ofp);
+	__dip_output_p_live(ofp, NULL, &base_y);
 	fprintf(ofp, "\n");
 }
 
+static void output_stacks_piece(struct opiece *op)
+{
+	int i;
+
+	for (i = 0; i < otbl.ndevs; i++)
+		output_stacks(op->ofp, otbl.devs[i].dip);
+}
+
+
+static struct opiece *opiece_add(struct opieces *ops, char *sect,
+				 void (*func)(struct opiece *))
+{
+	struct opiece *op;
+
+	if (ops->n == 0 || !(ops->n & (ops->n - 1)))
+		ops->pieces = realloc(ops->pieces,
+				      (ops->n ? 2 * ops->n : 1) * sizeof(*op));
+	op = &ops->pieces[ops->n++];
+	memset(op, 0, sizeof(*op));
+	op->sect = sect;
+	op->func = func;
+	return op;
+}
+
+static void opiece_add_avgs(struct opieces *ops, char *sect,
+			    void (*func)(struct opiece *))
+{
+	unsigned int i;
+	struct opiece *op = NULL;
+
+	for (i = 0; i < N_AVG_TABLES; i++) {
+		if (avg_tables[i].hdr == NULL) {
+			op->nl = 1;
+			continue;
+		}
+		op = opiece_add(ops, i == 0 ? sect : NULL, func);
+		op->hdr = avg_tables[i].hdr;
+		op->off = avg_tables[i].off;
+	}
+}
+
+static void opiece_run(struct opiece *op)
+{
+	if (op->sect)
+		output_section_hdr(op->ofp, op->sect);
+	op->func(op);
+	if (op->nl)
+		fprintf(op->ofp, "\n");
+}
+
+static void *opiece_thread(void *arg)
+{
+	struct opieces *ops = arg;
+	struct opiece *op;
+
+	pthread_mutex_lock(&ops->lock);
+	while (ops->next < ops->n) {
+		if (ops->next >= ops->written + ops->ahead) {
+			pthread_cond_wait(&ops->cond, &ops->lock);
+			continue;
+		}
+		op = &ops->pieces[ops->next++];
+		pthread_mutex_unlock(&ops->lock);
+
+		op->ofp = open_memstream(&op->buf, &op->len);
+		if (easy_parse_avgs)
+			op->xofp = open_memstream(&op->xbuf, &op->xlen);
+		if (!op->ofp || (easy_parse_avgs && !op->xofp)) {
+			perror("open_memstream");
+			exit(1);
+		}
+		opiece_run(op);
+		fclose(op->ofp);
+		if (op->xofp)
+			fclose(op->xofp);
+
+		pthread_mutex_lock(&ops->lock);
+		op->done = 1;
+		pthread_cond_broadcast(&ops->cond);
+	}
+	pthread_mutex_unlock(&ops->lock);
+
+	return NULL;
+}
+
+static void opieces_run(struct opieces *ops, FILE *ofp)
+{
+	int i, nthreads = n_shards < ops->n ? n_shards : ops->n;
+	pthread_t *tids;
+
+	if (nthreads <= 1) {
+		for (i = 0; i < ops->n; i++) {
+			ops->pieces[i].ofp = ofp;
+			ops->pieces[i].xofp = easy_parse_avgs ? xavgs_ofp : NULL;
+			opiece_run(&ops->pieces[i]);
+		}
+		return;
+	}
+
+	ops->ahead = OPIECE_AHEAD * nthreads;
+	pthread_mutex_init(&ops->lock, NULL);
+	pthread_cond_init(&ops->cond, NULL);
+
+	tids = malloc(nthreads * sizeof(*tids));
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&tids[i], NULL, opiece_thread, ops)) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+
+	for (i = 0; i < ops->n; i++) {
+		struct opiece *op = &ops->pieces[i];
+
+		pthread_mutex_lock(&ops->lock);
+		while (!op->done)
+			pthread_cond_wait(&ops->cond, &ops->lock);
+		pthread_mutex_unlock(&ops->lock);
+
+		fwrite(op->buf, 1, op->len, ofp);
+		if (op->xlen)
+			fwrite(op->xbuf, 1, op->xlen, xavgs_ofp);
+		free(op->buf);
+		free(op->xbuf);
+
+		pthread_mutex_lock(&ops->lock);
+		ops->written++;
+		pthread_cond_broadcast(&ops->cond);
+		pthread_mutex_unlock(&ops->lock);
+	}
+
+	for (i = 0; i < nthreads; i++)
+		pthread_join(tids[i], NULL);
+	free(tids);
+	pthread_cond_destroy(&ops->cond);
+	pthread_mutex_destroy(&ops->lock);
+}
+
 void output_histos(void)
 {
 	int i;
@@ -739,103 +1036,50 @@ void output_histos(void)
 	fclose(ofp);
 }
 
+
 int output_avgs(FILE *ofp)
 {
-	if (output_all_data) {
-		if (exes == NULL || *exes != '\0') {
-			output_section_hdr(ofp, "Per Process");
-			output_pip_avg(ofp, "Q2Qdm", pip_q2q_dm_avg);
-			output_pip_avg(ofp, "Q2Adm", pip_q2a_dm_avg);
-			output_pip_avg(ofp, "Q2Cdm", pip_q2c_dm_avg);
-			fprintf(ofp, "\n");
+	struct opieces ops;
 
-			output_pip_avg(ofp, "Q2Q", pip_q2q_avg);
-			output_pip_avg(ofp, "Q2A", pip_q2a_avg);
-			output_pip_avg(ofp, "Q2G", pip_q2g_avg);
-			output_pip_avg(ofp, "S2G", pip_s2g_avg);
-			output_pip_avg(ofp, "G2I", pip_g2i_avg);
-			output_pip_avg(ofp, "Q2M", pip_q2m_avg);
-			output_pip_avg(ofp, "I2D", pip_i2d_avg);
-			output_pip_avg(ofp, "D2C", pip_d2c_avg);
-			output_pip_avg(ofp, "Q2C", pip_q2c_avg);
-		}
+	otbl_init();
+	memset(&ops, 0, sizeof(ops));
 
-		output_section_hdr(ofp, "Per Device");
-		output_dip_avg(ofp, "Q2Qdm", dip_q2q_dm_avg);
-		output_dip_avg(ofp, "Q2Adm", dip_q2a_dm_avg);
-		output_dip_avg(ofp, "Q2Cdm", dip_q2c_dm_avg);
-		fprintf(ofp, "\n");
-
-		output_dip_avg(ofp, "Q2Q", dip_q2q_avg);
-		output_dip_avg(ofp, "Q2A", dip_q2a_avg);
-		output_dip_avg(ofp, "Q2G", dip_q2g_avg);
-		output_dip_avg(ofp, "S2G", dip_s2g_avg);
-		output_dip_avg(ofp, "G2I", dip_g2i_avg);
-		output_dip_avg(ofp, "Q2M", dip_q2m_avg);
-		output_dip_avg(ofp, "I2D", dip_i2d_avg);
-		output_dip_avg(ofp, "D2C", dip_d2c_avg);
-		output_dip_avg(ofp, "Q2C", dip_q2c_avg);
+	if (output_all_data) {
+		if (exes == NULL || *exes != '\0')
+			opiece_add_avgs(&ops, "Per Process", output_pip_avg);
+		opiece_add_avgs(&ops, "Per Device", output_dip_avg);
 	}
 
-	output_section_hdr(ofp, "All Devices");
-	output_hdr(ofp, "ALL");
-	__output_avg(ofp, "Q2Qdm", &all_avgs.q2q_dm, 0);
-	__output_avg(ofp, "Q2Adm", &all_avgs.q2a_dm, 0);
-	__output_avg(ofp, "Q2Cdm", &all_avgs.q2c_dm, 0);
-	fprintf(ofp, "\n");
-
-	__output_avg(ofp, "Q2Q", &all_avgs.q2q, 1);
-	__output_avg(ofp, "Q2A", &all_avgs.q2a, 1);
-	__output_avg(ofp, "Q2G", &all_avgs.q2g, 1);
-	__output_avg(ofp, "S2G", &all_avgs.s2g, 1);
-	__output_avg(ofp, "G2I", &all_avgs.g2i, 1);
-	__output_avg(ofp, "Q2M", &all_avgs.q2m, 1);
-	__output_avg(ofp, "I2D", &all_avgs.i2d, 1);
-	__output_avg(ofp, "M2D", &all_avgs.m2d, 1);
-	__output_avg(ofp, "D2C", &all_avgs.d2c, 1);
-	__output_avg(ofp, "Q2C", &all_avgs.q2c, 1);
-	fprintf(ofp, "\n");
-
-	output_section_hdr(ofp, "Device Overhead");
-	output_dip_prep_ohead(ofp);
-
-	output_section_hdr(ofp, "Device Merge Information");
-	output_dip_merge_ratio(ofp);
-
-	output_section_hdr(ofp, "Device Q2Q Seek Information");
-	output_dip_q2q_seek_info(ofp);
-
-	output_section_hdr(ofp, "Device D2D Seek Information");
-	output_dip_seek_info(ofp);
-
-	output_section_hdr(ofp, "Plug Information");
-	output_plug_info(ofp);
-
-	output_section_hdr(ofp, "Active Requests At Q Information");
-	output_actQ_info(ofp);
-
-	output_section_hdr(ofp, "I/O Active Period Information");
-	output_p_live(ofp);
+	opiece_add(&ops, "All Devices", output_all_avgs)->arg = &all_avgs;
+	if (do_stacks)
+		opiece_add(&ops, "Per Stack Latency Breakdown",
+			   output_stacks_piece);
+	opiece_add(&ops, "Device Overhead", output_dip_prep_ohead);
+	opiece_add(&ops, "Device Merge Information", output_dip_merge_ratio);
+	opiece_add(&ops, "Device Q2Q Seek Information",
+		   output_dip_q2q_seek_info);
+	opiece_add(&ops, "Device D2D Seek Information", output_dip_seek_info);
+	opiece_add(&ops, "Plug Information", output_plug_info);
+	opiece_add(&ops, "Active Requests At Q Information", output_actQ_info);
+	opiece_add(&ops, "I/O Active Period Information", output_p_live);
+	if (n_culled)
+		opiece_add(&ops, "Culled Outstanding IOs", output_culled);
+	if (output_all_data)
+		opiece_add(&ops, "Q2D Histogram", output_q2d_histo);
 
 	output_histos();
-
-
-	if (output_all_data) {
-		output_section_hdr(ofp, "Q2D Histogram");
-		output_q2d_histo(ofp);
-	}
+	opieces_run(&ops, ofp);
+	free(ops.pieces);
 
 	return 0;
 }
 
-void __output_ranges(FILE *ofp, struct list_head *head_p, float base)
+void __output_ranges(FILE *ofp, struct range_list *rlp, float base)
 {
 	struct range_info *rip;
-	struct list_head *p;
 	float limit = base + 0.4;
 
-	__list_for_each(p, head_p) {
-		rip = list_entry(p, struct range_info, head);
+	for (rip = rlp->ranges; rip < rlp->ranges + rlp->nr; rip++) {
 		fprintf(ofp, "%13.9lf %5.1f\n", BIT_TIME(rip->start), base);
 		fprintf(ofp, "%13.9lf %5.1f\n", BIT_TIME(rip->start), limit);
 		fprintf(ofp, "%13.9lf %5.1f\n", BIT_TIME(rip->end), limit);
@@ -846,7 +1090,7 @@ void __output_ranges(FILE *ofp, struct list_head *head_p, float base)
 int output_regions(FILE *ofp, char *header, struct region_info *reg,
 			  float base)
 {
-	if (list_len(&reg->qranges) == 0 && list_len(&reg->cranges) == 0)
+	if (reg->qranges.nr == 0 && reg->cranges.nr == 0)
 		return 0;
 
 	fprintf(ofp, "# %16s : q activity\n", header);
@@ -860,27 +1104,20 @@ int output_regions(FILE *ofp, char *header, struct region_info *reg,
 	return 1;
 }
 
-struct __od {
-	FILE *ofp;
-	float base;
-};
-void __output_dev(struct d_info *dip, void *arg)
-{
-	char header[128];
-	struct __od *odp = arg;
-
-	sprintf(header, "%d,%d", MAJOR(dip->device), MINOR(dip->device));
-	if (output_regions(odp->ofp, header, &dip->regions, odp->base))
-		odp->base += 1.0;
-}
-
 float output_devs(FILE *ofp, float base)
 {
-	struct __od od = { .ofp = ofp, .base = base };
+	int i;
+	char header[128];
 
 	fprintf(ofp, "# Per device\n" );
-	dip_foreach_out(__output_dev, &od);
-	return od.base;
+	for (i = 0; i < otbl.ndevs; i++) {
+		struct d_info *dip = otbl.devs[i].dip;
+
+		sprintf(header, "%d,%d", MAJOR(dip->device), MINOR(dip->device));
+		if (output_regions(ofp, header, &dip->regions, base))
+			base += 1.0;
+	}
+	return base;
 }
 
 static inline int exe_match(char *exe, char *name)
@@ -888,30 +1125,26 @@ static inline int exe_match(char *exe, char *name)
 	return (exe == NULL) || (strstr(name, exe) != NULL);
 }
 
-struct __op {
-	FILE *ofp;
-	float base;
-};
-void __output_procs(struct p_info *pip, void *arg)
-{
-	struct __op *opp = arg;
-	output_regions(opp->ofp, pip->name, &pip->regions, opp->base);
-	opp->base += 1.0;
-}
-
 float output_procs(FILE *ofp, float base)
 {
-	struct __op op = { .ofp = ofp, .base = base };
+	int i;
 
 	fprintf(ofp, "# Per process\n" );
-	pip_foreach_out(__output_procs, &op);
-	return op.base;
+	for (i = 0; i < otbl.nprocs; i++) {
+		struct p_info *pip = otbl.procs[i].pip;
+
+		output_regions(ofp, pip->name, &pip->regions, base);
+		base += 1.0;
+	}
+	return base;
 }
 
 int output_ranges(FILE *ofp)
 {
 	float base = 0.0;
 
+	otbl_init();
+
 	fprintf(ofp, "# %s\n", "Total System");
 	if (output_regions(ofp, "Total System", &all_regions, base))
 		base += 1.0;
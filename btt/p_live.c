@@ -21,24 +21,42 @@
  */
 #include "globals.h"
 
+/*
+ * Live periods are the union of the D->C times of the IOs on a device (or
+ * on all of them). Completions come in in time order, so a new interval
+ * can only join up with the last few periods: the ones that end after the
+ * oldest D of any IO still outstanding. Earlier periods are done with and
+ * just counted (and, with -Z, spilled to a temporary file for the plot
+ * data), so only the IOs in flight are kept.
+ */
 struct p_live {
-	struct rb_node rb_node;
-	struct list_head head;
 	__u64 dt, ct;
 };
 
-struct get_info {
-	struct p_live_info *plip;
-	__u64 t_start, t_end;
-	__u64 tot_live;
+/*
+ * D times of the IOs issued but not yet completed, oldest first, with the
+ * number of IOs at each
+ */
+struct d_grp {
+	__u64 dt;
+	int n;
+};
 
-	FILE *ofp;
-	double last_0;
-	int base_y;
+struct live_info {
+	struct p_live *open;		/* periods that may still grow */
+	int nopen, open_size;
+
+	struct d_grp *outs;		/* ring */
+	unsigned int outs_head, outs_nr, outs_size;
+
+	__u64 last_ct;
+	unsigned long nlives;
+	__u64 tot_live, t_start, t_end;
+	FILE *spill;
+	int trim_at;
 };
 
-static struct rb_root p_live_root;
-static LIST_HEAD(all_p_lives);
+static struct live_info sys_live;
 
 static FILE *do_open(struct d_info *dip)
 {
@@ -61,96 +79,243 @@ static FILE *do_open(struct d_info *dip)
 	return ofp;
 }
 
-static inline int inside(struct p_live *plp, __u64 dt, __u64 ct)
+static inline struct d_grp *outs_at(struct live_info *lip, unsigned int i)
 {
-	if (plp->dt <= dt && dt <= plp->ct)
-		return 1;
-	if (plp->dt <= ct && ct <= plp->ct)
-		return 1;
-	if (dt < plp->dt && plp->ct < ct)
-		return 1;
-	return 0;
+	return &lip->outs[(lip->outs_head + i) & (lip->outs_size - 1)];
 }
 
-static void __p_live_add(struct rb_root *root, __u64 dt, __u64 ct)
+static void outs_grow(struct live_info *lip)
 {
-	struct p_live *plp;
-	struct rb_node *parent = NULL;
-	struct rb_node **p = &root->rb_node;
+	unsigned int i, size = lip->outs_size ? 2 * lip->outs_size : 64;
+	struct d_grp *outs = malloc(size * sizeof(*outs));
 
-	while (*p) {
-		parent = *p;
-		plp = rb_entry(parent, struct p_live, rb_node);
+	for (i = 0; i < lip->outs_nr; i++)
+		outs[i] = *outs_at(lip, i);
 
-		if (inside(plp, dt, ct)) {
-			list_del(&plp->head);
-			rb_erase(&plp->rb_node, root);
-			__p_live_add(root, min(plp->dt, dt), max(plp->ct, ct));
-			free(plp);
-			return;
-		}
+	free(lip->outs);
+	lip->outs = outs;
+	lip->outs_size = size;
+	lip->outs_head = 0;
+}
+
+/*
+ * Oldest D of an outstanding IO, or the current time if there is none
+ */
+static inline __u64 outs_oldest(struct live_info *lip, __u64 now)
+{
+	if (lip->outs_nr && lip->outs[lip->outs_head].dt < now)
+		return lip->outs[lip->outs_head].dt;
+	return now;
+}
+
+static void outs_rem(struct live_info *lip, __u64 dt)
+{
+	unsigned int lo = 0, hi = lip->outs_nr;
 
-		if (ct < plp->dt)
-			p = &(*p)->rb_left;
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+
+		if (outs_at(lip, mid)->dt < dt)
+			lo = mid + 1;
 		else
-			p = &(*p)->rb_right;
+			hi = mid;
+	}
+	if (lo == lip->outs_nr || outs_at(lip, lo)->dt != dt)
+		return;
+
+	outs_at(lip, lo)->n--;
+	while (lip->outs_nr && lip->outs[lip->outs_head].n == 0) {
+		lip->outs_head = (lip->outs_head + 1) & (lip->outs_size - 1);
+		lip->outs_nr--;
+	}
+}
+
+static void live_final(struct live_info *lip, struct p_live *plp)
+{
+	lip->nlives++;
+	lip->tot_live += (plp->ct - plp->dt);
+	if (plp->dt < lip->t_start)
+		lip->t_start = plp->dt;
+	if (plp->ct > lip->t_end)
+		lip->t_end = plp->ct;
+
+	if (do_p_live) {
+		if (!lip->spill && (lip->spill = tmpfile()) == NULL) {
+			perror("tmpfile");
+			exit(1);
+		}
+		fwrite(plp, sizeof(*plp), 1, lip->spill);
+	}
+}
+
+/*
+ * Finish off the periods no IO starting at or after 'before' can reach
+ */
+static void live_trim(struct live_info *lip, __u64 before)
+{
+	int i;
+
+	for (i = 0; i < lip->nopen && lip->open[i].ct < before; i++)
+		live_final(lip, &lip->open[i]);
+
+	if (i) {
+		lip->nopen -= i;
+		memmove(lip->open, lip->open + i,
+			lip->nopen * sizeof(*lip->open));
+	}
+}
+
+/*
+ * Join [dt, ct] with the open periods it overlaps (or touches). Normally
+ * that is a run at the end; traces out of order on a stream can land it
+ * anywhere.
+ */
+static void live_add(struct live_info *lip, __u64 dt, __u64 ct)
+{
+	int i = lip->nopen, j;
+
+	if (ct > lip->last_ct)
+		lip->last_ct = ct;
+
+	while (i > 0 && lip->open[i - 1].ct >= dt)
+		i--;
+	for (j = i; j < lip->nopen && lip->open[j].dt <= ct; j++) {
+		if (lip->open[j].dt < dt)
+			dt = lip->open[j].dt;
+		if (lip->open[j].ct > ct)
+			ct = lip->open[j].ct;
+	}
+
+	if (i == j) {
+		if (lip->nopen == lip->open_size) {
+			lip->open_size = lip->open_size ? 2 * lip->open_size
+							: 16;
+			lip->open = realloc(lip->open,
+					    lip->open_size * sizeof(*lip->open));
+		}
+		memmove(lip->open + i + 1, lip->open + i,
+			(lip->nopen - i) * sizeof(*lip->open));
+		lip->nopen++;
+	} else if (j > i + 1) {
+		memmove(lip->open + i + 1, lip->open + j,
+			(lip->nopen - j) * sizeof(*lip->open));
+		lip->nopen -= j - i - 1;
 	}
 
-	plp = malloc(sizeof(*plp));
-	plp->dt = dt;
-	plp->ct = ct;
+	lip->open[i].dt = dt;
+	lip->open[i].ct = ct;
+}
 
-	rb_link_node(&plp->rb_node, parent, p);
-	rb_insert_color(&plp->rb_node, root);
-	list_add_tail(&plp->head, &all_p_lives);
+static void live_free(struct live_info *lip)
+{
+	free(lip->open);
+	free(lip->outs);
+	if (lip->spill)
+		fclose(lip->spill);
+	memset(lip, 0, sizeof(*lip));
 }
 
 void *p_live_alloc(void)
 {
-	size_t sz = sizeof(struct rb_root);
+	size_t sz = sizeof(struct live_info);
 	return memset(malloc(sz), 0, sz);
 }
 
 void p_live_free(void *p)
 {
+	live_free(p);
 	free(p);
 }
 
+/*
+ * An IO on dip has been issued at dt
+ */
+void p_live_issue(struct d_info *dip, __u64 dt)
+{
+	struct live_info *lip = dip->p_live_handle;
+	struct d_grp *gp;
+
+	if (lip->outs_nr && (gp = outs_at(lip, lip->outs_nr - 1))->dt == dt) {
+		gp->n++;
+		return;
+	}
+
+	if (lip->outs_nr == lip->outs_size)
+		outs_grow(lip);
+	gp = outs_at(lip, lip->outs_nr++);
+	gp->dt = dt;
+	gp->n = 1;
+}
+
+/*
+ * An IO issued at dt will not complete here after all (reissued, culled)
+ */
+void p_live_drop(struct d_info *dip, __u64 dt)
+{
+	outs_rem(dip->p_live_handle, dt);
+}
+
 void p_live_add(struct d_info *dip, __u64 dt, __u64 ct)
 {
-	__p_live_add(dip->p_live_handle, dt, ct);
-	__p_live_add(&p_live_root, dt, ct);
+	struct live_info *lip = dip->p_live_handle;
+
+	outs_rem(lip, dt);
+	live_add(lip, dt, ct);
+	live_trim(lip, outs_oldest(lip, ct));
 }
 
-static void p_live_visit(struct rb_node *n, struct get_info *gip)
+/*
+ * Periods on the system as a whole have to wait for the oldest IO
+ * outstanding on any device. That takes a walk over them all, so only do
+ * it once the open periods have doubled since the last time.
+ */
+void p_live_trim_sys(void)
 {
-	struct p_live *plp = rb_entry(n, struct p_live, rb_node);
+	__u64 before = sys_live.last_ct;
+	struct list_head *p;
 
-	if (n->rb_left)
-		p_live_visit(n->rb_left, gip);
+	if (sys_live.nopen < sys_live.trim_at)
+		return;
 
-	if (gip->ofp) {
-		float y0 = gip->base_y;
-		float y1 = gip->base_y + 0.9;
+	__list_for_each(p, &all_devs) {
+		struct d_info *dip = list_entry(p, struct d_info, all_head);
 
-		fprintf(gip->ofp, "%.9lf %.1f\n", gip->last_0, y0);
-		fprintf(gip->ofp, "%.9lf %.1f\n", BIT_TIME(plp->dt), y0);
-		fprintf(gip->ofp, "%.9lf %.1f\n", BIT_TIME(plp->dt), y1);
-		fprintf(gip->ofp, "%.9lf %.1f\n", BIT_TIME(plp->ct), y1);
-		fprintf(gip->ofp, "%.9lf %.1f\n", BIT_TIME(plp->ct), y0);
-		gip->last_0 = BIT_TIME(plp->ct);
+		before = outs_oldest(dip->p_live_handle, before);
 	}
+	live_trim(&sys_live, before);
+	sys_live.trim_at = max(64, 2 * sys_live.nopen);
+}
 
-	gip->plip->nlives++;
-	gip->tot_live += (plp->ct - plp->dt);
-
-	if (gip->t_start < 0.0 || plp->dt < gip->t_start)
-		gip->t_start = plp->dt;
-	if (gip->t_end < 0.0 || plp->ct > gip->t_end)
-		gip->t_end = plp->ct;
+/*
+ * With shards these are replayed at the end of each epoch, when the
+ * devices have moved on; shard.c trims once the replay is done
+ */
+void p_live_add_sys(__u64 dt, __u64 ct)
+{
+	live_add(&sys_live, dt, ct);
+	if (n_shards <= 1)
+		p_live_trim_sys();
+}
 
-	if (n->rb_right)
-		p_live_visit(n->rb_right, gip);
+static void live_dump(struct live_info *lip, FILE *ofp, int base_y)
+{
+	float y0 = base_y;
+	float y1 = base_y + 0.9;
+	double last_0 = 0.0;
+	struct p_live pl;
+
+	if (!lip->spill)
+		return;
+
+	rewind(lip->spill);
+	while (fread(&pl, sizeof(pl), 1, lip->spill) == 1) {
+		fprintf(ofp, "%.9lf %.1f\n", last_0, y0);
+		fprintf(ofp, "%.9lf %.1f\n", BIT_TIME(pl.dt), y0);
+		fprintf(ofp, "%.9lf %.1f\n", BIT_TIME(pl.dt), y1);
+		fprintf(ofp, "%.9lf %.1f\n", BIT_TIME(pl.ct), y1);
+		fprintf(ofp, "%.9lf %.1f\n", BIT_TIME(pl.ct), y0);
+		last_0 = BIT_TIME(pl.ct);
+	}
 }
 
 struct p_live_info *p_live_get(struct d_info *dip, int base_y)
@@ -158,18 +323,14 @@ struct p_live_info *p_live_get(struct d_info *dip, int base_y)
 	FILE *ofp = do_open(dip);
 	static struct p_live_info pli;
 	struct p_live_info *plip = &pli;
-	struct get_info gi = {
-		.plip = plip,
-		.t_start = 0.0,
-		.t_end = 0.0,
-		.ofp = ofp,
-		.base_y = base_y,
-	};
-	struct rb_root *root = (dip) ? dip->p_live_handle : &p_live_root;
+	struct live_info *lip = (dip) ? dip->p_live_handle : &sys_live;
+
+	live_trim(lip, ~0ULL);
+	if (ofp)
+		live_dump(lip, ofp, base_y);
 
 	memset(plip, 0, sizeof(*plip));
-	if (root->rb_node)
-		p_live_visit(root->rb_node, &gi);
+	plip->nlives = lip->nlives;
 
 	if (plip->nlives == 0) {
 		plip->avg_live = plip->avg_lull = plip->p_live = 0.0;
@@ -179,8 +340,8 @@ struct p_live_info *p_live_get(struct d_info *dip, int base_y)
 		plip->p_live = 100.0;
 	}
 	else {
-		double t_time = BIT_TIME(gi.t_end - gi.t_start);
-		double tot_live = BIT_TIME(gi.tot_live);
+		double t_time = BIT_TIME(lip->t_end - lip->t_start);
+		double tot_live = BIT_TIME(lip->tot_live);
 
 		plip->p_live = 100.0 * (tot_live / t_time);
 		plip->avg_live = tot_live / plip->nlives;
@@ -192,12 +353,88 @@ struct p_live_info *p_live_get(struct d_info *dip, int base_y)
 
 void p_live_exit(void)
 {
-	struct list_head *p, *q;
+	live_free(&sys_live);
+}
 
-	list_for_each_safe(p, q, &all_p_lives) {
-		struct p_live *plp = list_entry(p, struct p_live, head);
+/*
+ * The open periods and outstanding Ds are kept as they are; with -Z the
+ * periods already finished are copied out of (and back into) the spill.
+ */
+static void live_ckpt_save(FILE *fp, struct live_info *lip)
+{
+	unsigned int i;
+	__u64 nspill = 0;
+	struct p_live pl;
+
+	ckpt_put(fp, &lip->nopen, sizeof(lip->nopen));
+	ckpt_put(fp, lip->open, lip->nopen * sizeof(*lip->open));
+	ckpt_put(fp, &lip->outs_nr, sizeof(lip->outs_nr));
+	for (i = 0; i < lip->outs_nr; i++)
+		ckpt_put(fp, outs_at(lip, i), sizeof(struct d_grp));
+	ckpt_put(fp, &lip->last_ct, sizeof(lip->last_ct));
+	ckpt_put(fp, &lip->nlives, sizeof(lip->nlives));
+	ckpt_put(fp, &lip->tot_live, sizeof(lip->tot_live));
+	ckpt_put(fp, &lip->t_start, sizeof(lip->t_start));
+	ckpt_put(fp, &lip->t_end, sizeof(lip->t_end));
+	ckpt_put(fp, &lip->trim_at, sizeof(lip->trim_at));
+
+	if (lip->spill) {
+		fflush(lip->spill);
+		nspill = ftello(lip->spill) / sizeof(pl);
+	}
+	ckpt_put(fp, &nspill, sizeof(nspill));
+	if (nspill) {
+		rewind(lip->spill);
+		while (fread(&pl, sizeof(pl), 1, lip->spill) == 1)
+			ckpt_put(fp, &pl, sizeof(pl));
+		fseeko(lip->spill, 0, SEEK_END);
+	}
+}
 
-		list_del(&plp->head);
-		free(plp);
+static void live_ckpt_load(FILE *fp, struct live_info *lip)
+{
+	__u64 nspill;
+	struct p_live pl;
+
+	live_free(lip);
+	ckpt_get(fp, &lip->nopen, sizeof(lip->nopen));
+	lip->open_size = lip->nopen;
+	if (lip->nopen) {
+		lip->open = malloc(lip->nopen * sizeof(*lip->open));
+		ckpt_get(fp, lip->open, lip->nopen * sizeof(*lip->open));
+	}
+	ckpt_get(fp, &lip->outs_nr, sizeof(lip->outs_nr));
+	if (lip->outs_nr) {
+		lip->outs_size = 64;
+		while (lip->outs_size < lip->outs_nr)
+			lip->outs_size *= 2;
+		lip->outs = malloc(lip->outs_size * sizeof(*lip->outs));
+		ckpt_get(fp, lip->outs, lip->outs_nr * sizeof(*lip->outs));
 	}
+	ckpt_get(fp, &lip->last_ct, sizeof(lip->last_ct));
+	ckpt_get(fp, &lip->nlives, sizeof(lip->nlives));
+	ckpt_get(fp, &lip->tot_live, sizeof(lip->tot_live));
+	ckpt_get(fp, &lip->t_start, sizeof(lip->t_start));
+	ckpt_get(fp, &lip->t_end, sizeof(lip->t_end));
+	ckpt_get(fp, &lip->trim_at, sizeof(lip->trim_at));
+
+	ckpt_get(fp, &nspill, sizeof(nspill));
+	if (nspill && (lip->spill = tmpfile()) == NULL) {
+		perror("tmpfile");
+		exit(1);
+	}
+	while (nspill--) {
+		ckpt_get(fp, &pl, sizeof(pl));
+		fwrite(&pl, sizeof(pl), 1, lip->spill);
+	}
+}
+
+void p_live_ckpt_save(FILE *fp, struct d_info *dip)
+{
+	live_ckpt_save(fp, dip ? dip->p_live_handle : &sys_live);
+}
+
+void p_live_ckpt_load(FILE *fp, struct d_info *dip)
+{
+	live_ckpt_load(fp, dip ? dip->p_live_handle : &sys_live);
 }
@@ -24,9 +24,18 @@
 struct plat_info {
 	long nl;
 	FILE *fp;
+	struct bcol_buf *bp;
 	double first_ts, last_ts, tl;
 };
 
+static inline void plat_out(struct plat_info *pp, double ts, double lat)
+{
+	if (pp->bp)
+		bcol_add(pp->bp, ts, lat);
+	else
+		fprintf(pp->fp, "%lf %lf\n", ts, lat);
+}
+
 void *plat_alloc(struct d_info *dip, char *post)
 {
 	char *oname;
@@ -37,6 +46,18 @@ void *plat_alloc(struct d_info *dip, char *post)
 	pp = malloc(sizeof(*pp));
 	pp->nl = 0;
 	pp->first_ts = pp->last_ts = pp->tl = -1.0;
+	pp->fp = NULL;
+
+	if (binary_data) {
+		if (!strcmp(post, "_q2d"))
+			pp->bp = bcol_alloc(BC_Q2D_PLAT, dip);
+		else if (!strcmp(post, "_q2c"))
+			pp->bp = bcol_alloc(BC_Q2C_PLAT, dip);
+		else
+			pp->bp = bcol_alloc(BC_D2C_PLAT, dip);
+		return pp;
+	}
+	pp->bp = NULL;
 
 	oname = malloc(strlen(dip->dip_name) + strlen(post) + 32);
 	sprintf(oname, "%s%s_plat.dat", dip->dip_name, post);
@@ -60,9 +81,9 @@ void plat_free(void *info)
 	if (pp->first_ts != -1.0) {
 		double delta = pp->last_ts - pp->first_ts;
 
-		fprintf(pp->fp, "%lf %lf\n",
-			pp->first_ts + (delta / 2), pp->tl / pp->nl);
+		plat_out(pp, pp->first_ts + (delta / 2), pp->tl / pp->nl);
 	}
+	bcol_free(pp->bp);
 	free(info);
 }
 
@@ -81,8 +102,7 @@ void plat_x2c(void *info, __u64 ts, __u64 latency)
 	} else if ((now - pp->first_ts) >= plat_freq) {
 		double delta = pp->last_ts - pp->first_ts;
 
-		fprintf(pp->fp, "%lf %lf\n",
-			pp->first_ts + (delta / 2), pp->tl / pp->nl);
+		plat_out(pp, pp->first_ts + (delta / 2), pp->tl / pp->nl);
 
 		pp->first_ts = pp->last_ts = now;
 		pp->nl = 1;
@@ -19,139 +19,142 @@
  *
  */
 #include <string.h>
+#include <pthread.h>
 
 #include "globals.h"
 
+#define N_PID_CACHE	64
+#define PN_HASH_MIN	256
+
+/*
+ * Processes are found through two open addressed, linearly probed tables,
+ * one keyed on pid and one on name. Names are interned: each is hashed
+ * once when its process is made, and the process's own name is the key,
+ * so a name lookup only compares strings on a full hash match. Every pid
+ * seen with a name maps to the one process of that name, which is how
+ * per-process data gets merged by name.
+ */
 struct pn_info {
-	struct rb_node rb_node;
 	struct p_info *pip;
-	union {
-		char *name;
-		__u32 pid;
-	}  u;
+	__u32 key;		/* pid, or hash of the name */
+};
+
+struct pn_table {
+	struct pn_info *tbl;
+	unsigned int size, nr;
 };
 
-struct rb_root root_pid, root_name;
+static struct pn_table pid_tbl, name_tbl;
+
+/*
+ * Shards look processes up concurrently: a pid never changes the process
+ * it maps to once found, so each thread caches hits and only takes the
+ * lock to search (and maybe grow) the tables.
+ */
+static pthread_mutex_t proc_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct {
+	__u32 pid;
+	struct p_info *pip;
+} pid_cache[N_PID_CACHE];
+
+static inline unsigned int pn_slot(__u32 key, unsigned int size)
+{
+	return (unsigned int)((key * 0x9e3779b97f4a7c15ULL) >> 32) & (size - 1);
+}
 
-static void __foreach(struct rb_node *n, void (*f)(struct p_info *, void *),
-			void *arg)
+static inline __u32 name_hash(char *name)
 {
-	if (n) {
-		__foreach(n->rb_left, f, arg);
-		f(rb_entry(n, struct pn_info, rb_node)->pip, arg);
-		__foreach(n->rb_right, f, arg);
+	__u32 h = 2166136261U;		/* FNV-1a */
+
+	while (*name) {
+		h ^= (unsigned char)*name++;
+		h *= 16777619U;
 	}
+	return h;
 }
 
-static void __destroy(struct rb_node *n, int free_name, int free_pip)
+static void pn_grow(struct pn_table *tp)
 {
-	if (n) {
-		struct pn_info *pnp = rb_entry(n, struct pn_info, rb_node);
-
-		__destroy(n->rb_left, free_name, free_pip);
-		__destroy(n->rb_right, free_name, free_pip);
-
-		if (free_name)
-			free(pnp->u.name);
-		if (free_pip) {
-			free(pnp->pip->name);
-			region_exit(&pnp->pip->regions);
-			free(pnp->pip);
+	unsigned int i, j, old_size = tp->size;
+	struct pn_info *old = tp->tbl;
+
+	tp->size = old_size ? old_size * 2 : PN_HASH_MIN;
+	tp->tbl = calloc(tp->size, sizeof(*tp->tbl));
+
+	for (i = 0; i < old_size; i++)
+		if (old[i].pip) {
+			j = pn_slot(old[i].key, tp->size);
+			while (tp->tbl[j].pip)
+				j = (j + 1) & (tp->size - 1);
+			tp->tbl[j] = old[i];
 		}
-		free(pnp);
-	}
+
+	free(old);
+}
+
+static void pn_insert(struct pn_table *tp, __u32 key, struct p_info *pip)
+{
+	unsigned int i;
+
+	if (2 * (tp->nr + 1) > tp->size)
+		pn_grow(tp);
+
+	i = pn_slot(key, tp->size);
+	while (tp->tbl[i].pip)
+		i = (i + 1) & (tp->size - 1);
+	tp->tbl[i].key = key;
+	tp->tbl[i].pip = pip;
+	tp->nr++;
 }
 
 struct p_info * __find_process_pid(__u32 pid)
 {
-	struct pn_info *this;
-	struct rb_node *n = root_pid.rb_node;
-
-	while (n) {
-		this = rb_entry(n, struct pn_info, rb_node);
-		if (pid < this->u.pid)
-			n = n->rb_left;
-		else if (pid > this->u.pid)
-			n = n->rb_right;
-		else
-			return this->pip;
-	}
+	unsigned int i, mask = pid_tbl.size - 1;
+
+	if (!pid_tbl.nr)
+		return NULL;
+
+	for (i = pn_slot(pid, pid_tbl.size); pid_tbl.tbl[i].pip; i = (i + 1) & mask)
+		if (pid_tbl.tbl[i].key == pid)
+			return pid_tbl.tbl[i].pip;
 
 	return NULL;
 }
 
-struct p_info *__find_process_name(char *name)
+static struct p_info *__find_name_hash(char *name, __u32 h)
 {
-	int cmp;
-	struct pn_info *this;
-	struct rb_node *n = root_name.rb_node;
-
-	while (n) {
-		this = rb_entry(n, struct pn_info, rb_node);
-		cmp = strcmp(name, this->u.name);
-		if (cmp < 0)
-			n = n->rb_left;
-		else if (cmp > 0)
-			n = n->rb_right;
-		else
-			return this->pip;
+	unsigned int i, mask = name_tbl.size - 1;
+	struct pn_info *pnp;
+
+	if (!name_tbl.nr)
+		return NULL;
+
+	for (i = pn_slot(h, name_tbl.size); name_tbl.tbl[i].pip; i = (i + 1) & mask) {
+		pnp = &name_tbl.tbl[i];
+		if (pnp->key == h && !strcmp(name, pnp->pip->name))
+			return pnp->pip;
 	}
 
 	return NULL;
 }
 
-static void insert_pid(struct p_info *that, __u32 pid)
+struct p_info *__find_process_name(char *name)
 {
-	struct pn_info *this;
-	struct rb_node *parent = NULL;
-	struct rb_node **p = &root_pid.rb_node;
-
-	while (*p) {
-		parent = *p;
-		this = rb_entry(parent, struct pn_info, rb_node);
-
-		if (pid < this->u.pid)
-			p = &(*p)->rb_left;
-		else if (pid > this->u.pid)
-			p = &(*p)->rb_right;
-		else
-			return;	// Already there
-	}
-
-	this = malloc(sizeof(struct pn_info));
-	this->u.pid = pid;
-	this->pip = that;
+	return __find_name_hash(name, name_hash(name));
+}
 
-	rb_link_node(&this->rb_node, parent, p);
-	rb_insert_color(&this->rb_node, &root_pid);
+static void insert_pid(struct p_info *that, __u32 pid)
+{
+	if (!__find_process_pid(pid))
+		pn_insert(&pid_tbl, pid, that);
 }
 
 static void insert_name(struct p_info *that)
 {
-	int cmp;
-	struct pn_info *this;
-	struct rb_node *parent = NULL;
-	struct rb_node **p = &root_name.rb_node;
-
-	while (*p) {
-		parent = *p;
-		this = rb_entry(parent, struct pn_info, rb_node);
-		cmp = strcmp(that->name, this->u.name);
-
-		if (cmp < 0)
-			p = &(*p)->rb_left;
-		else if (cmp > 0)
-			p = &(*p)->rb_right;
-		else
-			return;	// Already there...
-	}
-
-	this = malloc(sizeof(struct pn_info));
-	this->u.name = strdup(that->name);
-	this->pip = that;
+	__u32 h = name_hash(that->name);
 
-	rb_link_node(&this->rb_node, parent, p);
-	rb_insert_color(&this->rb_node, &root_name);
+	if (!__find_name_hash(that->name, h))
+		pn_insert(&name_tbl, h, that);
 }
 
 static void insert(struct p_info *pip)
@@ -160,6 +163,33 @@ static void insert(struct p_info *pip)
 	insert_name(pip);
 }
 
+static int pip_name_cmp(const void *a, const void *b)
+{
+	return strcmp((*(struct p_info **)a)->name, (*(struct p_info **)b)->name);
+}
+
+/*
+ * Output goes in name order, as it always has
+ */
+static void __foreach(void (*f)(struct p_info *, void *), void *arg)
+{
+	struct p_info **pips;
+	unsigned int i, n = 0;
+
+	if (!name_tbl.nr)
+		return;
+
+	pips = malloc(name_tbl.nr * sizeof(*pips));
+	for (i = 0; i < name_tbl.size; i++)
+		if (name_tbl.tbl[i].pip)
+			pips[n++] = name_tbl.tbl[i].pip;
+	qsort(pips, n, sizeof(*pips), pip_name_cmp);
+
+	for (i = 0; i < n; i++)
+		f(pips[i], arg);
+	free(pips);
+}
+
 static inline struct p_info *pip_alloc(void)
 {
 	return memset(malloc(sizeof(struct p_info)), 0, sizeof(struct p_info));
@@ -181,7 +211,7 @@ struct p_info *find_process(__u32 pid, char *name)
 				 * as another, but a different PID.
 				 *
 				 * We'll store a reference in the PID
-				 * tree...
+				 * table...
 				 */
 				insert_pid(pip, pid);
 			}
@@ -214,28 +244,60 @@ void process_alloc(__u32 pid, char *name)
 		region_init(&pip->regions);
 		pip->last_q = (__u64)-1;
 		pip->name = strdup(name);
+		if (n_shards > 1)
+			pip->shard_avgs = calloc(n_shards, sizeof(pip->avgs));
 
 		insert(pip);
 	}
 }
 
-void pip_update_q(struct io *iop)
+struct p_info *pip_lookup(__u32 pid)
 {
-	if (iop->pip) {
-		if (remapper_dev(iop->dip->device))
-			update_lq(&iop->pip->last_q, &iop->pip->avgs.q2q_dm,
-								iop->t.time);
-		else
-			update_lq(&iop->pip->last_q, &iop->pip->avgs.q2q,
-								iop->t.time);
-		update_qregion(&iop->pip->regions, iop->t.time);
+	int idx = pid & (N_PID_CACHE - 1);
+	struct p_info *pip = pid_cache[idx].pip;
+
+	if (pip && pid_cache[idx].pid == pid)
+		return pip;
+
+	pthread_mutex_lock(&proc_lock);
+	pip = find_process(pid, NULL);
+	pthread_mutex_unlock(&proc_lock);
+
+	pid_cache[idx].pid = pid;
+	pid_cache[idx].pip = pip;
+	return pip;
+}
+
+void pip_update_q(struct p_info *pip, __u64 time, int dm)
+{
+	if (dm)
+		update_lq(&pip->last_q, &pip->avgs.q2q_dm, time);
+	else
+		update_lq(&pip->last_q, &pip->avgs.q2q, time);
+	update_qregion(&pip->regions, time);
+}
+
+void pip_merge_shards(void)
+{
+	unsigned int i;
+	int j;
+
+	for (i = 0; i < name_tbl.size; i++) {
+		struct p_info *pip = name_tbl.tbl[i].pip;
+
+		if (!pip)
+			continue;
+		for (j = 0; j < n_shards; j++) {
+			avgs_merge(&pip->avgs, &pip->shard_avgs[j]);
+			lh_free(&pip->shard_avgs[j]);
+		}
 	}
 }
 
 void pip_foreach_out(void (*f)(struct p_info *, void *), void *arg)
 {
 	if (exes == NULL)
-		__foreach(root_name.rb_node, f, arg);
+		__foreach(f, arg);
 	else {
 		struct p_info *pip;
 		char *exe, *next, *exes_save = strdup(exes);
@@ -255,8 +317,79 @@ void pip_foreach_out(void (*f)(struct p_info *, void *), void *arg)
 	}
 }
 
+/*
+ * Each process once, by name, then every pid and the name it maps to
+ */
+void pip_ckpt_save(FILE *fp)
+{
+	unsigned int i;
+
+	ckpt_put(fp, &name_tbl.nr, sizeof(name_tbl.nr));
+	for (i = 0; i < name_tbl.size; i++) {
+		struct p_info *pip = name_tbl.tbl[i].pip;
+
+		if (!pip)
+			continue;
+		ckpt_put_str(fp, pip->name);
+		ckpt_put(fp, &pip->pid, sizeof(pip->pid));
+		ckpt_put(fp, &pip->last_q, sizeof(pip->last_q));
+		ckpt_put_avgs(fp, &pip->avgs);
+		ckpt_put_region(fp, &pip->regions);
+	}
+
+	ckpt_put(fp, &pid_tbl.nr, sizeof(pid_tbl.nr));
+	for (i = 0; i < pid_tbl.size; i++) {
+		struct pn_info *pnp = &pid_tbl.tbl[i];
+
+		if (!pnp->pip)
+			continue;
+		ckpt_put(fp, &pnp->key, sizeof(pnp->key));
+		ckpt_put_str(fp, pnp->pip->name);
+	}
+}
+
+void pip_ckpt_load(FILE *fp)
+{
+	unsigned int i, n;
+	__u32 pid;
+	char *name;
+
+	ckpt_get(fp, &n, sizeof(n));
+	for (i = 0; i < n; i++) {
+		struct p_info *pip = pip_alloc();
+
+		pip->name = ckpt_get_str(fp);
+		ckpt_get(fp, &pip->pid, sizeof(pip->pid));
+		ckpt_get(fp, &pip->last_q, sizeof(pip->last_q));
+		ckpt_get_avgs(fp, &pip->avgs);
+		ckpt_get_region(fp, &pip->regions);
+		insert_name(pip);
+	}
+
+	ckpt_get(fp, &n, sizeof(n));
+	for (i = 0; i < n; i++) {
+		ckpt_get(fp, &pid, sizeof(pid));
+		name = ckpt_get_str(fp);
+		insert_pid(__find_process_name(name), pid);
+		free(name);
+	}
+}
+
 void pip_exit(void)
 {
-	__destroy(root_pid.rb_node, 0, 0);
-	__destroy(root_name.rb_node, 1, 1);
+	unsigned int i;
+
+	for (i = 0; i < name_tbl.size; i++) {
+		struct p_info *pip = name_tbl.tbl[i].pip;
+
+		if (pip) {
+			lh_free(&pip->avgs);
+			free(pip->shard_avgs);
+			free(pip->name);
+			region_exit(&pip->regions);
+			free(pip);
+		}
+	}
+	free(name_tbl.tbl);
+	free(pid_tbl.tbl);
 }
@@ -119,3 +119,13 @@ void q2d_acc(void *a1, void *a2)
 		ap->histos[i] += tp->histos[i];
 	ap->nhistos += tp->nhistos;
 }
+
+void q2d_ckpt_save(FILE *fp, void *priv)
+{
+	ckpt_put(fp, priv, sizeof(struct q2d_info));
+}
+
+void q2d_ckpt_load(FILE *fp, void *priv)
+{
+	ckpt_get(fp, priv, sizeof(struct q2d_info));
+}
@@ -41,7 +41,7 @@ static int do_open(struct files *fip, char *bn, char *pn)
 	fip->nm = malloc(strlen(bn) + 16);
 	sprintf(fip->nm, "%s_%s.dat", bn, pn);
 
-	fip->fp = my_fopen(fip->nm, "w");
+	fip->fp = ckpt_fopen(fip->nm);
 	if (fip->fp) {
 		add_file(fip->fp, fip->nm);
 		return 0;
@@ -119,6 +119,10 @@ void rstat_add(void *ptr, double cur, unsigned long long nblks)
 {
 	if (ptr != NULL)
 		__add((struct rstat *)ptr, cur, nblks);
+}
+
+void rstat_add_sys(double cur, unsigned long long nblks)
+{
 	__add(sys_info, cur, nblks);
 }
 
@@ -137,3 +141,34 @@ void rstat_exit(void)
 		rstat_free(rsip);
 	}
 }
+
+/*
+ * The counts for the second under way; NULL dip is the system's
+ */
+void rstat_ckpt_save(FILE *fp, struct d_info *dip)
+{
+	struct rstat *rsip = dip ? dip->rstat_handle : sys_info;
+	int on = rsip != NULL;
+
+	ckpt_put(fp, &on, sizeof(on));
+	if (on) {
+		ckpt_put(fp, &rsip->ios, sizeof(rsip->ios));
+		ckpt_put(fp, &rsip->nblks, sizeof(rsip->nblks));
+		ckpt_put(fp, &rsip->base_sec, sizeof(rsip->base_sec));
+	}
+}
+
+void rstat_ckpt_load(FILE *fp, struct d_info *dip)
+{
+	struct rstat tmp, *rsip = dip ? dip->rstat_handle : sys_info;
+	int on;
+
+	ckpt_get(fp, &on, sizeof(on));
+	if (on) {
+		if (!rsip)
+			rsip = &tmp;
+		ckpt_get(fp, &rsip->ios, sizeof(rsip->ios));
+		ckpt_get(fp, &rsip->nblks, sizeof(rsip->nblks));
+		ckpt_get(fp, &rsip->base_sec, sizeof(rsip->base_sec));
+	}
+}
@@ -21,12 +21,33 @@
 #include <float.h>
 #include "globals.h"
 
+/*
+ * Seek distances are summarized in bounded space: the most frequent ones
+ * are tracked with a Space-Saving table of SS_NR counters (a min-heap on
+ * the counts, plus a hash from distance to heap slot), and their overall
+ * distribution in a log-linear histogram (see lhist.c).
+ *
+ * Until more than SS_NR distinct distances have been seen the table holds
+ * exact counts, and median and mode are exact. After that the median
+ * comes from the histogram (within 1.6%), and modes are ranked by the
+ * count they are sure to have, which may be low by up to N/SS_NR; any
+ * distance seen more often than that is sure to be in the table. -E
+ * keeps every distinct distance instead.
+ */
+#define SS_NR		256
+#define SS_HASH		(2 * SS_NR)
+
 struct seek_bkt {
 	struct rb_node rb_node;
 	long long sectors;
 	int nseeks;
 };
 
+struct seek_ss {
+	long long sectors;
+	int nseeks, err, slot;
+};
+
 /* Seeks per second */
 struct sps_bkt {
 	double t_start, t_last;
@@ -35,7 +56,12 @@ struct sps_bkt {
 
 struct seeki {
 	FILE *rfp, *wfp, *cfp, *sps_fp;
+	struct bcol_buf *bp, *sps_bp;
 	struct rb_root root;
+	struct seek_ss ss[SS_NR];
+	short ss_hash[SS_HASH];
+	int ss_nr, evicted;
+	struct avg_info dist;
 	struct sps_bkt sps;
 	long long tot_seeks;
 	double total_sectors;
@@ -60,7 +86,7 @@ static FILE *seek_open(char *str, char rw)
 	return fp;
 }
 
-static void __insert(struct rb_root *root, long long sectors)
+static void __insert(struct rb_root *root, long long sectors, int nseeks)
 {
 	struct seek_bkt *sbp;
 	struct rb_node *parent = NULL;
@@ -74,13 +100,13 @@ static void __insert(struct rb_root *root, long long sectors)
 		else if (sectors > sbp->sectors)
 			p = &(*p)->rb_right;
 		else {
-			sbp->nseeks++;
+			sbp->nseeks += nseeks;
 			return;
 		}
 	}
 
 	sbp = malloc(sizeof(struct seek_bkt));
-	sbp->nseeks = 1;
+	sbp->nseeks = nseeks;
 	sbp->sectors = sectors;
 
 	rb_link_node(&sbp->rb_node, parent, p);
@@ -98,6 +124,124 @@ static void __destroy(struct rb_node *n)
 	}
 }
 
+static inline int ss_hash(long long sectors)
+{
+	return ((unsigned long long)sectors * 0x9e3779b97f4a7c15ULL) >> 32 &
+								(SS_HASH - 1);
+}
+
+static int ss_find(struct seeki *sip, long long sectors)
+{
+	int i, j;
+
+	for (i = ss_hash(sectors); (j = sip->ss_hash[i]) >= 0;
+						i = (i + 1) & (SS_HASH - 1))
+		if (sip->ss[j].sectors == sectors)
+			return j;
+
+	return -1;
+}
+
+static void ss_hash_ins(struct seeki *sip, int idx)
+{
+	int i = ss_hash(sip->ss[idx].sectors);
+
+	while (sip->ss_hash[i] >= 0)
+		i = (i + 1) & (SS_HASH - 1);
+	sip->ss_hash[i] = idx;
+	sip->ss[idx].slot = i;
+}
+
+/*
+ * Backward shift deletion, so probe runs never have holes
+ */
+static void ss_hash_rem(struct seeki *sip, int i)
+{
+	int j, k;
+
+	for (j = i; ; ) {
+		sip->ss_hash[i] = -1;
+		for (;;) {
+			j = (j + 1) & (SS_HASH - 1);
+			if (sip->ss_hash[j] < 0)
+				return;
+			k = ss_hash(sip->ss[sip->ss_hash[j]].sectors);
+			if (((j - k) & (SS_HASH - 1)) >=
+						((j - i) & (SS_HASH - 1)))
+				break;
+		}
+		sip->ss_hash[i] = sip->ss_hash[j];
+		sip->ss[sip->ss_hash[i]].slot = i;
+		i = j;
+	}
+}
+
+static inline void ss_swap(struct seeki *sip, int a, int b)
+{
+	struct seek_ss tmp = sip->ss[a];
+
+	sip->ss[a] = sip->ss[b];
+	sip->ss[b] = tmp;
+	sip->ss_hash[sip->ss[a].slot] = a;
+	sip->ss_hash[sip->ss[b].slot] = b;
+}
+
+static void ss_down(struct seeki *sip, int i)
+{
+	int c;
+
+	while ((c = 2 * i + 1) < sip->ss_nr) {
+		if (c + 1 < sip->ss_nr &&
+		    sip->ss[c + 1].nseeks < sip->ss[c].nseeks)
+			c++;
+		if (sip->ss[i].nseeks <= sip->ss[c].nseeks)
+			break;
+		ss_swap(sip, i, c);
+		i = c;
+	}
+}
+
+static void ss_add(struct seeki *sip, long long sectors)
+{
+	int i = ss_find(sip, sectors);
+
+	if (i >= 0) {
+		sip->ss[i].nseeks++;
+		ss_down(sip, i);
+	} else if (sip->ss_nr < SS_NR) {
+		/* a count of 1 is never above its parent's */
+		i = sip->ss_nr++;
+		sip->ss[i].sectors = sectors;
+		sip->ss[i].nseeks = 1;
+		sip->ss[i].err = 0;
+		ss_hash_ins(sip, i);
+		for (; i > 0 && sip->ss[(i - 1) / 2].nseeks > 1; i = (i - 1) / 2)
+			ss_swap(sip, i, (i - 1) / 2);
+	} else {
+		/* take over the least frequent distance */
+		ss_hash_rem(sip, sip->ss[0].slot);
+		sip->ss[0].sectors = sectors;
+		sip->ss[0].err = sip->ss[0].nseeks;
+		sip->ss[0].nseeks++;
+		ss_hash_ins(sip, 0);
+		ss_down(sip, 0);
+		sip->evicted = 1;
+	}
+
+	lh_add(&sip->dist, sectors, 1);
+	if (sip->dist.n++ == 0 || (__u64)sectors < sip->dist.min)
+		sip->dist.min = sectors;
+	if ((__u64)sectors > sip->dist.max)
+		sip->dist.max = sectors;
+}
+
+static int ss_cmp(const void *a, const void *b)
+{
+	const struct seek_ss *x = a, *y = b;
+
+	return (x->sectors > y->sectors) - (x->sectors < y->sectors);
+}
+
 static void sps_emit(struct seeki *sip)
 {
 	double s_p_s;
@@ -109,7 +253,10 @@ static void sps_emit(struct seeki *sip)
 	else
 		s_p_s = (double)(sps->nseeks) / delta;
 
-	fprintf(sip->sps_fp, "%15.9lf %.2lf\n", sps->t_start, s_p_s);
+	if (sip->sps_bp)
+		bcol_add(sip->sps_bp, sps->t_start, s_p_s);
+	else
+		fprintf(sip->sps_fp, "%15.9lf %.2lf\n", sps->t_start, s_p_s);
 
 	sps->t_start = 0;
 	sps->nseeks = 0;
@@ -117,7 +264,7 @@ static void sps_emit(struct seeki *sip)
 
 static void sps_add(struct seeki *sip, double t)
 {
-	if (sip->sps_fp) {
+	if (sip->sps_fp || sip->sps_bp) {
 		struct sps_bkt *sps = &sip->sps;
 
 		if (sps->nseeks != 0 && ((t - sps->t_start) >= 1.0))
@@ -132,50 +279,61 @@ static void sps_add(struct seeki *sip, double t)
 	}
 }
 
-static int __median(struct rb_node *n, long long sofar, long long target,
+/*
+ * Walks the tree in order, summing counts until target is reached
+ */
+static int __median(struct rb_node *n, long long *sofar, long long target,
 		    long long *rvp)
 {
 	struct seek_bkt *sbp;
 
+	if (n->rb_left && __median(n->rb_left, sofar, target, rvp))
+		return 1;
+
 	sbp = rb_entry(n, struct seek_bkt, rb_node);
-	if ((sofar + sbp->nseeks) >= target) {
+	*sofar += sbp->nseeks;
+	if (*sofar >= target) {
 		*rvp = sbp->sectors;
 		return 1;
 	}
 
-	if (n->rb_left && __median(n->rb_left, sofar, target, rvp))
-		return 1;
-
 	if (n->rb_right && __median(n->rb_right, sofar, target, rvp))
 		return 1;
 
 	return 0;
-
 }
 
-static void __mode(struct rb_node *n, struct mode *mp)
+static void mode_add(struct mode *mp, long long sectors, int nseeks, int err)
 {
-	struct seek_bkt *sbp;
-
-	if (n->rb_left)
-		__mode(n->rb_left, mp);
-	if (n->rb_right)
-		__mode(n->rb_right, mp);
-
-	sbp = rb_entry(n, struct seek_bkt, rb_node);
 	if (mp->modes == NULL) {
 		mp->modes = malloc(sizeof(long long));
 		mp->nmds = 0;
-	} else if (sbp->nseeks > mp->most_seeks)
+	} else if (nseeks > mp->most_seeks)
 		mp->nmds = 0;
-	else if (sbp->nseeks == mp->most_seeks)
+	else if (nseeks == mp->most_seeks)
 		mp->modes = realloc(mp->modes, (mp->nmds + 1) *
 							sizeof(long long));
 	else
 		return;
 
-	mp->most_seeks = sbp->nseeks;
-	mp->modes[mp->nmds++] = sbp->sectors;
+	if (mp->nmds == 0 || err > mp->err)
+		mp->err = err;
+	mp->most_seeks = nseeks;
+	mp->modes[mp->nmds++] = sectors;
+}
+
+static void __mode(struct rb_node *n, struct mode *mp)
+{
+	struct seek_bkt *sbp;
+
+	if (n->rb_left)
+		__mode(n->rb_left, mp);
+
+	sbp = rb_entry(n, struct seek_bkt, rb_node);
+	mode_add(mp, sbp->sectors, sbp->nseeks, 0);
+
+	if (n->rb_right)
+		__mode(n->rb_right, mp);
 }
 
 long long seek_dist(struct seeki *sip, struct io *iop)
@@ -207,19 +365,38 @@ void *seeki_alloc(struct d_info *dip, char *post)
 	char str[256];
 	struct seeki *sip = malloc(sizeof(struct seeki));
 
-	sprintf(str, "%s%s", dip->dip_name, post);
-	sip->rfp = seek_open(str, 'r');
-	sip->wfp = seek_open(str, 'w');
-	sip->cfp = seek_open(str, 'c');
+	if (binary_data) {
+		sip->rfp = sip->wfp = sip->cfp = NULL;
+		sip->bp = bcol_alloc(strcmp(post, "_d2d") ? BC_Q2Q_SEEK :
+							    BC_D2D_SEEK, dip);
+	} else {
+		sprintf(str, "%s%s", dip->dip_name, post);
+		sip->rfp = seek_open(str, 'r');
+		sip->wfp = seek_open(str, 'w');
+		sip->cfp = seek_open(str, 'c');
+		sip->bp = NULL;
+	}
 	sip->tot_seeks = 0;
 	sip->total_sectors = 0.0;
 	sip->last_start = sip->last_end = 0;
 	memset(&sip->root, 0, sizeof(sip->root));
+	memset(sip->ss_hash, 0xff, sizeof(sip->ss_hash));
+	sip->ss_nr = sip->evicted = 0;
+	memset(&sip->dist, 0, sizeof(sip->dist));
 
-	if (sps_name) {
-		char *oname;
+	sip->sps_fp = NULL;
+	sip->sps_bp = NULL;
+	memset(&sip->sps, 0, sizeof(sip->sps));
 
-		memset(&sip->sps, 0, sizeof(sip->sps));
+	/*
+	 * The binary file takes D-to-D seeks only, rather than both seek
+	 * streams sharing one file
+	 */
+	if (sps_name && binary_data) {
+		if (!strcmp(post, "_d2d"))
+			sip->sps_bp = bcol_alloc(BC_SPS, dip);
+	} else if (sps_name) {
+		char *oname;
 
 		oname = malloc(strlen(sps_name) + strlen(dip->dip_name) + 32);
 		sprintf(oname, "%s_%s.dat", sps_name, dip->dip_name);
@@ -228,8 +405,7 @@ void *seeki_alloc(struct d_info *dip, char *post)
 			free(oname);
 		} else
 			add_file(sip->sps_fp, oname);
-	} else
-		sip->sps_fp = NULL;
+	}
 
 	return sip;
 }
@@ -238,13 +414,16 @@ void seeki_free(void *param)
 {
 	struct seeki *sip = param;
 
-	if (sip->sps_fp && sip->sps.nseeks != 0)
+	if ((sip->sps_fp || sip->sps_bp) && sip->sps.nseeks != 0)
 		sps_emit(sip);
+	bcol_free(sip->sps_bp);
+	bcol_free(sip->bp);
 
 	/*
 	 * Associated files are cleaned up by seek_clean
 	 */
 	__destroy(sip->root.rb_node);
+	free(sip->dist.hist);
 	free(sip);
 }
 
@@ -256,6 +435,8 @@ void seeki_add(void *handle, struct io *iop)
 	double tstamp = BIT_TIME(iop->t.time);
 	FILE *fp = IOP_READ(iop) ? sip->rfp : sip->wfp;
 
+	if (sip->bp)
+		bcol_add(sip->bp, tstamp, dist, rw == 'w');
 	if (fp)
 		fprintf(fp, "%15.9lf %13lld %c\n", tstamp, dist, rw);
 	if (sip->cfp)
@@ -264,7 +445,10 @@ void seeki_add(void *handle, struct io *iop)
 	dist = llabs(dist);
 	sip->tot_seeks++;
 	sip->total_sectors += dist;
-	__insert(&sip->root, dist);
+	if (exact_seeks)
+		__insert(&sip->root, dist, 1);
+	else
+		ss_add(sip, dist);
 
 	sps_add(sip, tstamp);
 }
@@ -280,26 +464,133 @@ double seeki_mean(void *handle)
 	return sip->total_sectors / sip->tot_seeks;
 }
 
+/*
+ * The table is sorted in place: only done once all seeks are in
+ */
+static void ss_sort(struct seeki *sip)
+{
+	int i;
+
+	qsort(sip->ss, sip->ss_nr, sizeof(*sip->ss), ss_cmp);
+	for (i = 0; i < sip->ss_nr; i++)
+		sip->ss_hash[sip->ss[i].slot] = i;
+}
+
 long long seeki_median(void *handle)
 {
-	long long rval = 0LL;
+	long long sofar = 0LL, rval = 0LL;
 	struct seeki *sip = handle;
-
-	if (sip->root.rb_node)
-		(void)__median(sip->root.rb_node, 0LL, sip->tot_seeks / 2,
-			       &rval);
+	int i;
+
+	if (exact_seeks) {
+		if (sip->root.rb_node)
+			(void)__median(sip->root.rb_node, &sofar,
+				       sip->tot_seeks / 2, &rval);
+	} else if (sip->evicted)
+		rval = lh_pct(&sip->dist, 50.0);
+	else {
+		ss_sort(sip);
+		for (i = 0; i < sip->ss_nr; i++) {
+			sofar += sip->ss[i].nseeks;
+			if (sofar >= sip->tot_seeks / 2) {
+				rval = sip->ss[i].sectors;
+				break;
+			}
+		}
+	}
 
 	return rval;
 }
 
+int seeki_approx(void *handle)
+{
+	return !exact_seeks && ((struct seeki *)handle)->evicted;
+}
+
 int seeki_mode(void *handle, struct mode *mp)
 {
 	struct seeki *sip = handle;
 	struct rb_root *root = &sip->root;
+	int i;
 
 	memset(mp, 0, sizeof(struct mode));
-	if (root->rb_node)
-		__mode(root->rb_node, mp);
+	if (exact_seeks) {
+		if (root->rb_node)
+			__mode(root->rb_node, mp);
+	} else {
+		ss_sort(sip);
+		for (i = 0; i < sip->ss_nr; i++)
+			mode_add(mp, sip->ss[i].sectors,
+				 sip->ss[i].nseeks - sip->ss[i].err,
+				 sip->ss[i].err);
+	}
 
 	return mp->nmds;
 }
+
+static void __ckpt_count(struct rb_node *n, __u64 *nr)
+{
+	if (n) {
+		(*nr)++;
+		__ckpt_count(n->rb_left, nr);
+		__ckpt_count(n->rb_right, nr);
+	}
+}
+
+static void __ckpt_save(FILE *fp, struct rb_node *n)
+{
+	if (n) {
+		struct seek_bkt *sbp = rb_entry(n, struct seek_bkt, rb_node);
+
+		__ckpt_save(fp, n->rb_left);
+		ckpt_put(fp, &sbp->sectors, sizeof(sbp->sectors));
+		ckpt_put(fp, &sbp->nseeks, sizeof(sbp->nseeks));
+		__ckpt_save(fp, n->rb_right);
+	}
+}
+
+void seeki_ckpt_save(FILE *fp, void *handle)
+{
+	struct seeki *sip = handle;
+	__u64 nr = 0;
+
+	ckpt_put(fp, &sip->tot_seeks, sizeof(sip->tot_seeks));
+	ckpt_put(fp, &sip->total_sectors, sizeof(sip->total_sectors));
+	ckpt_put(fp, &sip->last_start, sizeof(sip->last_start));
+	ckpt_put(fp, &sip->last_end, sizeof(sip->last_end));
+	ckpt_put(fp, &sip->ss_nr, sizeof(sip->ss_nr));
+	ckpt_put(fp, &sip->evicted, sizeof(sip->evicted));
+	ckpt_put(fp, sip->ss, sip->ss_nr * sizeof(*sip->ss));
+	ckpt_put(fp, sip->ss_hash, sizeof(sip->ss_hash));
+	ckpt_put_avg(fp, &sip->dist);
+
+	__ckpt_count(sip->root.rb_node, &nr);
+	ckpt_put(fp, &nr, sizeof(nr));
+	__ckpt_save(fp, sip->root.rb_node);
+}
+
+void seeki_ckpt_load(FILE *fp, void *handle)
+{
+	struct seeki *sip = handle;
+	__u64 nr;
+
+	ckpt_get(fp, &sip->tot_seeks, sizeof(sip->tot_seeks));
+	ckpt_get(fp, &sip->total_sectors, sizeof(sip->total_sectors));
+	ckpt_get(fp, &sip->last_start, sizeof(sip->last_start));
+	ckpt_get(fp, &sip->last_end, sizeof(sip->last_end));
+	ckpt_get(fp, &sip->ss_nr, sizeof(sip->ss_nr));
+	ckpt_get(fp, &sip->evicted, sizeof(sip->evicted));
+	ckpt_get(fp, sip->ss, sip->ss_nr * sizeof(*sip->ss));
+	ckpt_get(fp, sip->ss_hash, sizeof(sip->ss_hash));
+	ckpt_get_avg(fp, &sip->dist);
+
+	ckpt_get(fp, &nr, sizeof(nr));
+	while (nr--) {
+		long long sectors;
+		int nseeks;
+
+		ckpt_get(fp, &sectors, sizeof(sectors));
+		ckpt_get(fp, &nseeks, sizeof(nseeks));
+		__insert(&sip->root, sectors, nseeks);
+	}
+}
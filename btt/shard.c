@@ -0,0 +1,464 @@
+/*
+ * blktrace output analysis: generate a timeline & gather statistics
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/*
+ * Per-device sharding (-j): almost all of the work for a trace only
+ * touches its own device, so devices are spread over worker threads and
+ * each worker runs the usual trace_io() for its devices. The main thread
+ * keeps reading traces and hands them out in epochs; while the workers
+ * run one epoch the next is being filled.
+ *
+ * The few things shared between devices and sensitive to order (the
+ * system-wide Q2Q and ranges, per-process Q2Q and ranges, the sys rstat
+ * and live data) are logged by the workers tagged with the trace
+ * sequence number, and replayed in that order by the main thread once
+ * the epoch is done. Plain sums (the overall and per-process averages and
+ * the histograms) are kept per worker and merged at the end. Devices
+ * tied together by remaps are always kept on the same worker.
+ */
+#include <pthread.h>
+#include <semaphore.h>
+#include "globals.h"
+
+#define EPOCH_NR	8192	/* traces per worker per epoch */
+
+int n_shards = 1;
+__thread int shard_id;
+__thread __u64 cur_seq;
+
+enum sys_type { SYS_Q, SYS_Q_DM, SYS_C, SYS_LIVE };
+
+struct sys_rec {
+	__u64 seq;
+	enum sys_type type;
+	struct p_info *pip;
+	__u64 a, b;
+};
+
+struct slot {
+	struct io *iop;
+	__u64 seq;
+};
+
+struct shard {
+	pthread_t thread;
+	sem_t go, done;
+	int id, quit;
+
+	struct slot *fill, *run;
+	int fill_nr, run_nr;
+
+	struct sys_rec *recs;
+	int nrecs, recs_size, rec_idx;
+
+	struct list_head *free_ios;
+	void **free_pdus;
+	struct avgs_info *avgs;
+	__u64 *q_histo, *d_histo;
+};
+
+/*
+ * Devices are put in groups (union-find), each group runs on one shard
+ */
+struct dev_grp {
+	struct dev_grp *next;
+	__u32 device;
+	int grp;
+};
+
+static struct shard *shards;
+static __thread struct shard *my_shard;
+static int running, next_shard;
+
+#define N_GRP_HASH	128
+static struct dev_grp *grp_hash[N_GRP_HASH];
+static int *grp_parent, *grp_shard, grp_nr;
+
+static void sys_apply(struct sys_rec *rp)
+{
+	switch (rp->type) {
+	case SYS_Q:
+	case SYS_Q_DM:
+		update_qregion(&all_regions, rp->a);
+		if (rp->pip)
+			pip_update_q(rp->pip, rp->a, rp->type == SYS_Q_DM);
+		update_lq(&last_q, rp->type == SYS_Q_DM ? &all_avgs.q2q_dm :
+							   &all_avgs.q2q, rp->a);
+		break;
+	case SYS_C:
+		update_cregion(&all_regions, rp->a);
+		if (rp->pip)
+			update_cregion(&rp->pip->regions, rp->a);
+		rstat_add_sys(BIT_TIME(rp->a), rp->b);
+		break;
+	case SYS_LIVE:
+		p_live_add_sys(rp->a, rp->b);
+		break;
+	}
+}
+
+static void sys_log(enum sys_type type, struct p_info *pip, __u64 a, __u64 b)
+{
+	struct sys_rec rec = {
+		.seq = cur_seq,
+		.type = type,
+		.pip = pip,
+		.a = a,
+		.b = b,
+	};
+	struct shard *sp = my_shard;
+
+	if (!sp) {
+		sys_apply(&rec);
+		return;
+	}
+
+	if (sp->nrecs == sp->recs_size) {
+		sp->recs_size = sp->recs_size ? sp->recs_size * 2 : 1024;
+		sp->recs = realloc(sp->recs, sp->recs_size * sizeof(*sp->recs));
+	}
+	sp->recs[sp->nrecs++] = rec;
+}
+
+void sys_update_q(struct p_info *pip, __u64 time, int dm)
+{
+	sys_log(dm ? SYS_Q_DM : SYS_Q, pip, time, 0);
+}
+
+void sys_update_c(struct p_info *pip, __u64 time, __u64 nblks)
+{
+	sys_log(SYS_C, pip, time, nblks);
+}
+
+void sys_update_live(__u64 dt, __u64 ct)
+{
+	sys_log(SYS_LIVE, NULL, dt, ct);
+}
+
+/*
+ * Each shard's log is in sequence order already, merge them
+ */
+static void replay(void)
+{
+	int i;
+
+	for (;;) {
+		struct shard *best = NULL;
+
+		for (i = 0; i < n_shards; i++) {
+			struct shard *sp = &shards[i];
+
+			if (sp->rec_idx < sp->nrecs &&
+			    (!best || sp->recs[sp->rec_idx].seq <
+				      best->recs[best->rec_idx].seq))
+				best = sp;
+		}
+		if (!best)
+			break;
+		sys_apply(&best->recs[best->rec_idx++]);
+	}
+
+	for (i = 0; i < n_shards; i++)
+		shards[i].nrecs = shards[i].rec_idx = 0;
+}
+
+/*
+ * IOs and pdus are allocated by the main thread and freed by workers:
+ * hand them back.
+ */
+static void reclaim(void)
+{
+	int i;
+
+	for (i = 0; i < n_shards; i++) {
+		struct shard *sp = &shards[i];
+		void **tail;
+
+		if (!list_empty(sp->free_ios)) {
+			struct list_head *first = sp->free_ios->next;
+			struct list_head *last = sp->free_ios->prev;
+
+			last->next = free_ios.next;
+			free_ios.next->prev = last;
+			free_ios.next = first;
+			first->prev = &free_ios;
+			INIT_LIST_HEAD(sp->free_ios);
+		}
+
+		if (*sp->free_pdus) {
+			for (tail = *sp->free_pdus; *tail; tail = *tail)
+				;
+			*tail = free_pdus;
+			free_pdus = *sp->free_pdus;
+			*sp->free_pdus = NULL;
+		}
+	}
+}
+
+static void wait_shards(void)
+{
+	int i;
+
+	if (!running)
+		return;
+
+	for (i = 0; i < n_shards; i++)
+		sem_wait(&shards[i].done);
+	running = 0;
+
+	replay();
+	p_live_trim_sys();
+	reclaim();
+}
+
+static void launch(void)
+{
+	int i;
+
+	wait_shards();
+	for (i = 0; i < n_shards; i++) {
+		struct shard *sp = &shards[i];
+		struct slot *tmp = sp->run;
+
+		sp->run = sp->fill;
+		sp->run_nr = sp->fill_nr;
+		sp->fill = tmp;
+		sp->fill_nr = 0;
+		sem_post(&sp->go);
+	}
+	running = 1;
+}
+
+static void *shard_main(void *arg)
+{
+	struct shard *sp = arg;
+	int i;
+
+	shard_id = sp->id + 1;
+	my_shard = sp;
+	INIT_LIST_HEAD(&free_ios);
+	sp->free_ios = &free_ios;
+	sp->free_pdus = &free_pdus;
+	sp->avgs = &all_avgs;
+	sp->q_histo = q_histo;
+	sp->d_histo = d_histo;
+	sem_post(&sp->done);
+
+	for (;;) {
+		sem_wait(&sp->go);
+		if (sp->quit)
+			break;
+
+		for (i = 0; i < sp->run_nr; i++) {
+			cur_seq = sp->run[i].seq;
+			trace_io(sp->run[i].iop);
+		}
+		sem_post(&sp->done);
+	}
+
+	return NULL;
+}
+
+static int grp_find(int grp)
+{
+	while (grp_parent[grp] != grp)
+		grp = grp_parent[grp] = grp_parent[grp_parent[grp]];
+	return grp;
+}
+
+static int grp_new(void)
+{
+	if ((grp_nr & 63) == 0) {
+		grp_parent = realloc(grp_parent, (grp_nr + 64) * sizeof(int));
+		grp_shard = realloc(grp_shard, (grp_nr + 64) * sizeof(int));
+	}
+	grp_parent[grp_nr] = grp_nr;
+	grp_shard[grp_nr] = next_shard++ % n_shards;
+	return grp_nr++;
+}
+
+static inline struct dev_grp **grp_bucket(__u32 device)
+{
+	return &grp_hash[(MAJOR(device) ^ MINOR(device)) & (N_GRP_HASH - 1)];
+}
+
+static struct dev_grp *dev_grp_find(__u32 device)
+{
+	struct dev_grp *dgp;
+
+	for (dgp = *grp_bucket(device); dgp; dgp = dgp->next)
+		if (dgp->device == device)
+			return dgp;
+
+	return NULL;
+}
+
+static struct dev_grp *dev_grp_add(__u32 device, int grp)
+{
+	struct dev_grp **head = grp_bucket(device);
+	struct dev_grp *dgp = malloc(sizeof(*dgp));
+
+	dgp->device = device;
+	dgp->grp = grp;
+	dgp->next = *head;
+	*head = dgp;
+	return dgp;
+}
+
+/*
+ * A remap looks up the IO on the device it came from: tie both devices
+ * to one shard. Moving a group elsewhere needs the shards to be idle.
+ */
+static void shard_link(struct io *iop, struct dev_grp *to)
+{
+	struct blk_io_trace_remap *rp = iop->pdu;
+	struct dev_grp *from;
+	int fg, tg;
+
+	if (ignore_remaps || !rp || iop->pdu_len < sizeof(*rp))
+		return;
+
+	from = dev_grp_find(be32_to_cpu(rp->device_from));
+	if (!from) {
+		dev_grp_add(be32_to_cpu(rp->device_from), to->grp);
+		return;
+	}
+
+	fg = grp_find(from->grp);
+	tg = grp_find(to->grp);
+	if (fg == tg)
+		return;
+
+	if (grp_shard[fg] != grp_shard[tg])
+		shard_sync();
+	grp_parent[fg] = tg;
+}
+
+void shard_dispatch(struct io *iop)
+{
+	struct dev_grp *dgp = dev_grp_find(iop->t.device);
+	struct shard *sp;
+
+	if (!dgp)
+		dgp = dev_grp_add(iop->t.device, grp_new());
+
+	if ((iop->t.action & 0xffff) == __BLK_TA_REMAP)
+		shard_link(iop, dgp);
+
+	sp = &shards[grp_shard[grp_find(dgp->grp)]];
+	sp->fill[sp->fill_nr].iop = iop;
+	sp->fill[sp->fill_nr].seq = cur_seq;
+	if (++sp->fill_nr == EPOCH_NR)
+		launch();
+}
+
+/*
+ * Devices are set up by whichever shard sees them first: put them back in
+ * the order a single thread would have found them.
+ */
+static void sort_devs(void)
+{
+	struct list_head *p, *q, *r;
+
+	list_for_each_safe(p, q, &all_devs) {
+		struct d_info *dip = list_entry(p, struct d_info, all_head);
+
+		for (r = p->prev; r != &all_devs; r = r->prev)
+			if (list_entry(r, struct d_info, all_head)->first_seq <
+								dip->first_seq)
+				break;
+		if (r != p->prev) {
+			list_del(p);
+			list_add(p, r);
+		}
+	}
+}
+
+void shard_sync(void)
+{
+	if (n_shards <= 1)
+		return;
+
+	launch();
+	wait_shards();
+	sort_devs();
+}
+
+void shard_start(void)
+{
+	int i;
+
+	shards = calloc(n_shards, sizeof(*shards));
+	for (i = 0; i < n_shards; i++) {
+		struct shard *sp = &shards[i];
+
+		sp->id = i;
+		sp->fill = malloc(EPOCH_NR * sizeof(*sp->fill));
+		sp->run = malloc(EPOCH_NR * sizeof(*sp->run));
+		sem_init(&sp->go, 0, 0);
+		sem_init(&sp->done, 0, 0);
+		if (pthread_create(&sp->thread, NULL, shard_main, sp)) {
+			perror("pthread_create");
+			exit(1);
+		}
+		sem_wait(&sp->done);
+	}
+}
+
+void shard_finish(void)
+{
+	int i, j;
+
+	shard_sync();
+	for (i = 0; i < n_shards; i++) {
+		struct shard *sp = &shards[i];
+
+		avgs_merge(&all_avgs, sp->avgs);
+		lh_free(sp->avgs);
+		for (j = 0; j < N_HIST_BKTS; j++) {
+			q_histo[j] += sp->q_histo[j];
+			d_histo[j] += sp->d_histo[j];
+		}
+	}
+	pip_merge_shards();
+
+	for (i = 0; i < n_shards; i++) {
+		struct shard *sp = &shards[i];
+
+		sp->quit = 1;
+		sem_post(&sp->go);
+		pthread_join(sp->thread, NULL);
+		sem_destroy(&sp->go);
+		sem_destroy(&sp->done);
+		free(sp->fill);
+		free(sp->run);
+		free(sp->recs);
+	}
+	free(shards);
+
+	for (i = 0; i < N_GRP_HASH; i++)
+		while (grp_hash[i]) {
+			struct dev_grp *dgp = grp_hash[i];
+
+			grp_hash[i] = dgp->next;
+			free(dgp);
+		}
+	free(grp_parent);
+	free(grp_shard);
+}
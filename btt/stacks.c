@@ -0,0 +1,292 @@
+/*
+ * blktrace output analysis: generate a timeline & gather statistics
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/*
+ * Per-stack latency breakdowns (-k). An IO on a remapping device (dm, md)
+ * is handed down as a remap (A) and a new Q on the device below, maybe
+ * several times over. The remap is kept until that Q shows up, which
+ * then carries a link (device and sector) to the Q it came from; both
+ * are found through the exact sector hashes, so the cost per IO does not
+ * grow with the number in flight.
+ *
+ * As each linked Q completes, its time is split into the part spent
+ * before the layer below saw it ("down": its Q to the lower Q, or Q2D on
+ * the bottom device) and after ("up": the lower C to its own C, or D2C).
+ * The record is then handed to the Q above, which keeps the last of its
+ * pieces to complete - the one that decided its completion time. Once
+ * the top of the stack completes, the whole chain is added to the stats
+ * for its sequence of devices.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "globals.h"
+
+#define N_LAYERS_MAX	8
+
+/*
+ * Hung off a Q in its (otherwise unused) pdu, so it comes from the pdu
+ * slabs and goes when the Q does
+ */
+struct chain {
+	struct chain *below;	/* last piece below to complete */
+	__u64 up_sec;		/* the Q this one was remapped from */
+	__u32 up_dev;
+	__u32 dev;
+	__u64 q_time, c_time;
+	__u64 down, up;
+};
+
+struct stack_info {
+	struct list_head head;
+	int n_layers;
+	__u32 devs[N_LAYERS_MAX];
+	struct avg_info q2c;
+	struct avg_info down[N_LAYERS_MAX], up[N_LAYERS_MAX];
+};
+
+struct stacks_info {
+	struct list_head stacks;
+	unsigned long n_deep;	/* chains too deep to keep */
+};
+
+int do_stacks;
+
+void *stacks_alloc(void)
+{
+	struct stacks_info *sip;
+
+	if (!do_stacks)
+		return NULL;
+
+	sip = malloc(sizeof(*sip));
+	INIT_LIST_HEAD(&sip->stacks);
+	sip->n_deep = 0;
+	return sip;
+}
+
+void stacks_free(void *info)
+{
+	struct stacks_info *sip = info;
+	struct list_head *p, *q;
+
+	if (!sip)
+		return;
+
+	list_for_each_safe(p, q, &sip->stacks) {
+		struct stack_info *stp = list_entry(p, struct stack_info, head);
+		int i;
+
+		list_del(&stp->head);
+		free(stp->q2c.hist);
+		for (i = 0; i < stp->n_layers; i++) {
+			free(stp->down[i].hist);
+			free(stp->up[i].hist);
+		}
+		free(stp);
+	}
+	free(sip);
+}
+
+static inline struct chain *chain_get(struct io *q_iop)
+{
+	struct chain *cp = q_iop->pdu;
+
+	if (!cp) {
+		cp = pdu_alloc(sizeof(*cp));
+		memset(cp, 0, sizeof(*cp));
+		q_iop->pdu = cp;
+		q_iop->pdu_len = sizeof(*cp);
+	}
+	return cp;
+}
+
+static void chain_put(struct chain *cp)
+{
+	while (cp) {
+		struct chain *below = cp->below;
+
+		pdu_free(cp, sizeof(*cp));
+		cp = below;
+	}
+}
+
+static inline struct chain *chain_take(struct io *q_iop)
+{
+	struct chain *cp = q_iop->pdu;
+
+	q_iop->pdu = NULL;
+	q_iop->pdu_len = 0;
+	return cp;
+}
+
+/*
+ * A new Q: was it just remapped here from a device above?
+ */
+void stacks_queue(struct io *q_iop)
+{
+	struct io *a_iop = dip_find_sec(q_iop->dip, IOP_A, q_iop->t.sector);
+	struct blk_io_trace_remap *rp;
+	struct chain *cp;
+
+	if (!a_iop)
+		return;
+
+	rp = a_iop->pdu;
+	cp = chain_get(q_iop);
+	cp->up_dev = rp->device_from;
+	cp->up_sec = rp->sector_from;
+	io_release(a_iop);
+}
+
+static struct stack_info *stack_find(struct stacks_info *sip, __u32 *devs,
+				     int n_layers)
+{
+	struct stack_info *stp;
+	struct list_head *p;
+
+	__list_for_each(p, &sip->stacks) {
+		stp = list_entry(p, struct stack_info, head);
+		if (stp->n_layers == n_layers &&
+		    !memcmp(stp->devs, devs, n_layers * sizeof(*devs)))
+			return stp;
+	}
+
+	stp = malloc(sizeof(*stp));
+	memset(stp, 0, sizeof(*stp));
+	stp->n_layers = n_layers;
+	memcpy(stp->devs, devs, n_layers * sizeof(*devs));
+	list_add_tail(&stp->head, &sip->stacks);
+	return stp;
+}
+
+static void stack_add(struct stacks_info *sip, struct chain *top)
+{
+	__u32 devs[N_LAYERS_MAX];
+	struct stack_info *stp;
+	struct chain *cp;
+	int i, n = 0;
+
+	for (cp = top; cp; cp = cp->below) {
+		if (n == N_LAYERS_MAX) {
+			sip->n_deep++;
+			return;
+		}
+		devs[n++] = cp->dev;
+	}
+
+	stp = stack_find(sip, devs, n);
+	avg_update(&stp->q2c, tdelta(top->q_time, top->c_time));
+	for (i = 0, cp = top; cp; i++, cp = cp->below) {
+		avg_update(&stp->down[i], cp->down);
+		avg_update(&stp->up[i], cp->up);
+	}
+}
+
+/*
+ * q_iop has completed with c_iop: split its time and pass it up
+ */
+void stacks_complete(struct io *q_iop, struct io *c_iop)
+{
+	struct chain *cp = q_iop->pdu, *upc;
+	struct d_info *up_dip;
+	struct io *up_iop;
+
+	if (cp->below) {
+		cp->down = tdelta(q_iop->t.time, cp->below->q_time);
+		cp->up = tdelta(cp->below->c_time, c_iop->t.time);
+	} else {
+		__u64 d_time = iop_time(q_iop, IOT_D);
+
+		if (d_time == (__u64)-1)
+			return;
+		cp->down = tdelta(q_iop->t.time, d_time);
+		cp->up = tdelta(d_time, c_iop->t.time);
+	}
+	cp->dev = q_iop->t.device;
+	cp->q_time = q_iop->t.time;
+	cp->c_time = c_iop->t.time;
+
+	if (!cp->up_dev) {
+		if (cp->below)
+			stack_add(q_iop->dip->stacks_handle, cp);
+		chain_put(chain_take(q_iop));
+		return;
+	}
+
+	up_dip = __dip_find(cp->up_dev);
+	up_iop = up_dip ? dip_find_sec(up_dip, IOP_Q, cp->up_sec) : NULL;
+	if (!up_iop) {
+		chain_put(chain_take(q_iop));
+		return;
+	}
+
+	upc = chain_get(up_iop);
+	if (upc->below && upc->below->c_time > cp->c_time) {
+		chain_put(chain_take(q_iop));
+		return;
+	}
+	chain_put(upc->below);
+	upc->below = chain_take(q_iop);
+}
+
+void output_stacks(FILE *ofp, struct d_info *dip)
+{
+	struct stacks_info *sip;
+	struct list_head *p;
+	char hdr[32];
+	int i;
+
+	if (dip == NULL)	/* -D names a device not in the trace */
+		return;
+
+	sip = dip->stacks_handle;
+	if (!sip)
+		return;
+
+	__list_for_each(p, &sip->stacks) {
+		struct stack_info *stp = list_entry(p, struct stack_info, head);
+
+		fprintf(ofp, "Stack:");
+		for (i = 0; i < stp->n_layers; i++)
+			fprintf(ofp, "%s(%3d,%3d)", i ? " > " : " ",
+				MAJOR(stp->devs[i]), MINOR(stp->devs[i]));
+		fprintf(ofp, "\n");
+
+		output_hdr(ofp, "LAYER");
+		__output_avg(ofp, "Q2C", &stp->q2c, NULL);
+		for (i = 0; i < stp->n_layers; i++) {
+			int bottom = (i == stp->n_layers - 1);
+
+			sprintf(hdr, "(%3d,%3d) %s", MAJOR(stp->devs[i]),
+				MINOR(stp->devs[i]), bottom ? "Q2D" : "dn");
+			__output_avg(ofp, hdr, &stp->down[i], NULL);
+			sprintf(hdr, "(%3d,%3d) %s", MAJOR(stp->devs[i]),
+				MINOR(stp->devs[i]), bottom ? "D2C" : "up");
+			__output_avg(ofp, hdr, &stp->up[i], NULL);
+		}
+		fprintf(ofp, "\n");
+	}
+
+	if (sip->n_deep)
+		fprintf(ofp, "(%3d,%3d): %lu IOs remapped more than %d deep "
+			"left out\n\n", MAJOR(dip->device), MINOR(dip->device),
+			sip->n_deep, N_LAYERS_MAX);
+}
@@ -20,22 +20,10 @@
  */
 #include "globals.h"
 
-static void __add_trace(struct io *iop)
-{
-	time_t now = time(NULL);
-
-	last_t_seen = BIT_TIME(iop->t.time);
-
-	n_traces++;
-	iostat_check_time(iop->t.time);
-
-	if (verbose && ((now - last_vtrace) > 0)) {
-		printf("%10lu t (%6.2lf%%)\r", n_traces, pct_done());
-		if ((n_traces % 1000000) == 0) printf("\n");
-		fflush(stdout);
-		last_vtrace = now;
-	}
+__u64 trace_seq;
 
+void trace_io(struct io *iop)
+{
 	switch (iop->t.action & 0xffff) {
 	case __BLK_TA_QUEUE:		trace_queue(iop); break;
 	case __BLK_TA_REMAP:		trace_remap(iop); break;
@@ -56,16 +44,40 @@ static void __add_trace(struct io *iop)
 	}
 }
 
+static void __add_trace(struct io *iop)
+{
+	time_t now = time(NULL);
+
+	last_t_seen = BIT_TIME(iop->t.time);
+
+	n_traces++;
+	iostat_check_time(iop->t.time);
+	if (cull_horizon > 0.0)
+		dip_cull_check(iop->t.time);
+
+	if (verbose && ((now - last_vtrace) > 0)) {
+		printf("%10lu t (%6.2lf%%)\r", n_traces, pct_done());
+		if ((n_traces % 1000000) == 0) printf("\n");
+		fflush(stdout);
+		last_vtrace = now;
+	}
+
+	if (n_shards > 1)
+		shard_dispatch(iop);
+	else
+		trace_io(iop);
+}
+
 static void trace_message(struct io *iop)
 {
 	char scratch[15];
-	char msg[iop->t.pdu_len + 1];
+	char msg[iop->pdu_len + 1];
 
 	if (!io_setup(iop, IOP_M))
 		return;
 
-	memcpy(msg, iop->pdu, iop->t.pdu_len);
-	msg[iop->t.pdu_len] = '\0';
+	memcpy(msg, iop->pdu, iop->pdu_len);
+	msg[iop->pdu_len] = '\0';
 
 	fprintf(msgs_ofp, "%s %5d.%09lu %s\n",
 		make_dev_hdr(scratch, 15, iop->dip, 1),
@@ -75,7 +87,9 @@ static void trace_message(struct io *iop)
 
 void add_trace(struct io *iop)
 {
+	cur_seq = ++trace_seq;
 	if (iop->t.action & BLK_TC_ACT(BLK_TC_NOTIFY)) {
+		shard_sync();
 		if (iop->t.action == BLK_TN_PROCESS) {
 			if (iop->t.pid == 0)
 				process_alloc(0, "kernel");
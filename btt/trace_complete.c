@@ -23,86 +23,122 @@
 static inline void __out(FILE *ofp, __u64 tm, enum iop_type type,
 					__u64 sec, __u32 nsec, int indent)
 {
-	if (tm != (__u64)-1) {
-		if (indent)
-			fprintf(ofp, "         ");
-		fprintf(ofp, "%5d.%09lu %c %10llu+%-4u\n",
+	if (tm != (__u64)-1)
+		fprintf(ofp, "%s%5d.%09lu %c %10llu+%-4u\n",
+			indent ? "         " : "",
 			(int)SECONDS(tm), (unsigned long)NANO_SECONDS(tm),
 			type2c(type), (unsigned long long)sec, nsec);
-	}
 }
 
-static void display_io_track(FILE *ofp, struct io *iop)
+static void display_io_track(FILE *ofp, struct io *iop, struct io *c_iop)
 {
+	__u64 d_time = iop_time(iop, IOT_D);
+
 	fprintf(ofp, "%3d,%-3d: ", MAJOR(iop->t.device), MINOR(iop->t.device));
 	__out(ofp, iop->t.time, IOP_Q, iop->t.sector, t_sec(&iop->t), 0);
 
-	if (iop->g_time != (__u64)-1)
-		__out(ofp, iop->g_time, IOP_G, iop->t.sector, t_sec(&iop->t),1);
-	if (iop->i_time != (__u64)-1)
-		__out(ofp, iop->i_time, IOP_I, iop->t.sector, t_sec(&iop->t),1);
-	if (iop->m_time != (__u64)-1)
-		__out(ofp, iop->m_time, IOP_M, iop->t.sector, t_sec(&iop->t),1);
+	__out(ofp, iop_time(iop, IOT_G), IOP_G, iop->t.sector, t_sec(&iop->t),1);
+	__out(ofp, iop_time(iop, IOT_I), IOP_I, iop->t.sector, t_sec(&iop->t),1);
+	__out(ofp, iop_time(iop, IOT_M), IOP_M, iop->t.sector, t_sec(&iop->t),1);
 
-	__out(ofp, iop->d_time, IOP_D, iop->d_sec, iop->d_nsec, 1);
-	__out(ofp, iop->c_time, IOP_C, iop->c_sec, iop->c_nsec, 1);
+	if (d_time != (__u64)-1)
+		__out(ofp, d_time, IOP_D, iop->cold->d_sec,
+		      iop->cold->d_nsec, 1);
+	__out(ofp, c_iop->t.time, IOP_C, c_iop->t.sector, t_sec(&c_iop->t), 1);
 	fprintf(ofp, "\n");
 }
 
+/*
+ * G, I, M and D go in as 32-bit offsets from the Q: ~0 if not seen, and
+ * capped just below that (at ~4.29 seconds)
+ */
+static inline unsigned int pio_delta(__u64 q_time, __u64 tm)
+{
+	if (tm == (__u64)-1)
+		return ~0U;
+	if (tm < q_time)
+		return 0;
+	return (tm - q_time < ~0U) ? (unsigned int)(tm - q_time) : ~0U - 1;
+}
+
+static void add_io_track(struct bcol_buf *bp, struct io *iop, struct io *c_iop)
+{
+	__u64 q_time = iop->t.time;
+	__u64 d_time = iop_time(iop, IOT_D);
+	int has_d = d_time != (__u64)-1;
+
+	bcol_add(bp, q_time, iop->t.sector, t_sec(&iop->t),
+		 pio_delta(q_time, iop_time(iop, IOT_G)),
+		 pio_delta(q_time, iop_time(iop, IOT_I)),
+		 pio_delta(q_time, iop_time(iop, IOT_M)),
+		 pio_delta(q_time, d_time),
+		 c_iop->t.time - q_time,
+		 has_d ? iop->cold->d_sec : (__u64)0,
+		 has_d ? iop->cold->d_nsec : 0U,
+		 c_iop->t.sector, t_sec(&c_iop->t));
+}
+
 static void handle_complete(struct io *c_iop)
 {
 	LIST_HEAD(head);
 	struct list_head *p, *q;
-	__u64 d_time = (__u64)-1;
+	__u64 g_time = (__u64)-1, d_time = (__u64)-1;
 	FILE *pit_fp = c_iop->dip->pit_fp;
 	double cur = BIT_TIME(c_iop->t.time);
 
 	update_blks(c_iop);
-	update_cregion(&all_regions, c_iop->t.time);
 	update_cregion(&c_iop->dip->regions, c_iop->t.time);
-	if (c_iop->pip)
-		update_cregion(&c_iop->pip->regions, c_iop->t.time);
 	aqd_complete(c_iop->dip->aqd_handle, cur);
 	rstat_add(c_iop->dip->rstat_handle, cur, c_iop->t.bytes >> 9);
+	sys_update_c(c_iop->pip, c_iop->t.time, c_iop->t.bytes >> 9);
 
 	dip_foreach_list(c_iop, IOP_Q, &head);
 	list_for_each_safe(p, q, &head) {
 		struct io *q_iop = list_entry(p, struct io, f_head);
 		__u64 q2c = tdelta(q_iop->t.time, c_iop->t.time);
 
-		c_iop->bytes_left -= q_iop->t.bytes;
-
 		update_q2c(q_iop, q2c);
 		latency_q2c(q_iop->dip, q_iop->t.time, q2c);
 
-		if (q_iop->d_time != (__u64)-1) {
-			__u64 d2c = tdelta(q_iop->d_time, c_iop->t.time);
+		if (iop_time(q_iop, IOT_G) != (__u64)-1)
+			g_time = iop_time(q_iop, IOT_G);
+
+		if (iop_time(q_iop, IOT_D) != (__u64)-1) {
+			__u64 d2c;
+
+			d_time = iop_time(q_iop, IOT_D);
+			d2c = tdelta(d_time, c_iop->t.time);
 
-			p_live_add(q_iop->dip, q_iop->d_time, c_iop->t.time);
+			p_live_add(q_iop->dip, d_time, c_iop->t.time);
+			sys_update_live(d_time, c_iop->t.time);
 			update_d2c(q_iop, d2c);
 			latency_d2c(q_iop->dip, c_iop->t.time, d2c);
 			iostat_complete(q_iop, c_iop);
-
-			d_time = q_iop->d_time;
 		}
 
-		if (per_io_ofp) {
-			q_iop->c_time = c_iop->t.time;
-			q_iop->c_sec = c_iop->t.sector;
-			q_iop->c_nsec = t_sec(&c_iop->t);
-			display_io_track(per_io_ofp, q_iop);
-		}
+		if (per_io_ofp)
+			display_io_track(per_io_ofp, q_iop, c_iop);
+		else if (q_iop->dip->per_io_bp)
+			add_io_track(q_iop->dip->per_io_bp, q_iop, c_iop);
 
-		if (q_iop->dip->pit_fp) {
+		if (q_iop->dip->pit_bp)
+			bcol_add(q_iop->dip->pit_bp, q_iop->t.time,
+				 iop_time(q_iop, IOT_D), c_iop->t.time);
+		else if (q_iop->dip->pit_fp) {
 			fprintf(pit_fp, "%d.%09lu ",
 				(int)SECONDS(q_iop->t.time),
 				(unsigned long)NANO_SECONDS(q_iop->t.time));
 		}
 
+		if (do_stacks && q_iop->pdu)
+			stacks_complete(q_iop, c_iop);
+
 		list_del(&q_iop->f_head);
 		io_release(q_iop);
 	}
 
+	iostat_complete_rq(c_iop, g_time, d_time);
+
 	if (per_io_ofp)
 		fprintf(per_io_ofp,
 			"-----------------------------------------\n");
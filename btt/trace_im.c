@@ -28,10 +28,12 @@ static void handle_g(struct io *g_iop)
 
 	q_iop = dip_find_sec(g_iop->dip, IOP_Q, g_iop->t.sector);
 	if (q_iop) {
-		q_iop->g_time = g_iop->t.time;
+		__u64 s_time = iop_time(q_iop, IOT_S);
+
+		iop_set_time(q_iop, IOT_G, g_iop->t.time);
 		update_q2g(q_iop, tdelta(q_iop->t.time, g_iop->t.time));
-		if (q_iop->s_time != 0)
-			update_s2g(q_iop, tdelta(q_iop->s_time, g_iop->t.time));
+		if (s_time != (__u64)-1)
+			update_s2g(q_iop, tdelta(s_time, g_iop->t.time));
 	}
 }
 
@@ -40,7 +42,7 @@ static void handle_s(struct io *s_iop)
 	struct io *q_iop = dip_find_sec(s_iop->dip, IOP_Q, s_iop->t.sector);
 
 	if (q_iop)
-		q_iop->s_time = s_iop->t.time;
+		iop_set_time(q_iop, IOT_S, s_iop->t.time);
 }
 
 static void handle_i(struct io *i_iop)
@@ -48,9 +50,11 @@ static void handle_i(struct io *i_iop)
 	struct io *q_iop = dip_find_sec(i_iop->dip, IOP_Q, i_iop->t.sector);
 
 	if (q_iop) {
-		q_iop->i_time = i_iop->t.time;
-		if (q_iop->g_time != (__u64)-1)
-			update_g2i(q_iop, tdelta(q_iop->g_time, i_iop->t.time));
+		__u64 g_time = iop_time(q_iop, IOT_G);
+
+		iop_set_time(q_iop, IOT_I, i_iop->t.time);
+		if (g_time != (__u64)-1)
+			update_g2i(q_iop, tdelta(g_time, i_iop->t.time));
 	}
 }
 
@@ -62,7 +66,7 @@ static void handle_m(struct io *m_iop)
 
 	q_iop = dip_find_sec(m_iop->dip, IOP_Q, m_iop->t.sector);
 	if (q_iop) {
-		q_iop->m_time = m_iop->t.time;
+		iop_set_time(q_iop, IOT_M, m_iop->t.time);
 		update_q2m(q_iop, tdelta(q_iop->t.time, m_iop->t.time));
 	}
 
@@ -40,17 +40,24 @@ static void handle_issue(struct io *d_iop)
 	list_for_each_safe(p, q, &head) {
 		struct io *q_iop = list_entry(p, struct io, f_head);
 
-		if (q_iop->i_time != (__u64)-1)
-			update_i2d(q_iop, tdelta(q_iop->i_time, d_iop->t.time));
-		else if (q_iop->m_time != (__u64)-1)
-			update_m2d(q_iop, tdelta(q_iop->m_time, d_iop->t.time));
+		__u64 i_time = iop_time(q_iop, IOT_I);
+		__u64 m_time = iop_time(q_iop, IOT_M);
+
+		if (i_time != (__u64)-1)
+			update_i2d(q_iop, tdelta(i_time, d_iop->t.time));
+		else if (m_time != (__u64)-1)
+			update_m2d(q_iop, tdelta(m_time, d_iop->t.time));
 
-		d_iop->bytes_left -= q_iop->t.bytes;
 		list_del(&q_iop->f_head);
 
-		q_iop->d_time = d_iop->t.time;
-		q_iop->d_sec = d_iop->t.sector;
-		q_iop->d_nsec = t_sec(&d_iop->t);
+		if (iop_time(q_iop, IOT_D) != (__u64)-1)
+			p_live_drop(q_iop->dip, iop_time(q_iop, IOT_D));
+		p_live_issue(q_iop->dip, d_iop->t.time);
+		iop_set_time(q_iop, IOT_D, d_iop->t.time);
+		if (per_io_name) {
+			io_cold(q_iop)->d_sec = d_iop->t.sector;
+			q_iop->cold->d_nsec = t_sec(&d_iop->t);
+		}
 
 		if (output_all_data)
 			q2d_histo_add(q_iop->dip->q2d_priv,
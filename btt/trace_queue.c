@@ -22,20 +22,18 @@
 
 static void handle_queue(struct io *q_iop)
 {
+	int dm = remapper_dev(q_iop->t.device);
+
 	seeki_add(q_iop->dip->q2q_handle, q_iop);
-	update_qregion(&all_regions, q_iop->t.time);
 	dip_update_q(q_iop->dip, q_iop);
-	pip_update_q(q_iop);
-	if (remapper_dev(q_iop->t.device))
-		update_lq(&last_q, &all_avgs.q2q_dm, q_iop->t.time);
-	else {
+	sys_update_q(q_iop->pip, q_iop->t.time, dm);
+	if (!dm)
 		update_q_histo(q_iop->t.bytes);
-		update_lq(&last_q, &all_avgs.q2q, q_iop->t.time);
-	}
 
-	q_iop->i_time = q_iop->g_time = q_iop->c_time = q_iop->m_time =
-						q_iop->d_time = (__u64)-1;
+	iop_clear_times(q_iop);
 	q_iop->dip->n_qs++;
+	if (do_stacks)
+		stacks_queue(q_iop);
 
 	q_iop->dip->t_act_q += q_iop->dip->n_act_q;
 	q_iop->dip->n_act_q++;
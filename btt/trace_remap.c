@@ -34,7 +34,7 @@ static inline void cvt_pdu_remap(struct blk_io_trace_remap *rp)
 void trace_remap(struct io *a_iop)
 {
 	struct io *q_iop;
-	struct d_info *q_dip;
+	struct d_info *q_dip, *a_dip;
 	struct blk_io_trace_remap *rp;
 
 	if (ignore_remaps)
@@ -43,6 +43,17 @@ void trace_remap(struct io *a_iop)
 	rp = a_iop->pdu;
 	cvt_pdu_remap(rp);
 
+	/*
+	 * With -k the remap is kept for the Q it turns into (see stacks.c);
+	 * one left over from before at the same sector is stale by now
+	 */
+	if (do_stacks && (a_dip = __dip_find(a_iop->t.device)) != NULL) {
+		struct io *old = dip_find_sec(a_dip, IOP_A, a_iop->t.sector);
+
+		if (old)
+			io_release(old);
+	}
+
 	if (!io_setup(a_iop, IOP_A))
 		goto out;
 
@@ -51,8 +62,11 @@ void trace_remap(struct io *a_iop)
 		goto out;
 
 	q_iop = dip_find_sec(q_dip, IOP_Q, rp->sector_from);
-	if (q_iop)
+	if (q_iop) {
 		update_q2a(q_iop, tdelta(q_iop->t.time, a_iop->t.time));
+		if (do_stacks)
+			return;
+	}
 
 out:
 	io_release(a_iop);